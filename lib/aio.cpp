@@ -0,0 +1,534 @@
+#include "libfilezilla/aio.hpp"
+#include "libfilezilla/event_handler.hpp"
+#include "libfilezilla/mutex.hpp"
+#include "libfilezilla/thread_pool.hpp"
+
+#include <algorithm>
+#include <deque>
+#include <memory>
+#include <vector>
+
+#ifndef FZ_WINDOWS
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#if HAVE_LINUX_IO_URING_H
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include <string.h>
+#endif
+
+namespace fz {
+
+/// \private
+/// This instantiation must be a public symbol
+template class simple_event<aio_event_type, aio_id, int64_t>;
+
+namespace {
+enum class aio_type
+{
+	read,
+	write,
+	fsync,
+	open
+};
+
+struct aio_op final
+{
+	aio_id id_{};
+	event_handler* handler_{};
+	aio_type type_{};
+
+	file* file_{};
+	void* buf_{};
+	int64_t count_{};
+	int64_t offset_{};
+
+	native_string name_;
+	file::mode mode_{};
+	file::creation_flags creation_{};
+};
+
+#if HAVE_LINUX_IO_URING_H
+// Upper bound for the number of operations in flight with io_uring
+size_t const max_ring_size = 4096;
+
+// Minimal io_uring wrapper using the raw system calls, so that we do not depend on liburing.
+class uring final
+{
+public:
+	uring() = default;
+
+	~uring()
+	{
+		if (sqes_) {
+			munmap(sqes_, sqes_size_);
+		}
+		if (cq_ptr_ && cq_ptr_ != sq_ptr_) {
+			munmap(cq_ptr_, cq_size_);
+		}
+		if (sq_ptr_) {
+			munmap(sq_ptr_, sq_size_);
+		}
+		if (fd_ != -1) {
+			close(fd_);
+		}
+	}
+
+	uring(uring const&) = delete;
+	uring& operator=(uring const&) = delete;
+
+	bool init(unsigned int entries)
+	{
+		io_uring_params p{};
+		fd_ = static_cast<int>(syscall(__NR_io_uring_setup, entries, &p));
+		if (fd_ == -1) {
+			return false;
+		}
+
+		// IORING_OP_READ, IORING_OP_WRITE and IORING_OP_OPENAT appeared together with this feature flag
+		if (!(p.features & IORING_FEAT_RW_CUR_POS)) {
+			return false;
+		}
+
+		sq_size_ = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+		cq_size_ = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+		bool const single_mmap = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+		if (single_mmap) {
+			sq_size_ = cq_size_ = std::max(sq_size_, cq_size_);
+		}
+
+		sq_ptr_ = mmap(nullptr, sq_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQ_RING);
+		if (sq_ptr_ == MAP_FAILED) {
+			sq_ptr_ = nullptr;
+			return false;
+		}
+		if (single_mmap) {
+			cq_ptr_ = sq_ptr_;
+		}
+		else {
+			cq_ptr_ = mmap(nullptr, cq_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_CQ_RING);
+			if (cq_ptr_ == MAP_FAILED) {
+				cq_ptr_ = nullptr;
+				return false;
+			}
+		}
+
+		sqes_size_ = p.sq_entries * sizeof(io_uring_sqe);
+		void* sqes = mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQES);
+		if (sqes == MAP_FAILED) {
+			return false;
+		}
+		sqes_ = static_cast<io_uring_sqe*>(sqes);
+
+		char* sq = static_cast<char*>(sq_ptr_);
+		sq_tail_ = reinterpret_cast<unsigned int*>(sq + p.sq_off.tail);
+		sq_mask_ = *reinterpret_cast<unsigned int*>(sq + p.sq_off.ring_mask);
+		sq_array_ = reinterpret_cast<unsigned int*>(sq + p.sq_off.array);
+
+		char* cq = static_cast<char*>(cq_ptr_);
+		cq_head_ = reinterpret_cast<unsigned int*>(cq + p.cq_off.head);
+		cq_tail_ = reinterpret_cast<unsigned int*>(cq + p.cq_off.tail);
+		cq_mask_ = *reinterpret_cast<unsigned int*>(cq + p.cq_off.ring_mask);
+		cqes_ = reinterpret_cast<io_uring_cqe*>(cq + p.cq_off.cqes);
+
+		return true;
+	}
+
+	// Caller must serialize submissions. The number of operations in flight must not exceed the ring size.
+	bool submit(aio_op const* op, int fd)
+	{
+		unsigned int const tail = *sq_tail_;
+		unsigned int const index = tail & sq_mask_;
+		io_uring_sqe & sqe = sqes_[index];
+		memset(&sqe, 0, sizeof(sqe));
+		sqe.user_data = reinterpret_cast<uintptr_t>(op);
+
+		if (!op) {
+			sqe.opcode = IORING_OP_NOP;
+		}
+		else {
+			// The kernel does not transfer more than that in one go anyhow.
+			unsigned int const len = static_cast<unsigned int>(std::min(op->count_, int64_t(0x7ffff000)));
+			switch (op->type_) {
+			case aio_type::read:
+				sqe.opcode = IORING_OP_READ;
+				sqe.fd = fd;
+				sqe.addr = reinterpret_cast<uintptr_t>(op->buf_);
+				sqe.len = len;
+				sqe.off = static_cast<uint64_t>(op->offset_);
+				break;
+			case aio_type::write:
+				sqe.opcode = IORING_OP_WRITE;
+				sqe.fd = fd;
+				sqe.addr = reinterpret_cast<uintptr_t>(op->buf_);
+				sqe.len = len;
+				sqe.off = static_cast<uint64_t>(op->offset_);
+				break;
+			case aio_type::fsync:
+				sqe.opcode = IORING_OP_FSYNC;
+				sqe.fd = fd;
+				break;
+			case aio_type::open:
+				sqe.opcode = IORING_OP_OPENAT;
+				sqe.fd = AT_FDCWD;
+				sqe.addr = reinterpret_cast<uintptr_t>(op->name_.c_str());
+				sqe.len = S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH;
+				sqe.open_flags = O_CLOEXEC;
+				if (op->mode_ == file::reading) {
+					sqe.open_flags |= O_RDONLY;
+				}
+				else {
+					sqe.open_flags |= O_WRONLY | O_CREAT;
+					if (op->creation_ == file::empty) {
+						sqe.open_flags |= O_TRUNC;
+					}
+				}
+				break;
+			}
+		}
+		sq_array_[index] = index;
+		__atomic_store_n(sq_tail_, tail + 1, __ATOMIC_RELEASE);
+
+		int res;
+		do {
+			res = static_cast<int>(syscall(__NR_io_uring_enter, fd_, 1, 0, 0, nullptr, 0));
+		} while (res == -1 && (errno == EINTR || errno == EAGAIN || errno == EBUSY));
+
+		return res == 1;
+	}
+
+	// Waits for completions, calls the passed function for each. Only to be called from a single thread.
+	template<typename F>
+	void reap(F const& f)
+	{
+		int res;
+		do {
+			res = static_cast<int>(syscall(__NR_io_uring_enter, fd_, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0));
+		} while (res == -1 && errno == EINTR);
+
+		unsigned int head = *cq_head_;
+		unsigned int const tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+		for (; head != tail; ++head) {
+			io_uring_cqe const& cqe = cqes_[head & cq_mask_];
+			f(reinterpret_cast<aio_op*>(static_cast<uintptr_t>(cqe.user_data)), cqe.res);
+		}
+		__atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+	}
+
+private:
+	int fd_{-1};
+
+	void* sq_ptr_{};
+	size_t sq_size_{};
+	void* cq_ptr_{};
+	size_t cq_size_{};
+	io_uring_sqe* sqes_{};
+	size_t sqes_size_{};
+
+	unsigned int* sq_tail_{};
+	unsigned int sq_mask_{};
+	unsigned int* sq_array_{};
+
+	unsigned int* cq_head_{};
+	unsigned int* cq_tail_{};
+	unsigned int cq_mask_{};
+	io_uring_cqe* cqes_{};
+};
+#endif
+}
+
+class aio_engine::impl final
+{
+public:
+	impl(size_t max_in_flight, size_t threads, bool use_io_uring)
+		: max_in_flight_(std::max(max_in_flight, size_t(1)))
+	{
+#if HAVE_LINUX_IO_URING_H
+		if (use_io_uring) {
+			ring_.reset(new uring);
+			if (ring_->init(static_cast<unsigned int>(std::min(max_in_flight_, max_ring_size)))) {
+				max_in_flight_ = std::min(max_in_flight_, max_ring_size);
+				completions_ = pool_.spawn([this]() { reap(); });
+				return;
+			}
+			ring_.reset();
+		}
+#else
+		(void)use_io_uring;
+#endif
+		pool_.set_max_threads(std::max(threads, size_t(1)));
+	}
+
+	~impl()
+	{
+		// Completing an operation starts the next queued one, wait until all are done
+		scoped_lock l(m_);
+		cond_.wait(l, [this]() { return active_.empty() && pending_.empty(); });
+
+#if HAVE_LINUX_IO_URING_H
+		if (ring_) {
+			// Stop the completion thread
+			ring_->submit(nullptr, -1);
+			l.unlock();
+			completions_.join();
+		}
+#endif
+	}
+
+	aio_id add(std::unique_ptr<aio_op> && op)
+	{
+		scoped_lock l(m_);
+		aio_id const id = ++next_id_;
+		op->id_ = id;
+		if (active_.size() < max_in_flight_) {
+			start(l, op.release());
+		}
+		else {
+			pending_.emplace_back(std::move(op));
+		}
+		return id;
+	}
+
+	void cancel(event_handler & h)
+	{
+		scoped_lock l(m_);
+		pending_.erase(std::remove_if(pending_.begin(), pending_.end(), [&h](std::unique_ptr<aio_op> const& op) {
+			return op->handler_ == &h;
+		}), pending_.end());
+
+		std::vector<aio_id> cancelled;
+		for (auto & op : active_) {
+			if (op->handler_ == &h) {
+				op->handler_ = nullptr;
+				cancelled.push_back(op->id_);
+			}
+		}
+		cond_.wait(l, [&]() {
+			return std::none_of(active_.cbegin(), active_.cend(), [&](aio_op const* op) {
+				return std::find(cancelled.cbegin(), cancelled.cend(), op->id_) != cancelled.cend();
+			});
+		});
+	}
+
+	bool uses_io_uring() const
+	{
+#if HAVE_LINUX_IO_URING_H
+		return ring_ != nullptr;
+#else
+		return false;
+#endif
+	}
+
+private:
+	void start(scoped_lock & l, aio_op* op)
+	{
+		active_.push_back(op);
+
+#if HAVE_LINUX_IO_URING_H
+		if (ring_) {
+			if (op->type_ == aio_type::open) {
+				op->file_->close();
+			}
+			if (!ring_->submit(op, native_handle(*op->file_))) {
+				// Not reached with a ring large enough for all operations in flight.
+				finish(l, op, -1);
+			}
+			return;
+		}
+#endif
+
+		run_in_pool(op);
+	}
+
+	// Performs the operation on a worker thread
+	void run_in_pool(aio_op* op)
+	{
+		pool_.spawn([this, op]() {
+			int64_t const result = run(*op);
+			scoped_lock l(m_);
+			finish(l, op, result);
+		}).detach();
+	}
+
+	// Performs an operation synchronously
+	static int64_t run(aio_op & op)
+	{
+		switch (op.type_) {
+		case aio_type::read:
+			return op.file_->read_at(op.buf_, op.count_, op.offset_);
+		case aio_type::write:
+			return op.file_->write_at(op.buf_, op.count_, op.offset_);
+		case aio_type::fsync:
+#ifdef FZ_WINDOWS
+			return FlushFileBuffers(native_handle(*op.file_)) ? 0 : -1;
+#else
+			{
+				int res;
+				do {
+					res = ::fsync(native_handle(*op.file_));
+				} while (res == -1 && errno == EINTR);
+				return res ? -1 : 0;
+			}
+#endif
+		case aio_type::open:
+			return op.file_->open(op.name_, op.mode_, op.creation_) ? 0 : -1;
+		}
+		return -1;
+	}
+
+	void finish(scoped_lock & l, aio_op* op, int64_t result)
+	{
+		active_.erase(std::find(active_.begin(), active_.end(), op));
+		if (op->handler_) {
+			op->handler_->send_event<aio_event>(op->id_, result);
+		}
+		delete op;
+
+		while (!pending_.empty() && active_.size() < max_in_flight_) {
+			aio_op* next = pending_.front().release();
+			pending_.pop_front();
+			start(l, next);
+		}
+
+		cond_.broadcast(l);
+	}
+
+#if HAVE_LINUX_IO_URING_H
+	void reap()
+	{
+		bool stop{};
+		while (!stop) {
+			ring_->reap([&](aio_op* op, int res) {
+				if (!op) {
+					stop = true;
+					return;
+				}
+
+				if (res == -EINVAL && op->file_->direct() && (op->type_ == aio_type::read || op->type_ == aio_type::write)) {
+					// Unaligned direct I/O. Let file::read_at and file::write_at go through their bounce buffer,
+					// the same as without io_uring.
+					run_in_pool(op);
+					return;
+				}
+
+				int64_t result = res;
+				if (op->type_ == aio_type::open) {
+					if (res >= 0) {
+						native_handle(*op->file_) = res;
+						result = 0;
+					}
+				}
+				else if (op->type_ == aio_type::fsync && res >= 0) {
+					result = 0;
+				}
+				if (result < 0) {
+					result = -1;
+				}
+
+				scoped_lock l(m_);
+				finish(l, op, result);
+			});
+		}
+	}
+
+	std::unique_ptr<uring> ring_;
+	async_task completions_;
+#endif
+
+	mutex m_{"aio_engine", false};
+	broadcast_condition cond_;
+
+	size_t max_in_flight_;
+	aio_id next_id_{};
+
+	std::vector<aio_op*> active_;
+	std::deque<std::unique_ptr<aio_op>> pending_;
+
+	// Declared last, destroyed first: Waits for the worker threads to finish.
+	thread_pool pool_;
+};
+
+aio_engine::aio_engine(size_t max_in_flight, size_t threads, bool use_io_uring)
+	: impl_(new impl(max_in_flight, threads, use_io_uring))
+{
+}
+
+aio_engine::~aio_engine()
+{
+	delete impl_;
+}
+
+aio_id aio_engine::read(event_handler & h, file & f, void *buf, int64_t count, int64_t offset)
+{
+	std::unique_ptr<aio_op> op(new aio_op);
+	op->handler_ = &h;
+	op->type_ = aio_type::read;
+	op->file_ = &f;
+	op->buf_ = buf;
+	op->count_ = count;
+	op->offset_ = offset;
+	return impl_->add(std::move(op));
+}
+
+aio_id aio_engine::write(event_handler & h, file & f, void const* buf, int64_t count, int64_t offset)
+{
+	std::unique_ptr<aio_op> op(new aio_op);
+	op->handler_ = &h;
+	op->type_ = aio_type::write;
+	op->file_ = &f;
+	op->buf_ = const_cast<void*>(buf);
+	op->count_ = count;
+	op->offset_ = offset;
+	return impl_->add(std::move(op));
+}
+
+aio_id aio_engine::fsync(event_handler & h, file & f)
+{
+	std::unique_ptr<aio_op> op(new aio_op);
+	op->handler_ = &h;
+	op->type_ = aio_type::fsync;
+	op->file_ = &f;
+	return impl_->add(std::move(op));
+}
+
+aio_id aio_engine::open(event_handler & h, file & f, native_string const& name, file::mode m, file::creation_flags d)
+{
+	std::unique_ptr<aio_op> op(new aio_op);
+	op->handler_ = &h;
+	op->type_ = aio_type::open;
+	op->file_ = &f;
+	op->name_ = name;
+	op->mode_ = m;
+	op->creation_ = d;
+	return impl_->add(std::move(op));
+}
+
+void aio_engine::cancel(event_handler & h)
+{
+	impl_->cancel(h);
+}
+
+bool aio_engine::uses_io_uring() const
+{
+	return impl_->uses_io_uring();
+}
+
+#ifdef FZ_WINDOWS
+HANDLE& aio_engine::native_handle(file & f)
+{
+	return f.hFile_;
+}
+#else
+int& aio_engine::native_handle(file & f)
+{
+	return f.fd_;
+}
+#endif
+
+}
@@ -0,0 +1,110 @@
+#include "libfilezilla/aligned_buffer.hpp"
+
+#ifdef FZ_WINDOWS
+#include <malloc.h>
+#else
+#include <stdlib.h>
+#endif
+
+namespace fz {
+
+size_t const aligned_buffer::default_alignment;
+
+aligned_buffer::aligned_buffer(size_t size, size_t alignment)
+{
+	if (alignment < sizeof(void*)) {
+		alignment = sizeof(void*);
+	}
+
+#ifdef FZ_WINDOWS
+	data_ = static_cast<uint8_t*>(_aligned_malloc(size, alignment));
+#else
+	void* p{};
+	if (!posix_memalign(&p, alignment, size)) {
+		data_ = static_cast<uint8_t*>(p);
+	}
+#endif
+	if (data_) {
+		size_ = size;
+		alignment_ = alignment;
+	}
+}
+
+aligned_buffer::~aligned_buffer()
+{
+	reset();
+}
+
+aligned_buffer::aligned_buffer(aligned_buffer && op) noexcept
+	: data_(op.data_)
+	, size_(op.size_)
+	, alignment_(op.alignment_)
+{
+	op.data_ = nullptr;
+	op.size_ = 0;
+	op.alignment_ = 0;
+}
+
+aligned_buffer& aligned_buffer::operator=(aligned_buffer && op) noexcept
+{
+	if (this != &op) {
+		reset();
+		data_ = op.data_;
+		size_ = op.size_;
+		alignment_ = op.alignment_;
+		op.data_ = nullptr;
+		op.size_ = 0;
+		op.alignment_ = 0;
+	}
+	return *this;
+}
+
+void aligned_buffer::reset()
+{
+	if (data_) {
+#ifdef FZ_WINDOWS
+		_aligned_free(data_);
+#else
+		free(data_);
+#endif
+		data_ = nullptr;
+		size_ = 0;
+		alignment_ = 0;
+	}
+}
+
+aligned_buffer_pool::aligned_buffer_pool(size_t buffer_size, size_t alignment, size_t max_cached)
+	: buffer_size_(buffer_size)
+	, alignment_(alignment)
+	, max_cached_(max_cached)
+{
+}
+
+aligned_buffer aligned_buffer_pool::get()
+{
+	{
+		scoped_lock l(m_);
+		if (!cached_.empty()) {
+			aligned_buffer ret = std::move(cached_.back());
+			cached_.pop_back();
+			return ret;
+		}
+	}
+	return aligned_buffer(buffer_size_, alignment_);
+}
+
+void aligned_buffer_pool::release(aligned_buffer && buffer)
+{
+	// Taken over in any case, declared before the lock so that a surplus buffer gets freed after unlocking
+	aligned_buffer b = std::move(buffer);
+	if (!b || b.size() != buffer_size_ || b.alignment() < alignment_) {
+		return;
+	}
+
+	scoped_lock l(m_);
+	if (cached_.size() < max_cached_) {
+		cached_.emplace_back(std::move(b));
+	}
+}
+
+}
@@ -0,0 +1,206 @@
+#include "libfilezilla/atomic_file.hpp"
+#include "libfilezilla/string.hpp"
+#include "libfilezilla/util.hpp"
+
+#ifndef FZ_WINDOWS
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace fz {
+
+namespace {
+native_string directory_of(native_string const& path)
+{
+#ifdef FZ_WINDOWS
+	auto const pos = path.find_last_of(fzT("/\\"));
+#else
+	auto const pos = path.rfind('/');
+#endif
+	if (pos == native_string::npos) {
+		return fzT(".");
+	}
+	if (!pos) {
+		return path.substr(0, 1);
+	}
+	return path.substr(0, pos);
+}
+}
+
+native_string atomic_file_writer::temp_name()
+{
+	return target_ + fzT(".tmp") + to_native(std::to_string(random_number(0, 1000000000)));
+}
+
+bool atomic_file_writer::write(void const* data, int64_t count)
+{
+	auto const* p = static_cast<char const*>(data);
+	while (count > 0) {
+		int64_t const written = file_.write(p, count);
+		if (written <= 0) {
+			return false;
+		}
+		p += written;
+		count -= written;
+	}
+	return count == 0;
+}
+
+atomic_file_writer::~atomic_file_writer()
+{
+	discard();
+}
+
+#ifdef FZ_WINDOWS
+atomic_file_writer::atomic_file_writer(native_string const& target)
+	: target_(target)
+{
+	for (int i = 0; i < 10 && !file_.opened(); ++i) {
+		temp_ = temp_name();
+		file_.hFile_ = CreateFileW(temp_.c_str(), GENERIC_WRITE, FILE_SHARE_READ, 0, CREATE_NEW, FILE_ATTRIBUTE_TEMPORARY, 0);
+		if (!file_.opened() && GetLastError() != ERROR_FILE_EXISTS) {
+			break;
+		}
+	}
+	if (!file_.opened()) {
+		temp_.clear();
+	}
+}
+
+bool atomic_file_writer::commit(bool durable)
+{
+	if (!file_.opened()) {
+		return false;
+	}
+
+	if (durable && !file_.fsync()) {
+		discard();
+		return false;
+	}
+	file_.close();
+
+	// The temporary attribute makes the system keep the data in the cache if possible.
+	SetFileAttributesW(temp_.c_str(), FILE_ATTRIBUTE_NORMAL);
+
+	if (!MoveFileExW(temp_.c_str(), target_.c_str(), MOVEFILE_REPLACE_EXISTING | (durable ? MOVEFILE_WRITE_THROUGH : 0))) {
+		discard();
+		return false;
+	}
+	temp_.clear();
+
+	return true;
+}
+
+void atomic_file_writer::discard()
+{
+	file_.close();
+	if (!temp_.empty()) {
+		DeleteFileW(temp_.c_str());
+		temp_.clear();
+	}
+}
+
+#else
+
+atomic_file_writer::atomic_file_writer(native_string const& target)
+	: target_(target)
+{
+	int const permissions = S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH;
+
+#ifdef O_TMPFILE
+	// Giving the file a name on commit needs /proc
+	if (!access("/proc/self/fd", X_OK)) {
+		file_.fd_ = open(directory_of(target_).c_str(), O_TMPFILE | O_WRONLY | O_CLOEXEC, permissions);
+		unnamed_ = file_.opened();
+	}
+#endif
+
+	for (int i = 0; i < 10 && !file_.opened(); ++i) {
+		temp_ = temp_name();
+		file_.fd_ = open(temp_.c_str(), O_CREAT | O_EXCL | O_WRONLY | O_CLOEXEC, permissions);
+		if (!file_.opened() && errno != EEXIST) {
+			break;
+		}
+	}
+	if (!file_.opened()) {
+		temp_.clear();
+		return;
+	}
+
+	struct stat st;
+	if (!stat(target_.c_str(), &st)) {
+		fchmod(file_.fd_, st.st_mode & 07777);
+	}
+}
+
+bool atomic_file_writer::commit(bool durable)
+{
+	if (!file_.opened()) {
+		return false;
+	}
+
+	if (durable && !file_.fdatasync()) {
+		discard();
+		return false;
+	}
+
+	if (unnamed_) {
+		// Linking directly to the target would fail if it exists, link to a temporary name first.
+		std::string const fd_path = "/proc/self/fd/" + std::to_string(file_.fd_);
+		for (int i = 0; i < 10 && temp_.empty(); ++i) {
+			temp_ = temp_name();
+			if (linkat(AT_FDCWD, fd_path.c_str(), AT_FDCWD, temp_.c_str(), AT_SYMLINK_FOLLOW)) {
+				bool const retry = errno == EEXIST;
+				temp_.clear();
+				if (!retry) {
+					break;
+				}
+			}
+		}
+		if (temp_.empty()) {
+			discard();
+			return false;
+		}
+	}
+	file_.close();
+
+	if (rename(temp_.c_str(), target_.c_str())) {
+		discard();
+		return false;
+	}
+	temp_.clear();
+
+	if (durable) {
+		// Persist the directory entry
+		int const dir = open(directory_of(target_).c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+		if (dir == -1) {
+			return false;
+		}
+		int res;
+		do {
+			res = ::fsync(dir);
+		} while (res == -1 && errno == EINTR);
+		close(dir);
+		if (res) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+void atomic_file_writer::discard()
+{
+	file_.close();
+	if (!temp_.empty()) {
+		unlink(temp_.c_str());
+		temp_.clear();
+	}
+}
+
+#endif
+
+}
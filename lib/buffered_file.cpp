@@ -0,0 +1,191 @@
+#include "libfilezilla/buffered_file.hpp"
+
+#include <algorithm>
+
+#include <string.h>
+
+namespace fz {
+
+size_t const file_reader::default_buffer_size;
+size_t const file_writer::default_buffer_size;
+
+file_reader::file_reader(file & f, size_t buffer_size)
+	: file_(f)
+	, buffer_(std::max(buffer_size, size_t(1)))
+{
+}
+
+int64_t file_reader::fill()
+{
+	if (start_ == end_) {
+		start_ = end_ = 0;
+	}
+	else if (end_ == buffer_.size()) {
+		memmove(buffer_.data(), buffer_.data() + start_, end_ - start_);
+		end_ -= start_;
+		start_ = 0;
+	}
+
+	int64_t const r = file_.read(buffer_.data() + end_, static_cast<int64_t>(buffer_.size() - end_));
+	if (r > 0) {
+		end_ += static_cast<size_t>(r);
+	}
+	return r;
+}
+
+int64_t file_reader::read(void *buf, int64_t count)
+{
+	if (count <= 0) {
+		return count ? -1 : 0;
+	}
+
+	if (start_ == end_) {
+		if (static_cast<uint64_t>(count) >= buffer_.size()) {
+			return file_.read(buf, count);
+		}
+		int64_t const r = fill();
+		if (r <= 0) {
+			return r;
+		}
+	}
+
+	size_t const available = static_cast<size_t>(std::min(count, static_cast<int64_t>(end_ - start_)));
+	memcpy(buf, buffer_.data() + start_, available);
+	start_ += available;
+	return static_cast<int64_t>(available);
+}
+
+int64_t file_reader::peek(uint8_t const*& data, size_t count)
+{
+	count = std::min(count, buffer_.size());
+
+	while (end_ - start_ < count) {
+		if (start_ && buffer_.size() - start_ < count) {
+			memmove(buffer_.data(), buffer_.data() + start_, end_ - start_);
+			end_ -= start_;
+			start_ = 0;
+		}
+		int64_t const r = fill();
+		if (r < 0) {
+			if (start_ == end_) {
+				return -1;
+			}
+			break;
+		}
+		if (!r) {
+			break;
+		}
+	}
+
+	data = buffer_.data() + start_;
+	return static_cast<int64_t>(std::min(count, end_ - start_));
+}
+
+void file_reader::consume(size_t count)
+{
+	start_ += std::min(count, end_ - start_);
+}
+
+int64_t file_reader::read_line(std::string & line)
+{
+	line.clear();
+
+	int64_t consumed{};
+	while (true) {
+		if (start_ == end_) {
+			int64_t const r = fill();
+			if (r < 0) {
+				return -1;
+			}
+			if (!r) {
+				// Unterminated last line
+				return consumed;
+			}
+		}
+
+		uint8_t const* const begin = buffer_.data() + start_;
+		size_t const available = end_ - start_;
+		auto const* const lf = static_cast<uint8_t const*>(memchr(begin, '\n', available));
+		if (lf) {
+			size_t const len = static_cast<size_t>(lf - begin);
+			line.append(reinterpret_cast<char const*>(begin), len);
+			start_ += len + 1;
+			consumed += static_cast<int64_t>(len) + 1;
+			if (!line.empty() && line.back() == '\r') {
+				line.pop_back();
+			}
+			return consumed;
+		}
+
+		line.append(reinterpret_cast<char const*>(begin), available);
+		start_ = end_;
+		consumed += static_cast<int64_t>(available);
+	}
+}
+
+file_writer::file_writer(file & f, size_t buffer_size)
+	: file_(f)
+	, buffer_(std::max(buffer_size, size_t(1)))
+{
+}
+
+file_writer::~file_writer()
+{
+	flush();
+}
+
+bool file_writer::write(void const* data, int64_t count)
+{
+	if (count < 0) {
+		return false;
+	}
+
+	auto const* p = static_cast<uint8_t const*>(data);
+	while (count) {
+		if (!used_ && static_cast<uint64_t>(count) >= buffer_.size()) {
+			int64_t const w = file_.write(p, count);
+			if (w <= 0) {
+				return false;
+			}
+			p += w;
+			count -= w;
+			continue;
+		}
+
+		size_t const chunk = static_cast<size_t>(std::min(count, static_cast<int64_t>(buffer_.size() - used_)));
+		memcpy(buffer_.data() + used_, p, chunk);
+		used_ += chunk;
+		p += chunk;
+		count -= static_cast<int64_t>(chunk);
+
+		if (used_ == buffer_.size() && !flush()) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool file_writer::flush()
+{
+	size_t written{};
+	while (written < used_) {
+		int64_t const w = file_.write(buffer_.data() + written, static_cast<int64_t>(used_ - written));
+		if (w <= 0) {
+			memmove(buffer_.data(), buffer_.data() + written, used_ - written);
+			used_ -= written;
+			return false;
+		}
+		written += static_cast<size_t>(w);
+	}
+	used_ = 0;
+
+	return true;
+}
+
+bool file_writer::sync()
+{
+	return flush() && file_.fsync();
+}
+
+}
@@ -9,7 +9,6 @@
 namespace fz {
 
 event_loop::event_loop()
-	: sync_(false)
 {
 	run();
 }
@@ -177,7 +176,7 @@ void event_loop::entry()
 
 		// Nothing to do, now we wait
 		if (deadline_) {
-			cond_.wait(l, deadline_ - now);
+			cond_.wait_until(l, deadline_);
 		}
 		else {
 			cond_.wait(l);
@@ -1,16 +1,57 @@
 #include "libfilezilla/libfilezilla.hpp"
 #include "libfilezilla/file.hpp"
+#include "libfilezilla/aligned_buffer.hpp"
+
+#include <algorithm>
+#include <string.h>
+
+#ifdef FZ_WINDOWS
+#include <winioctl.h>
+#endif
 
 #ifndef FZ_WINDOWS
 #include <errno.h>
+#include <limits.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <fcntl.h>
 #include <unistd.h>
+
+#if HAVE_LINUX_FS_H
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#endif
+#if HAVE_SYS_SENDFILE_H
+#include <sys/sendfile.h>
+#endif
+
+#include <vector>
 #endif
 
 namespace fz {
 
+namespace {
+// Vectored I/O emulated using one call per buffer, stops at the first short read or write.
+template<typename Buffer, typename Op>
+int64_t vectored_io(Buffer const* buffers, size_t count, Op const& op)
+{
+	int64_t total{};
+	for (size_t i = 0; i < count; ++i) {
+		int64_t const size = static_cast<int64_t>(buffers[i].size);
+		int64_t const r = op(buffers[i].data, size, total);
+		if (r < 0) {
+			return total ? total : r;
+		}
+		total += r;
+		if (r < size) {
+			break;
+		}
+	}
+	return total;
+}
+}
+
 file::file()
 {
 }
@@ -20,13 +61,23 @@ file::file(native_string const& f, mode m, creation_flags d)
 	open(f, m, d);
 }
 
+file::file(native_string const& f, mode m, creation_flags d, open_options const& o)
+{
+	open(f, m, d, o);
+}
+
+bool file::open(native_string const& f, mode m, creation_flags d)
+{
+	return open(f, m, d, open_options());
+}
+
 file::~file()
 {
 	close();
 }
 
 #ifdef FZ_WINDOWS
-bool file::open(native_string const& f, mode m, creation_flags d)
+bool file::open(native_string const& f, mode m, creation_flags d, open_options const& o)
 {
 	close();
 
@@ -48,7 +99,33 @@ bool file::open(native_string const& f, mode m, creation_flags d)
 		shareMode |= FILE_SHARE_WRITE;
 	}
 
-	hFile_ = CreateFile(f.c_str(), (m == reading) ? GENERIC_READ : GENERIC_WRITE, shareMode, 0, dispositionFlags, FILE_FLAG_SEQUENTIAL_SCAN, 0);
+	DWORD flags = 0;
+	if (o.pattern == sequential) {
+		flags |= FILE_FLAG_SEQUENTIAL_SCAN;
+	}
+	else if (o.pattern == random) {
+		flags |= FILE_FLAG_RANDOM_ACCESS;
+	}
+	if (o.direct) {
+		flags |= FILE_FLAG_NO_BUFFERING;
+	}
+
+	DWORD access = (m == reading) ? GENERIC_READ : GENERIC_WRITE;
+	if (o.direct) {
+		// Unaligned writes need to read partial blocks
+		access |= GENERIC_READ;
+	}
+
+	hFile_ = CreateFile(f.c_str(), access, shareMode, 0, dispositionFlags, flags, 0);
+	if (hFile_ == INVALID_HANDLE_VALUE && (flags & FILE_FLAG_NO_BUFFERING) && GetLastError() == ERROR_INVALID_PARAMETER) {
+		flags &= ~FILE_FLAG_NO_BUFFERING;
+		hFile_ = CreateFile(f.c_str(), access, shareMode, 0, dispositionFlags, flags, 0);
+	}
+	direct_ = hFile_ != INVALID_HANDLE_VALUE && (flags & FILE_FLAG_NO_BUFFERING);
+
+	if (hFile_ != INVALID_HANDLE_VALUE && m == writing && o.preallocate > 0) {
+		allocate(0, o.preallocate, true);
+	}
 
 	return hFile_ != INVALID_HANDLE_VALUE;
 }
@@ -59,6 +136,7 @@ void file::close()
 		CloseHandle(hFile_);
 		hFile_ = INVALID_HANDLE_VALUE;
 	}
+	direct_ = false;
 }
 
 int64_t file::size() const
@@ -99,6 +177,127 @@ bool file::truncate()
 	return !!SetEndOfFile(hFile_);
 }
 
+bool file::fsync()
+{
+	return !!FlushFileBuffers(hFile_);
+}
+
+bool file::fdatasync()
+{
+	return fsync();
+}
+
+bool file::allocate(int64_t offset, int64_t length, bool keep_size)
+{
+	if (offset < 0 || length <= 0) {
+		return false;
+	}
+
+	int64_t const s = size();
+	if (s < 0) {
+		return false;
+	}
+
+	int64_t const end = offset + length;
+	if (end <= s) {
+		// NTFS does not leave holes in non-sparse files
+		return true;
+	}
+
+	if (keep_size) {
+		FILE_ALLOCATION_INFO info{};
+		info.AllocationSize.QuadPart = end;
+		return !!SetFileInformationByHandle(hFile_, FileAllocationInfo, &info, sizeof(info));
+	}
+
+	return truncate_at(end);
+}
+
+bool file::punch_hole(int64_t offset, int64_t length)
+{
+	if (offset < 0 || length <= 0) {
+		return false;
+	}
+
+	DWORD bytes{};
+	FILE_SET_SPARSE_BUFFER sparse{};
+	sparse.SetSparse = TRUE;
+	if (!DeviceIoControl(hFile_, FSCTL_SET_SPARSE, &sparse, sizeof(sparse), nullptr, 0, &bytes, nullptr)) {
+		return false;
+	}
+
+	FILE_ZERO_DATA_INFORMATION zero{};
+	zero.FileOffset.QuadPart = offset;
+	zero.BeyondFinalZero.QuadPart = offset + length;
+	return !!DeviceIoControl(hFile_, FSCTL_SET_ZERO_DATA, &zero, sizeof(zero), nullptr, 0, &bytes, nullptr);
+}
+
+namespace {
+// Finds the first allocated range overlapping [offset, size)
+bool query_allocated(HANDLE h, int64_t offset, int64_t size, FILE_ALLOCATED_RANGE_BUFFER & out)
+{
+	FILE_ALLOCATED_RANGE_BUFFER in{};
+	in.FileOffset.QuadPart = offset;
+	in.Length.QuadPart = size - offset;
+
+	DWORD bytes{};
+	if (!DeviceIoControl(h, FSCTL_QUERY_ALLOCATED_RANGES, &in, sizeof(in), &out, sizeof(out), &bytes, nullptr) && GetLastError() != ERROR_MORE_DATA) {
+		return false;
+	}
+	if (bytes < sizeof(out)) {
+		out.FileOffset.QuadPart = size;
+		out.Length.QuadPart = 0;
+	}
+	return true;
+}
+}
+
+int64_t file::next_data(int64_t offset)
+{
+	int64_t const s = size();
+	if (s < 0 || offset < 0) {
+		return -1;
+	}
+	if (offset >= s) {
+		return s;
+	}
+
+	FILE_ALLOCATED_RANGE_BUFFER range{};
+	if (!query_allocated(hFile_, offset, s, range)) {
+		// Not supported by the file system, everything is data
+		return offset;
+	}
+	return std::max(offset, static_cast<int64_t>(range.FileOffset.QuadPart));
+}
+
+int64_t file::next_hole(int64_t offset)
+{
+	int64_t const s = size();
+	if (s < 0 || offset < 0) {
+		return -1;
+	}
+
+	while (offset < s) {
+		FILE_ALLOCATED_RANGE_BUFFER range{};
+		if (!query_allocated(hFile_, offset, s, range)) {
+			return s;
+		}
+		if (range.FileOffset.QuadPart > offset) {
+			break;
+		}
+		// Adjacent ranges are reported separately
+		offset = range.FileOffset.QuadPart + range.Length.QuadPart;
+	}
+	return std::min(offset, s);
+}
+
+bool file::truncate_at(int64_t length)
+{
+	FILE_END_OF_FILE_INFO info{};
+	info.EndOfFile.QuadPart = length;
+	return !!SetFileInformationByHandle(hFile_, FileEndOfFileInfo, &info, sizeof(info));
+}
+
 int64_t file::read(void *buf, int64_t count)
 {
 	int64_t ret = -1;
@@ -107,6 +306,15 @@ int64_t file::read(void *buf, int64_t count)
 	if (ReadFile(hFile_, buf, static_cast<DWORD>(count), &read, 0)) {
 		ret = static_cast<int64_t>(read);
 	}
+	else if (direct_ && GetLastError() == ERROR_INVALID_PARAMETER) {
+		int64_t const pos = seek(0, current);
+		if (pos != -1) {
+			ret = unaligned_read_at(buf, count, pos);
+			if (ret > 0) {
+				seek(pos + ret, begin);
+			}
+		}
+	}
 
 	return ret;
 }
@@ -119,10 +327,94 @@ int64_t file::write(void const* buf, int64_t count)
 	if (WriteFile(hFile_, buf, static_cast<DWORD>(count), &written, 0)) {
 		ret = static_cast<int64_t>(written);
 	}
+	else if (direct_ && GetLastError() == ERROR_INVALID_PARAMETER) {
+		int64_t const pos = seek(0, current);
+		if (pos != -1) {
+			ret = unaligned_write_at(buf, count, pos);
+			if (ret > 0) {
+				seek(pos + ret, begin);
+			}
+		}
+	}
+
+	return ret;
+}
+
+int64_t file::native_read_at(void *buf, int64_t count, int64_t offset)
+{
+	int64_t ret = -1;
+
+	OVERLAPPED o{};
+	o.Offset = static_cast<DWORD>(offset);
+	o.OffsetHigh = static_cast<DWORD>(offset >> 32);
+
+	DWORD read = 0;
+	if (ReadFile(hFile_, buf, static_cast<DWORD>(count), &read, &o)) {
+		ret = static_cast<int64_t>(read);
+	}
+	else if (GetLastError() == ERROR_HANDLE_EOF) {
+		ret = 0;
+	}
 
 	return ret;
 }
 
+int64_t file::native_write_at(void const* buf, int64_t count, int64_t offset)
+{
+	int64_t ret = -1;
+
+	OVERLAPPED o{};
+	o.Offset = static_cast<DWORD>(offset);
+	o.OffsetHigh = static_cast<DWORD>(offset >> 32);
+
+	DWORD written = 0;
+	if (WriteFile(hFile_, buf, static_cast<DWORD>(count), &written, &o)) {
+		ret = static_cast<int64_t>(written);
+	}
+
+	return ret;
+}
+
+bool file::advise(int64_t, int64_t, access_pattern pattern)
+{
+	// Access patterns can only be specified when opening files.
+	return pattern == normal;
+}
+
+bool file::readahead(int64_t, int64_t)
+{
+	return false;
+}
+
+int64_t file::readv(io_buffer const* buffers, size_t count)
+{
+	// ReadFileScatter needs unbuffered handles and page-sized buffers, not an option.
+	return vectored_io(buffers, count, [this](void* data, int64_t size, int64_t) {
+		return read(data, size);
+	});
+}
+
+int64_t file::writev(const_io_buffer const* buffers, size_t count)
+{
+	return vectored_io(buffers, count, [this](void const* data, int64_t size, int64_t) {
+		return write(data, size);
+	});
+}
+
+int64_t file::readv_at(io_buffer const* buffers, size_t count, int64_t offset)
+{
+	return vectored_io(buffers, count, [this, offset](void* data, int64_t size, int64_t done) {
+		return read_at(data, size, offset + done);
+	});
+}
+
+int64_t file::writev_at(const_io_buffer const* buffers, size_t count, int64_t offset)
+{
+	return vectored_io(buffers, count, [this, offset](void const* data, int64_t size, int64_t done) {
+		return write_at(data, size, offset + done);
+	});
+}
+
 bool file::opened() const
 {
 	return hFile_ != INVALID_HANDLE_VALUE;
@@ -133,9 +425,16 @@ bool remove_file(fz::native_string const& name)
 	return DeleteFileW(name.c_str()) != 0;
 }
 
+namespace {
+bool misaligned()
+{
+	return GetLastError() == ERROR_INVALID_PARAMETER;
+}
+}
+
 #else
 
-bool file::open(native_string const& f, mode m, creation_flags d)
+bool file::open(native_string const& f, mode m, creation_flags d, open_options const& o)
 {
 	close();
 
@@ -149,15 +448,62 @@ bool file::open(native_string const& f, mode m, creation_flags d)
 			flags |= O_TRUNC;
 		}
 	}
-	fd_ = ::open(f.c_str(), flags, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH);
+#ifdef O_DIRECT
+	if (o.direct) {
+		flags |= O_DIRECT;
+		if (m == writing) {
+			// Unaligned writes need to read partial blocks
+			flags = (flags & ~O_WRONLY) | O_RDWR;
+		}
+	}
+#endif
+#ifdef O_NOATIME
+	if (o.noatime && m == reading) {
+		flags |= O_NOATIME;
+	}
+#endif
 
-#if HAVE_POSIX_FADVISE
-	if (fd_ != -1) {
-		(void)posix_fadvise(fd_, 0, 0, POSIX_FADV_SEQUENTIAL | POSIX_FADV_NOREUSE);
+	int const permissions = S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH;
+	// Drop the optional flags one at a time until opening succeeds or fails for another reason.
+	// Each failure reports only one of the problems, in an order not to be relied upon.
+	while ((fd_ = ::open(f.c_str(), flags, permissions)) == -1) {
+#ifdef O_NOATIME
+		if (errno == EPERM && (flags & O_NOATIME)) {
+			// Only permitted for the owner of the file
+			flags &= ~O_NOATIME;
+			continue;
+		}
+#endif
+#ifdef O_DIRECT
+		if (errno == EINVAL && (flags & O_DIRECT)) {
+			// File system does not support direct I/O
+			flags &= ~O_DIRECT;
+			continue;
+		}
+#endif
+		break;
+	}
+	if (fd_ == -1) {
+		return false;
+	}
+
+#ifdef O_DIRECT
+	direct_ = (flags & O_DIRECT) != 0;
+#elif defined(F_NOCACHE)
+	if (o.direct) {
+		direct_ = fcntl(fd_, F_NOCACHE, 1) != -1;
 	}
 #endif
 
-	return fd_ != -1;
+	if (o.pattern != normal) {
+		advise(0, 0, o.pattern);
+	}
+
+	if (m == writing && o.preallocate > 0) {
+		allocate(0, o.preallocate, true);
+	}
+
+	return true;
 }
 
 void file::close()
@@ -166,6 +512,7 @@ void file::close()
 		::close(fd_);
 		fd_ = -1;
 	}
+	direct_ = false;
 }
 
 int64_t file::size() const
@@ -214,6 +561,172 @@ bool file::truncate()
 	return ret;
 }
 
+bool file::fsync()
+{
+	int res;
+	do {
+		res = ::fsync(fd_);
+	} while (res == -1 && errno == EINTR);
+
+	return !res;
+}
+
+bool file::fdatasync()
+{
+#if HAVE_FDATASYNC
+	int res;
+	do {
+		res = ::fdatasync(fd_);
+	} while (res == -1 && errno == EINTR);
+
+	return !res;
+#else
+	return fsync();
+#endif
+}
+
+bool file::allocate(int64_t offset, int64_t length, bool keep_size)
+{
+	if (offset < 0 || length <= 0) {
+		return false;
+	}
+
+#if HAVE_FALLOCATE
+	int res;
+	do {
+		res = fallocate(fd_, keep_size ? FALLOC_FL_KEEP_SIZE : 0, offset, length);
+	} while (res == -1 && errno == EINTR);
+	if (!res || (errno != EOPNOTSUPP && errno != ENOSYS)) {
+		return !res;
+	}
+#endif
+
+	if (keep_size) {
+#ifdef F_PREALLOCATE
+		// Allocates past the physical end of the file, possibly more than needed.
+		fstore_t store{};
+		store.fst_flags = F_ALLOCATEALL;
+		store.fst_posmode = F_PEOFPOSMODE;
+		store.fst_length = offset + length;
+		return fcntl(fd_, F_PREALLOCATE, &store) != -1;
+#else
+		return false;
+#endif
+	}
+
+#if HAVE_POSIX_FALLOCATE
+	// Emulated by writing zeroes on file systems not supporting it
+	int err;
+	do {
+		err = posix_fallocate(fd_, offset, length);
+	} while (err == EINTR);
+	return !err;
+#else
+	int64_t const s = size();
+	if (s < 0) {
+		return false;
+	}
+	if (offset + length <= s) {
+		return true;
+	}
+	return truncate_at(offset + length);
+#endif
+}
+
+bool file::punch_hole(int64_t offset, int64_t length)
+{
+	if (offset < 0 || length <= 0) {
+		return false;
+	}
+
+#if HAVE_FALLOCATE && defined(FALLOC_FL_PUNCH_HOLE)
+	int res;
+	do {
+		res = fallocate(fd_, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, offset, length);
+	} while (res == -1 && errno == EINTR);
+	return !res;
+#elif defined(F_PUNCHHOLE)
+	fpunchhole_t hole{};
+	hole.fp_offset = offset;
+	hole.fp_length = length;
+	return fcntl(fd_, F_PUNCHHOLE, &hole) != -1;
+#else
+	return false;
+#endif
+}
+
+namespace {
+#if defined(SEEK_DATA) && defined(SEEK_HOLE)
+// Like lseek with SEEK_DATA or SEEK_HOLE, but restores the file pointer afterwards.
+int64_t seek_sparse(int fd, int64_t offset, int whence, int64_t size)
+{
+	off_t const pos = lseek(fd, 0, SEEK_CUR);
+	if (pos == static_cast<off_t>(-1)) {
+		return -1;
+	}
+
+	int64_t ret = lseek(fd, offset, whence);
+	if (ret == -1) {
+		if (errno == ENXIO) {
+			// Past the last data
+			ret = size;
+		}
+		else if (errno == EINVAL) {
+			// Not supported, everything is data
+			ret = (whence == SEEK_DATA) ? offset : size;
+		}
+	}
+
+	lseek(fd, pos, SEEK_SET);
+	return ret;
+}
+#endif
+}
+
+int64_t file::next_data(int64_t offset)
+{
+	int64_t const s = size();
+	if (s < 0 || offset < 0) {
+		return -1;
+	}
+	if (offset >= s) {
+		return s;
+	}
+
+#if defined(SEEK_DATA) && defined(SEEK_HOLE)
+	return seek_sparse(fd_, offset, SEEK_DATA, s);
+#else
+	return offset;
+#endif
+}
+
+int64_t file::next_hole(int64_t offset)
+{
+	int64_t const s = size();
+	if (s < 0 || offset < 0) {
+		return -1;
+	}
+	if (offset >= s) {
+		return s;
+	}
+
+#if defined(SEEK_DATA) && defined(SEEK_HOLE)
+	return seek_sparse(fd_, offset, SEEK_HOLE, s);
+#else
+	return s;
+#endif
+}
+
+bool file::truncate_at(int64_t length)
+{
+	int res;
+	do {
+		res = ftruncate(fd_, length);
+	} while (res == -1 && (errno == EAGAIN || errno == EINTR));
+
+	return !res;
+}
+
 int64_t file::read(void *buf, int64_t count)
 {
 	int64_t ret;
@@ -221,6 +734,16 @@ int64_t file::read(void *buf, int64_t count)
 		ret = ::read(fd_, buf, count);
 	} while (ret == -1 && (errno == EAGAIN || errno == EINTR));
 
+	if (ret == -1 && direct_ && errno == EINVAL) {
+		int64_t const pos = seek(0, current);
+		if (pos != -1) {
+			ret = unaligned_read_at(buf, count, pos);
+			if (ret > 0) {
+				seek(pos + ret, begin);
+			}
+		}
+	}
+
 	return ret;
 }
 
@@ -231,9 +754,191 @@ int64_t file::write(void const* buf, int64_t count)
 		ret = ::write(fd_, buf, count);
 	} while (ret == -1 && (errno == EAGAIN || errno == EINTR));
 
+	if (ret == -1 && direct_ && errno == EINVAL) {
+		int64_t const pos = seek(0, current);
+		if (pos != -1) {
+			ret = unaligned_write_at(buf, count, pos);
+			if (ret > 0) {
+				seek(pos + ret, begin);
+			}
+		}
+	}
+
+	return ret;
+}
+
+int64_t file::native_read_at(void *buf, int64_t count, int64_t offset)
+{
+	int64_t ret;
+	do {
+		ret = ::pread(fd_, buf, count, offset);
+	} while (ret == -1 && (errno == EAGAIN || errno == EINTR));
+
+	return ret;
+}
+
+int64_t file::native_write_at(void const* buf, int64_t count, int64_t offset)
+{
+	int64_t ret;
+	do {
+		ret = ::pwrite(fd_, buf, count, offset);
+	} while (ret == -1 && (errno == EAGAIN || errno == EINTR));
+
 	return ret;
 }
 
+bool file::advise(int64_t offset, int64_t length, access_pattern pattern)
+{
+#if HAVE_POSIX_FADVISE
+	int advice = POSIX_FADV_NORMAL;
+	switch (pattern) {
+	case sequential:
+		advice = POSIX_FADV_SEQUENTIAL;
+		break;
+	case random:
+		advice = POSIX_FADV_RANDOM;
+		break;
+	case willneed:
+		advice = POSIX_FADV_WILLNEED;
+		break;
+	case dontneed:
+		advice = POSIX_FADV_DONTNEED;
+		break;
+	default:
+		break;
+	}
+	return !posix_fadvise(fd_, offset, length, advice);
+#else
+	(void)offset;
+	(void)length;
+	return pattern == normal;
+#endif
+}
+
+bool file::readahead(int64_t offset, int64_t length)
+{
+#if HAVE_POSIX_FADVISE
+	// Unlike readahead(2), this does not wait for the data to be read.
+	return !posix_fadvise(fd_, offset, length, POSIX_FADV_WILLNEED);
+#elif defined(F_RDADVISE)
+	radvisory ra{};
+	ra.ra_offset = offset;
+	ra.ra_count = static_cast<int>(std::min(length ? length : size() - offset, int64_t(INT_MAX)));
+	return !fcntl(fd_, F_RDADVISE, &ra);
+#else
+	(void)offset;
+	(void)length;
+	return false;
+#endif
+}
+
+namespace {
+#ifdef IOV_MAX
+size_t const max_iovecs = IOV_MAX;
+#else
+size_t const max_iovecs = 1024;
+#endif
+
+// Translates buffers into iovec structures. Excess buffers are ignored, resulting in
+// a short read or write.
+class iovecs final
+{
+public:
+	template<typename Buffer>
+	iovecs(Buffer const* buffers, size_t count)
+		: count_(static_cast<int>(std::min(count, max_iovecs)))
+	{
+		if (count_ > static_cast<int>(sizeof(local_) / sizeof(iovec))) {
+			heap_.resize(count_);
+			iov_ = heap_.data();
+		}
+		for (int i = 0; i < count_; ++i) {
+			iov_[i].iov_base = const_cast<void*>(static_cast<void const*>(buffers[i].data));
+			iov_[i].iov_len = buffers[i].size;
+		}
+	}
+
+	iovec local_[16];
+	std::vector<iovec> heap_;
+	iovec* iov_{local_};
+	int const count_;
+};
+}
+
+int64_t file::readv(io_buffer const* buffers, size_t count)
+{
+	iovecs v(buffers, count);
+
+	int64_t ret;
+	do {
+		ret = ::readv(fd_, v.iov_, v.count_);
+	} while (ret == -1 && (errno == EAGAIN || errno == EINTR));
+
+	if (ret == -1 && direct_ && errno == EINVAL) {
+		ret = vectored_io(buffers, count, [this](void* data, int64_t size, int64_t) {
+			return read(data, size);
+		});
+	}
+
+	return ret;
+}
+
+int64_t file::writev(const_io_buffer const* buffers, size_t count)
+{
+	iovecs v(buffers, count);
+
+	int64_t ret;
+	do {
+		ret = ::writev(fd_, v.iov_, v.count_);
+	} while (ret == -1 && (errno == EAGAIN || errno == EINTR));
+
+	if (ret == -1 && direct_ && errno == EINVAL) {
+		ret = vectored_io(buffers, count, [this](void const* data, int64_t size, int64_t) {
+			return write(data, size);
+		});
+	}
+
+	return ret;
+}
+
+int64_t file::readv_at(io_buffer const* buffers, size_t count, int64_t offset)
+{
+#if HAVE_PREADV
+	iovecs v(buffers, count);
+
+	int64_t ret;
+	do {
+		ret = ::preadv(fd_, v.iov_, v.count_, offset);
+	} while (ret == -1 && (errno == EAGAIN || errno == EINTR));
+
+	if (ret != -1 || !direct_ || errno != EINVAL) {
+		return ret;
+	}
+#endif
+	return vectored_io(buffers, count, [this, offset](void* data, int64_t size, int64_t done) {
+		return read_at(data, size, offset + done);
+	});
+}
+
+int64_t file::writev_at(const_io_buffer const* buffers, size_t count, int64_t offset)
+{
+#if HAVE_PWRITEV
+	iovecs v(buffers, count);
+
+	int64_t ret;
+	do {
+		ret = ::pwritev(fd_, v.iov_, v.count_, offset);
+	} while (ret == -1 && (errno == EAGAIN || errno == EINTR));
+
+	if (ret != -1 || !direct_ || errno != EINVAL) {
+		return ret;
+	}
+#endif
+	return vectored_io(buffers, count, [this, offset](void const* data, int64_t size, int64_t done) {
+		return write_at(data, size, offset + done);
+	});
+}
+
 bool file::opened() const
 {
 	return fd_ != -1;
@@ -244,6 +949,326 @@ bool remove_file(fz::native_string const& name)
 	return unlink(name.c_str()) == 0;
 }
 
+namespace {
+bool misaligned()
+{
+	return errno == EINVAL;
+}
+}
+
 #endif
 
+namespace {
+// Alignment is conservative, sufficient for virtually all devices.
+int64_t const direct_alignment = aligned_buffer::default_alignment;
+
+// Larger unaligned requests result in short reads or writes.
+int64_t const max_bounce_size = 1024 * 1024;
+}
+
+int64_t file::read_at(void *buf, int64_t count, int64_t offset)
+{
+	int64_t ret = native_read_at(buf, count, offset);
+	if (ret == -1 && direct_ && misaligned()) {
+		ret = unaligned_read_at(buf, count, offset);
+	}
+	return ret;
+}
+
+int64_t file::write_at(void const* buf, int64_t count, int64_t offset)
+{
+	int64_t ret = native_write_at(buf, count, offset);
+	if (ret == -1 && direct_ && misaligned()) {
+		ret = unaligned_write_at(buf, count, offset);
+	}
+	return ret;
+}
+
+int64_t file::unaligned_read_at(void *buf, int64_t count, int64_t offset)
+{
+	if (count <= 0 || offset < 0) {
+		return -1;
+	}
+	count = std::min(count, max_bounce_size);
+
+	int64_t const start = offset - offset % direct_alignment;
+	int64_t const end = (offset + count + direct_alignment - 1) / direct_alignment * direct_alignment;
+
+	aligned_buffer bounce(static_cast<size_t>(end - start), static_cast<size_t>(direct_alignment));
+	if (!bounce) {
+		return -1;
+	}
+
+	// Fill the bounce buffer, so that a short read only happens at the end of the file.
+	int64_t filled{};
+	while (filled < end - start) {
+		int64_t const r = native_read_at(bounce.data() + filled, end - start - filled, start + filled);
+		if (r < 0) {
+			return r;
+		}
+		if (!r) {
+			break;
+		}
+		filled += r;
+	}
+
+	int64_t const skip = offset - start;
+	if (filled <= skip) {
+		return 0;
+	}
+
+	int64_t const ret = std::min(filled - skip, count);
+	memcpy(buf, bounce.data() + skip, static_cast<size_t>(ret));
+	return ret;
+}
+
+int64_t file::unaligned_write_at(void const* buf, int64_t count, int64_t offset)
+{
+	if (count <= 0 || offset < 0) {
+		return -1;
+	}
+	count = std::min(count, max_bounce_size);
+
+	int64_t const start = offset - offset % direct_alignment;
+	int64_t const end = (offset + count + direct_alignment - 1) / direct_alignment * direct_alignment;
+
+	int64_t const old_size = size();
+	if (old_size < 0) {
+		return -1;
+	}
+
+	aligned_buffer bounce(static_cast<size_t>(end - start), static_cast<size_t>(direct_alignment));
+	if (!bounce) {
+		return -1;
+	}
+	memset(bounce.data(), 0, bounce.size());
+
+	// Preserve the existing data in the partially overwritten head and tail blocks
+	auto const load_block = [&](int64_t block) {
+		if (block >= old_size) {
+			return true;
+		}
+		return native_read_at(bounce.data() + block - start, direct_alignment, block) >= 0;
+	};
+	if (offset != start && !load_block(start)) {
+		return -1;
+	}
+	if (offset + count != end && (end - direct_alignment != start || offset == start) && !load_block(end - direct_alignment)) {
+		return -1;
+	}
+
+	memcpy(bounce.data() + offset - start, buf, static_cast<size_t>(count));
+
+	int64_t const written = native_write_at(bounce.data(), end - start, start);
+	if (written < 0) {
+		return written;
+	}
+
+	// Whole blocks have been written, cut off the padding past the intended end of the file.
+	int64_t const new_size = std::max(old_size, std::min(start + written, offset + count));
+	if (start + written > new_size && !truncate_at(new_size)) {
+		return -1;
+	}
+
+	return std::max(int64_t(0), std::min(start + written, offset + count) - offset);
+}
+
+namespace {
+// Kernel-side copies are split into chunks of this size to keep progress reporting responsive.
+int64_t const copy_chunk_size = 16 * 1024 * 1024;
+
+size_t const copy_buffer_size = 1024 * 1024;
+
+#ifndef FZ_WINDOWS
+// Errors indicating that a copy method is not available for the given pair of files.
+bool copy_unsupported(int error)
+{
+	return error == ENOSYS || error == EXDEV || error == EINVAL || error == EOPNOTSUPP || error == ENOTSUP || error == EBADF || error == ETXTBSY;
+}
+#endif
+}
+
+int64_t copy_file(file & src, file & dst, int64_t offset, int64_t length, copy_progress const& progress)
+{
+	if (!src.opened() || !dst.opened() || offset < 0) {
+		return -1;
+	}
+
+	int64_t const src_size = src.size();
+	if (src_size < 0) {
+		return -1;
+	}
+	int64_t const available = std::max(int64_t(0), src_size - offset);
+	if (length < 0 || length > available) {
+		length = available;
+	}
+
+	int64_t copied{};
+	auto const report = [&]() {
+		return !progress || progress(copied);
+	};
+
+#ifndef FZ_WINDOWS
+#if HAVE_LINUX_FS_H && defined(FICLONERANGE)
+	if (length) {
+		file_clone_range range{};
+		range.src_fd = src.fd_;
+		range.src_offset = static_cast<uint64_t>(offset);
+		// A length of 0 clones to the end of the file, the last block of which is usually partial.
+		range.src_length = (offset + length == src_size) ? 0 : static_cast<uint64_t>(length);
+		range.dest_offset = static_cast<uint64_t>(offset);
+		if (!ioctl(dst.fd_, FICLONERANGE, &range)) {
+			copied = length;
+			return report() ? copied : -1;
+		}
+	}
+#endif
+
+	bool supported = true;
+
+#if HAVE_COPY_FILE_RANGE
+	while (copied < length) {
+		loff_t in = offset + copied;
+		loff_t out = in;
+		ssize_t const r = copy_file_range(src.fd_, &in, dst.fd_, &out, static_cast<size_t>(std::min(copy_chunk_size, length - copied)), 0);
+		if (r == -1) {
+			if (errno == EINTR || errno == EAGAIN) {
+				continue;
+			}
+			if (!copy_unsupported(errno)) {
+				return -1;
+			}
+			supported = false;
+			break;
+		}
+		if (!r) {
+			// Source got shorter
+			return copied;
+		}
+		copied += r;
+		if (!report()) {
+			return -1;
+		}
+	}
+	if (supported) {
+		return copied;
+	}
+#endif
+
+#if HAVE_SYS_SENDFILE_H
+	// sendfile writes at the destination's file pointer
+	supported = dst.seek(offset + copied, file::begin) != -1;
+	while (supported && copied < length) {
+		off_t in = offset + copied;
+		ssize_t const r = sendfile(dst.fd_, src.fd_, &in, static_cast<size_t>(std::min(copy_chunk_size, length - copied)));
+		if (r == -1) {
+			if (errno == EINTR || errno == EAGAIN) {
+				continue;
+			}
+			if (!copy_unsupported(errno)) {
+				return -1;
+			}
+			supported = false;
+			break;
+		}
+		if (!r) {
+			return copied;
+		}
+		copied += r;
+		if (!report()) {
+			return -1;
+		}
+	}
+	if (supported) {
+		return copied;
+	}
+#endif
+	(void)supported;
+#endif
+
+	// Aligned, in case either file uses direct I/O.
+	aligned_buffer buf(copy_buffer_size);
+	if (!buf) {
+		return -1;
+	}
+	while (copied < length) {
+		int64_t const r = src.read_at(buf.data(), std::min(static_cast<int64_t>(buf.size()), length - copied), offset + copied);
+		if (r < 0) {
+			return -1;
+		}
+		if (!r) {
+			return copied;
+		}
+		for (int64_t written = 0; written < r; ) {
+			int64_t const w = dst.write_at(buf.data() + written, r - written, offset + copied + written);
+			if (w <= 0) {
+				return -1;
+			}
+			written += w;
+		}
+		copied += r;
+		if (!report()) {
+			return -1;
+		}
+	}
+
+	return copied;
+}
+
+bool copy_file(native_string const& src, native_string const& dst, bool resume, copy_progress const& progress)
+{
+	file in(src, file::reading);
+	if (!in.opened()) {
+		return false;
+	}
+
+	// Not truncated right away, the destination could be the source under another name
+	file out(dst, file::writing, file::existing);
+	if (!out.opened()) {
+		return false;
+	}
+
+#ifdef FZ_WINDOWS
+	BY_HANDLE_FILE_INFORMATION in_info, out_info;
+	if (!GetFileInformationByHandle(in.hFile_, &in_info) || !GetFileInformationByHandle(out.hFile_, &out_info)) {
+		return false;
+	}
+	if (in_info.dwVolumeSerialNumber == out_info.dwVolumeSerialNumber &&
+		in_info.nFileIndexHigh == out_info.nFileIndexHigh && in_info.nFileIndexLow == out_info.nFileIndexLow)
+	{
+		return false;
+	}
+#else
+	struct stat in_buf, out_buf;
+	if (fstat(in.fd_, &in_buf) || fstat(out.fd_, &out_buf)) {
+		return false;
+	}
+	if (in_buf.st_dev == out_buf.st_dev && in_buf.st_ino == out_buf.st_ino) {
+		return false;
+	}
+#endif
+
+	int64_t offset{};
+	if (resume) {
+		offset = out.size();
+		if (offset < 0) {
+			return false;
+		}
+	}
+	else if (!out.truncate_at(0)) {
+		return false;
+	}
+
+	int64_t const size = in.size();
+	if (size < 0) {
+		return false;
+	}
+	if (offset > size) {
+		// Destination is not a partial copy of the source
+		return false;
+	}
+
+	return copy_file(in, out, offset, -1, progress) == size - offset;
+}
+
 }
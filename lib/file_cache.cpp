@@ -0,0 +1,273 @@
+#include "libfilezilla/file_cache.hpp"
+
+#ifndef FZ_WINDOWS
+#include <sys/stat.h>
+#endif
+
+#include <vector>
+
+namespace fz {
+
+namespace {
+// Identifies a file and its version
+struct file_identity final
+{
+	uint64_t device{};
+	uint64_t inode{};
+	int64_t size{-1};
+	int64_t mtime{};
+
+	// Sub-second parts of the modification and status change times, if available. Inode numbers
+	// get reused right away, whole seconds cannot tell apart a file replaced within the same second.
+	int64_t mtime_nsec{};
+	int64_t ctime{};
+	int64_t ctime_nsec{};
+
+	bool operator==(file_identity const& op) const
+	{
+		return device == op.device && inode == op.inode && size == op.size &&
+			mtime == op.mtime && mtime_nsec == op.mtime_nsec && ctime == op.ctime && ctime_nsec == op.ctime_nsec;
+	}
+};
+
+#ifdef FZ_WINDOWS
+int64_t to_int64(FILETIME const& ft)
+{
+	return (static_cast<int64_t>(ft.dwHighDateTime) << 32) + static_cast<int64_t>(ft.dwLowDateTime);
+}
+
+// Without opening the file there is no way to get its file index, only size and modification time are compared.
+bool get_identity(native_string const& path, file_identity & id)
+{
+	WIN32_FILE_ATTRIBUTE_DATA data;
+	if (!GetFileAttributesExW(path.c_str(), GetFileExInfoStandard, &data) || (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)) {
+		return false;
+	}
+	id.size = (static_cast<int64_t>(data.nFileSizeHigh) << 32) + static_cast<int64_t>(data.nFileSizeLow);
+	id.mtime = to_int64(data.ftLastWriteTime);
+	return true;
+}
+
+bool get_identity(HANDLE h, file_identity & id, datetime & mtime)
+{
+	BY_HANDLE_FILE_INFORMATION info;
+	if (!GetFileInformationByHandle(h, &info) || (info.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)) {
+		return false;
+	}
+	id.size = (static_cast<int64_t>(info.nFileSizeHigh) << 32) + static_cast<int64_t>(info.nFileSizeLow);
+	id.mtime = to_int64(info.ftLastWriteTime);
+	mtime = datetime(info.ftLastWriteTime, datetime::milliseconds);
+	return true;
+}
+#else
+bool from_stat(struct stat const& buf, file_identity & id)
+{
+	if (!S_ISREG(buf.st_mode)) {
+		return false;
+	}
+	id.device = static_cast<uint64_t>(buf.st_dev);
+	id.inode = static_cast<uint64_t>(buf.st_ino);
+	id.size = static_cast<int64_t>(buf.st_size);
+	id.mtime = static_cast<int64_t>(buf.st_mtime);
+	id.ctime = static_cast<int64_t>(buf.st_ctime);
+#if HAVE_STRUCT_STAT_ST_MTIM
+	id.mtime_nsec = static_cast<int64_t>(buf.st_mtim.tv_nsec);
+	id.ctime_nsec = static_cast<int64_t>(buf.st_ctim.tv_nsec);
+#elif HAVE_STRUCT_STAT_ST_MTIMESPEC
+	id.mtime_nsec = static_cast<int64_t>(buf.st_mtimespec.tv_nsec);
+	id.ctime_nsec = static_cast<int64_t>(buf.st_ctimespec.tv_nsec);
+#endif
+	return true;
+}
+
+bool get_identity(native_string const& path, file_identity & id)
+{
+	struct stat buf;
+	return !stat(path.c_str(), &buf) && from_stat(buf, id);
+}
+
+bool get_identity(int fd, file_identity & id, datetime & mtime)
+{
+	struct stat buf;
+	if (fstat(fd, &buf) || !from_stat(buf, id)) {
+		return false;
+	}
+#if HAVE_STRUCT_STAT_ST_MTIM || HAVE_STRUCT_STAT_ST_MTIMESPEC
+	mtime = datetime(buf.st_mtime, datetime::milliseconds);
+	mtime += duration::from_milliseconds(id.mtime_nsec / 1000000);
+#else
+	mtime = datetime(buf.st_mtime, datetime::seconds);
+#endif
+	return true;
+}
+#endif
+}
+
+struct file_cache::entry final
+{
+	native_string path_;
+	file file_;
+	file_identity id_;
+	datetime mtime_;
+
+	// Protected by the cache's mutex
+	monotonic_clock validated_;
+};
+
+file& file_cache::lease::operator*() const
+{
+	return entry_->file_;
+}
+
+file* file_cache::lease::operator->() const
+{
+	return &entry_->file_;
+}
+
+int64_t file_cache::lease::size() const
+{
+	return entry_->id_.size;
+}
+
+datetime const& file_cache::lease::modification_time() const
+{
+	return entry_->mtime_;
+}
+
+file_cache::file_cache(size_t max_open, duration const& revalidate)
+	: max_open_(max_open)
+	, revalidate_(revalidate)
+{
+}
+
+file_cache::~file_cache()
+{
+	clear();
+}
+
+file_cache::lease file_cache::open(native_string const& path)
+{
+	// Declared before any lock so that files get closed with the mutex unlocked
+	std::vector<std::shared_ptr<entry>> closed;
+	std::shared_ptr<entry> e;
+
+	{
+		scoped_lock l(m_);
+		auto it = entries_.find(path);
+		if (it != entries_.end()) {
+			e = *it->second;
+			if (revalidate_ && monotonic_clock::now() - e->validated_ < revalidate_) {
+				lru_.splice(lru_.begin(), lru_, it->second);
+				++hits_;
+				evict(closed);
+				return lease(e);
+			}
+		}
+	}
+
+	if (e) {
+		file_identity id;
+		if (get_identity(path, id) && id == e->id_) {
+			scoped_lock l(m_);
+			auto it = entries_.find(path);
+			if (it != entries_.end() && *it->second == e) {
+				e->validated_ = monotonic_clock::now();
+				lru_.splice(lru_.begin(), lru_, it->second);
+			}
+			++hits_;
+			evict(closed);
+			return lease(e);
+		}
+		closed.emplace_back(std::move(e));
+	}
+
+	auto ne = std::make_shared<entry>();
+	ne->path_ = path;
+	bool opened = ne->file_.open(path, file::reading);
+	if (opened) {
+#ifdef FZ_WINDOWS
+		opened = get_identity(ne->file_.hFile_, ne->id_, ne->mtime_);
+#else
+		opened = get_identity(ne->file_.fd_, ne->id_, ne->mtime_);
+#endif
+	}
+
+	scoped_lock l(m_);
+	++misses_;
+
+	auto it = entries_.find(path);
+	if (it != entries_.end()) {
+		closed.emplace_back(std::move(*it->second));
+		lru_.erase(it->second);
+		entries_.erase(it);
+	}
+	if (!opened) {
+		return lease();
+	}
+
+	ne->validated_ = monotonic_clock::now();
+	lru_.push_front(ne);
+	entries_[path] = lru_.begin();
+
+	evict(closed);
+
+	return lease(ne);
+}
+
+void file_cache::evict(std::vector<std::shared_ptr<entry>> & closed)
+{
+	// Close the least recently used files no longer leased. If the limit was exceeded as all files
+	// were leased, this catches up once leases are gone.
+	auto it = lru_.end();
+	while (entries_.size() > max_open_ && it != lru_.begin()) {
+		--it;
+		if (it->use_count() == 1) {
+			entries_.erase((*it)->path_);
+			closed.emplace_back(std::move(*it));
+			it = lru_.erase(it);
+		}
+	}
+}
+
+void file_cache::invalidate(native_string const& path)
+{
+	// Declared before the lock so that the file gets closed with the mutex unlocked
+	std::shared_ptr<entry> e;
+
+	scoped_lock l(m_);
+	auto it = entries_.find(path);
+	if (it != entries_.end()) {
+		e = std::move(*it->second);
+		lru_.erase(it->second);
+		entries_.erase(it);
+	}
+}
+
+void file_cache::clear()
+{
+	lru_list closed;
+
+	scoped_lock l(m_);
+	entries_.clear();
+	closed.swap(lru_);
+}
+
+size_t file_cache::size() const
+{
+	scoped_lock l(m_);
+	return entries_.size();
+}
+
+uint64_t file_cache::hits() const
+{
+	scoped_lock l(m_);
+	return hits_;
+}
+
+uint64_t file_cache::misses() const
+{
+	scoped_lock l(m_);
+	return misses_;
+}
+
+}
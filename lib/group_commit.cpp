@@ -0,0 +1,131 @@
+#include "libfilezilla/group_commit.hpp"
+#include "libfilezilla/event_handler.hpp"
+
+#include <algorithm>
+
+namespace fz {
+
+template class simple_event<group_commit_event_type, file*, bool>;
+
+struct group_commit::request final
+{
+	file* f_{};
+
+	// Set for asynchronous requests, which are owned by the group_commit
+	event_handler* handler_{};
+	bool async_{};
+
+	bool done_{};
+	bool result_{};
+};
+
+group_commit::group_commit(duration const& interval, bool data_only)
+	: interval_(interval)
+	, data_only_(data_only)
+{
+	task_ = pool_.spawn([this]() { run(); });
+}
+
+group_commit::~group_commit()
+{
+	{
+		scoped_lock l(m_);
+		quit_ = true;
+		wakeup_.signal(l);
+	}
+	task_.join();
+}
+
+bool group_commit::commit(file & f)
+{
+	request r;
+	r.f_ = &f;
+
+	scoped_lock l(m_);
+	pending_.push_back(&r);
+	wakeup_.signal(l);
+	done_.wait(l, [&r]() { return r.done_; });
+
+	return r.result_;
+}
+
+void group_commit::commit(file & f, event_handler & h)
+{
+	auto* r = new request;
+	r->f_ = &f;
+	r->handler_ = &h;
+	r->async_ = true;
+
+	scoped_lock l(m_);
+	pending_.push_back(r);
+	wakeup_.signal(l);
+}
+
+void group_commit::cancel(event_handler & h)
+{
+	scoped_lock l(m_);
+	for (auto* r : pending_) {
+		if (r->handler_ == &h) {
+			r->handler_ = nullptr;
+		}
+	}
+	for (auto* r : flushing_) {
+		if (r->handler_ == &h) {
+			r->handler_ = nullptr;
+		}
+	}
+}
+
+void group_commit::run()
+{
+	scoped_lock l(m_);
+	while (true) {
+		while (pending_.empty() && !quit_) {
+			wakeup_.wait(l);
+		}
+		if (pending_.empty()) {
+			break;
+		}
+
+		if (interval_ && !quit_) {
+			// Let the batch grow
+			auto const deadline = monotonic_clock::now() + interval_;
+			while (!quit_ && wakeup_.wait_until(l, deadline)) {
+			}
+		}
+
+		flushing_.swap(pending_);
+		std::vector<file*> files;
+		for (auto const* r : flushing_) {
+			if (std::find(files.cbegin(), files.cend(), r->f_) == files.cend()) {
+				files.push_back(r->f_);
+			}
+		}
+
+		l.unlock();
+		std::vector<bool> results;
+		results.reserve(files.size());
+		for (auto* f : files) {
+			results.push_back(data_only_ ? f->fdatasync() : f->fsync());
+		}
+		l.lock();
+
+		for (auto* r : flushing_) {
+			bool const result = results[std::find(files.cbegin(), files.cend(), r->f_) - files.cbegin()];
+			if (r->async_) {
+				if (r->handler_) {
+					r->handler_->send_event<group_commit_event>(r->f_, result);
+				}
+				delete r;
+			}
+			else {
+				r->result_ = result;
+				r->done_ = true;
+			}
+		}
+		flushing_.clear();
+		done_.broadcast(l);
+	}
+}
+
+}
@@ -0,0 +1,800 @@
+#include "libfilezilla/hash.hpp"
+#include "libfilezilla/aligned_buffer.hpp"
+#include "libfilezilla/file.hpp"
+#include "libfilezilla/thread_pool.hpp"
+
+#include <algorithm>
+#include <atomic>
+
+#include <string.h>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define FZ_HASH_X86 1
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define FZ_TARGET(x)
+#else
+#include <cpuid.h>
+#define FZ_TARGET(x) __attribute__((target(x)))
+#endif
+#include <immintrin.h>
+#endif
+
+namespace fz {
+
+namespace {
+
+#if FZ_HASH_X86
+struct cpu_features final
+{
+	cpu_features()
+	{
+		unsigned int regs[4]{};
+#ifdef _MSC_VER
+		int info[4];
+		__cpuid(info, 0);
+		int const max = info[0];
+		if (max >= 1) {
+			__cpuid(info, 1);
+			sse42_ = (info[2] & (1 << 20)) != 0;
+			sse41_ = (info[2] & (1 << 19)) != 0;
+			ssse3_ = (info[2] & (1 << 9)) != 0;
+		}
+		if (max >= 7) {
+			__cpuidex(info, 7, 0);
+			sha_ = (info[1] & (1 << 29)) != 0;
+		}
+		(void)regs;
+#else
+		if (__get_cpuid(1, &regs[0], &regs[1], &regs[2], &regs[3])) {
+			sse42_ = (regs[2] & bit_SSE4_2) != 0;
+			sse41_ = (regs[2] & bit_SSE4_1) != 0;
+			ssse3_ = (regs[2] & bit_SSSE3) != 0;
+		}
+		if (__get_cpuid_count(7, 0, &regs[0], &regs[1], &regs[2], &regs[3])) {
+			sha_ = (regs[1] & (1u << 29)) != 0;
+		}
+#endif
+	}
+
+	bool sse42_{};
+	bool sse41_{};
+	bool ssse3_{};
+	bool sha_{};
+};
+
+cpu_features const& cpu()
+{
+	static cpu_features const features;
+	return features;
+}
+#endif
+
+uint32_t load_be32(uint8_t const* p)
+{
+	return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | uint32_t(p[3]);
+}
+
+uint32_t load_le32(uint8_t const* p)
+{
+	return uint32_t(p[0]) | (uint32_t(p[1]) << 8) | (uint32_t(p[2]) << 16) | (uint32_t(p[3]) << 24);
+}
+
+uint64_t load_le64(uint8_t const* p)
+{
+	return uint64_t(load_le32(p)) | (uint64_t(load_le32(p + 4)) << 32);
+}
+
+void store_be32(uint8_t* p, uint32_t v)
+{
+	p[0] = static_cast<uint8_t>(v >> 24);
+	p[1] = static_cast<uint8_t>(v >> 16);
+	p[2] = static_cast<uint8_t>(v >> 8);
+	p[3] = static_cast<uint8_t>(v);
+}
+
+void store_be64(uint8_t* p, uint64_t v)
+{
+	store_be32(p, static_cast<uint32_t>(v >> 32));
+	store_be32(p + 4, static_cast<uint32_t>(v));
+}
+
+uint32_t rotr32(uint32_t v, int n)
+{
+	return (v >> n) | (v << (32 - n));
+}
+
+uint64_t rotl64(uint64_t v, int n)
+{
+	return (v << n) | (v >> (64 - n));
+}
+
+/*
+ * CRC32C
+ */
+
+// Slicing-by-8 tables for the reflected Castagnoli polynomial
+struct crc32c_tables final
+{
+	crc32c_tables()
+	{
+		for (uint32_t i = 0; i < 256; ++i) {
+			uint32_t crc = i;
+			for (int j = 0; j < 8; ++j) {
+				crc = (crc >> 1) ^ ((crc & 1) ? 0x82f63b78u : 0);
+			}
+			t_[0][i] = crc;
+		}
+		for (uint32_t i = 0; i < 256; ++i) {
+			for (int k = 1; k < 8; ++k) {
+				t_[k][i] = (t_[k - 1][i] >> 8) ^ t_[0][t_[k - 1][i] & 0xff];
+			}
+		}
+	}
+
+	uint32_t t_[8][256];
+};
+
+uint32_t crc32c_sw(uint32_t crc, uint8_t const* p, size_t size)
+{
+	static crc32c_tables const tables;
+	auto const& t = tables.t_;
+
+	while (size >= 8) {
+		uint32_t const lo = load_le32(p) ^ crc;
+		uint32_t const hi = load_le32(p + 4);
+		crc = t[7][lo & 0xff] ^ t[6][(lo >> 8) & 0xff] ^ t[5][(lo >> 16) & 0xff] ^ t[4][lo >> 24] ^
+			t[3][hi & 0xff] ^ t[2][(hi >> 8) & 0xff] ^ t[1][(hi >> 16) & 0xff] ^ t[0][hi >> 24];
+		p += 8;
+		size -= 8;
+	}
+	while (size--) {
+		crc = (crc >> 8) ^ t[0][(crc ^ *p++) & 0xff];
+	}
+	return crc;
+}
+
+#if FZ_HASH_X86
+FZ_TARGET("sse4.2")
+uint32_t crc32c_sse42(uint32_t crc, uint8_t const* p, size_t size)
+{
+#if defined(__x86_64__) || defined(_M_X64)
+	uint64_t crc64 = crc;
+	while (size >= 8) {
+		uint64_t v;
+		memcpy(&v, p, 8);
+		crc64 = _mm_crc32_u64(crc64, v);
+		p += 8;
+		size -= 8;
+	}
+	crc = static_cast<uint32_t>(crc64);
+#endif
+	while (size >= 4) {
+		uint32_t v;
+		memcpy(&v, p, 4);
+		crc = _mm_crc32_u32(crc, v);
+		p += 4;
+		size -= 4;
+	}
+	while (size--) {
+		crc = _mm_crc32_u8(crc, *p++);
+	}
+	return crc;
+}
+#endif
+
+typedef uint32_t (*crc32c_func)(uint32_t, uint8_t const*, size_t);
+
+crc32c_func select_crc32c()
+{
+#if FZ_HASH_X86
+	if (cpu().sse42_) {
+		return &crc32c_sse42;
+	}
+#endif
+	return &crc32c_sw;
+}
+
+uint32_t crc32c_update(uint32_t crc, uint8_t const* p, size_t size)
+{
+	static crc32c_func const f = select_crc32c();
+	return f(crc, p, size);
+}
+
+/*
+ * XXH64
+ */
+uint64_t const xxh_p1 = 0x9e3779b185ebca87ull;
+uint64_t const xxh_p2 = 0xc2b2ae3d27d4eb4full;
+uint64_t const xxh_p3 = 0x165667b19e3779f9ull;
+uint64_t const xxh_p4 = 0x85ebca77c2b2ae63ull;
+uint64_t const xxh_p5 = 0x27d4eb2f165667c5ull;
+
+uint64_t xxh_round(uint64_t acc, uint64_t lane)
+{
+	acc += lane * xxh_p2;
+	acc = rotl64(acc, 31);
+	return acc * xxh_p1;
+}
+
+uint64_t xxh_merge(uint64_t acc, uint64_t v)
+{
+	acc ^= xxh_round(0, v);
+	return acc * xxh_p1 + xxh_p4;
+}
+
+class xxh64_state final
+{
+public:
+	explicit xxh64_state(uint64_t seed = 0)
+	{
+		reset(seed);
+	}
+
+	void reset(uint64_t seed = 0)
+	{
+		seed_ = seed;
+		v_[0] = seed + xxh_p1 + xxh_p2;
+		v_[1] = seed + xxh_p2;
+		v_[2] = seed;
+		v_[3] = seed - xxh_p1;
+		total_ = 0;
+		buffered_ = 0;
+	}
+
+	void update(uint8_t const* p, size_t size)
+	{
+		total_ += size;
+
+		if (buffered_) {
+			size_t const n = std::min(size, sizeof(buffer_) - buffered_);
+			memcpy(buffer_ + buffered_, p, n);
+			buffered_ += n;
+			p += n;
+			size -= n;
+			if (buffered_ < sizeof(buffer_)) {
+				return;
+			}
+			stripe(buffer_);
+			buffered_ = 0;
+		}
+
+		while (size >= 32) {
+			stripe(p);
+			p += 32;
+			size -= 32;
+		}
+
+		memcpy(buffer_, p, size);
+		buffered_ = size;
+	}
+
+	uint64_t digest() const
+	{
+		uint64_t h;
+		if (total_ >= 32) {
+			h = rotl64(v_[0], 1) + rotl64(v_[1], 7) + rotl64(v_[2], 12) + rotl64(v_[3], 18);
+			for (auto const v : v_) {
+				h = xxh_merge(h, v);
+			}
+		}
+		else {
+			h = seed_ + xxh_p5;
+		}
+		h += total_;
+
+		uint8_t const* p = buffer_;
+		size_t size = buffered_;
+		while (size >= 8) {
+			h ^= xxh_round(0, load_le64(p));
+			h = rotl64(h, 27) * xxh_p1 + xxh_p4;
+			p += 8;
+			size -= 8;
+		}
+		if (size >= 4) {
+			h ^= uint64_t(load_le32(p)) * xxh_p1;
+			h = rotl64(h, 23) * xxh_p2 + xxh_p3;
+			p += 4;
+			size -= 4;
+		}
+		while (size--) {
+			h ^= (*p++) * xxh_p5;
+			h = rotl64(h, 11) * xxh_p1;
+		}
+
+		h ^= h >> 33;
+		h *= xxh_p2;
+		h ^= h >> 29;
+		h *= xxh_p3;
+		h ^= h >> 32;
+		return h;
+	}
+
+private:
+	void stripe(uint8_t const* p)
+	{
+		v_[0] = xxh_round(v_[0], load_le64(p));
+		v_[1] = xxh_round(v_[1], load_le64(p + 8));
+		v_[2] = xxh_round(v_[2], load_le64(p + 16));
+		v_[3] = xxh_round(v_[3], load_le64(p + 24));
+	}
+
+	uint64_t seed_{};
+	uint64_t v_[4];
+	uint64_t total_{};
+	uint8_t buffer_[32];
+	size_t buffered_{};
+};
+
+/*
+ * SHA-256
+ */
+uint32_t const sha256_k[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+void sha256_blocks_sw(uint32_t* state, uint8_t const* p, size_t blocks)
+{
+	while (blocks--) {
+		uint32_t w[64];
+		for (int i = 0; i < 16; ++i) {
+			w[i] = load_be32(p + i * 4);
+		}
+		for (int i = 16; i < 64; ++i) {
+			uint32_t const s0 = rotr32(w[i - 15], 7) ^ rotr32(w[i - 15], 18) ^ (w[i - 15] >> 3);
+			uint32_t const s1 = rotr32(w[i - 2], 17) ^ rotr32(w[i - 2], 19) ^ (w[i - 2] >> 10);
+			w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+		}
+
+		uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+		uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+		for (int i = 0; i < 64; ++i) {
+			uint32_t const s1 = rotr32(e, 6) ^ rotr32(e, 11) ^ rotr32(e, 25);
+			uint32_t const ch = (e & f) ^ (~e & g);
+			uint32_t const t1 = h + s1 + ch + sha256_k[i] + w[i];
+			uint32_t const s0 = rotr32(a, 2) ^ rotr32(a, 13) ^ rotr32(a, 22);
+			uint32_t const maj = (a & b) ^ (a & c) ^ (b & c);
+			uint32_t const t2 = s0 + maj;
+			h = g;
+			g = f;
+			f = e;
+			e = d + t1;
+			d = c;
+			c = b;
+			b = a;
+			a = t1 + t2;
+		}
+
+		state[0] += a;
+		state[1] += b;
+		state[2] += c;
+		state[3] += d;
+		state[4] += e;
+		state[5] += f;
+		state[6] += g;
+		state[7] += h;
+
+		p += 64;
+	}
+}
+
+#if FZ_HASH_X86
+FZ_TARGET("sha,sse4.1,ssse3")
+void sha256_blocks_shani(uint32_t* state, uint8_t const* p, size_t blocks)
+{
+	__m128i const shuffle = _mm_set_epi64x(0x0c0d0e0f08090a0bll, 0x0405060700010203ll);
+
+	// The instructions operate on the state in ABEF/CDGH order
+	__m128i tmp = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<__m128i const*>(state)), 0xb1);
+	__m128i state1 = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<__m128i const*>(state + 4)), 0x1b);
+	__m128i state0 = _mm_alignr_epi8(tmp, state1, 8);
+	state1 = _mm_blend_epi16(state1, tmp, 0xf0);
+
+	while (blocks--) {
+		__m128i const abef = state0;
+		__m128i const cdgh = state1;
+
+		__m128i m[4];
+		for (int i = 0; i < 16; ++i) {
+			if (i < 4) {
+				m[i] = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<__m128i const*>(p + i * 16)), shuffle);
+			}
+			else {
+				// W[t] = s1(W[t-2]) + W[t-7] + s0(W[t-15]) + W[t-16]
+				__m128i const w = _mm_add_epi32(_mm_sha256msg1_epu32(m[i % 4], m[(i + 1) % 4]), _mm_alignr_epi8(m[(i + 3) % 4], m[(i + 2) % 4], 4));
+				m[i % 4] = _mm_sha256msg2_epu32(w, m[(i + 3) % 4]);
+			}
+
+			__m128i msg = _mm_add_epi32(m[i % 4], _mm_loadu_si128(reinterpret_cast<__m128i const*>(sha256_k + i * 4)));
+			state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+			msg = _mm_shuffle_epi32(msg, 0x0e);
+			state0 = _mm_sha256rnds2_epu32(state0, state1, msg);
+		}
+
+		state0 = _mm_add_epi32(state0, abef);
+		state1 = _mm_add_epi32(state1, cdgh);
+
+		p += 64;
+	}
+
+	tmp = _mm_shuffle_epi32(state0, 0x1b);
+	state1 = _mm_shuffle_epi32(state1, 0xb1);
+	state0 = _mm_blend_epi16(tmp, state1, 0xf0);
+	state1 = _mm_alignr_epi8(state1, tmp, 8);
+
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(state), state0);
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(state + 4), state1);
+}
+#endif
+
+typedef void (*sha256_func)(uint32_t*, uint8_t const*, size_t);
+
+sha256_func select_sha256()
+{
+#if FZ_HASH_X86
+	if (cpu().sha_ && cpu().sse41_ && cpu().ssse3_) {
+		return &sha256_blocks_shani;
+	}
+#endif
+	return &sha256_blocks_sw;
+}
+
+void sha256_blocks(uint32_t* state, uint8_t const* p, size_t blocks)
+{
+	static sha256_func const f = select_sha256();
+	f(state, p, blocks);
+}
+
+class sha256_state final
+{
+public:
+	sha256_state()
+	{
+		reset();
+	}
+
+	void reset()
+	{
+		static uint32_t const initial[8] = {
+			0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+		};
+		memcpy(state_, initial, sizeof(state_));
+		total_ = 0;
+		buffered_ = 0;
+	}
+
+	void update(uint8_t const* p, size_t size)
+	{
+		total_ += size;
+
+		if (buffered_) {
+			size_t const n = std::min(size, sizeof(buffer_) - buffered_);
+			memcpy(buffer_ + buffered_, p, n);
+			buffered_ += n;
+			p += n;
+			size -= n;
+			if (buffered_ < sizeof(buffer_)) {
+				return;
+			}
+			sha256_blocks(state_, buffer_, 1);
+			buffered_ = 0;
+		}
+
+		if (size >= 64) {
+			sha256_blocks(state_, p, size / 64);
+			p += size & ~size_t(63);
+			size &= 63;
+		}
+
+		memcpy(buffer_, p, size);
+		buffered_ = size;
+	}
+
+	std::vector<uint8_t> digest()
+	{
+		uint64_t const bits = total_ * 8;
+
+		uint8_t pad[72]{};
+		pad[0] = 0x80;
+		size_t const pad_size = (buffered_ < 56) ? (56 - buffered_) : (120 - buffered_);
+		store_be64(pad + pad_size, bits);
+		update(pad, pad_size + 8);
+
+		std::vector<uint8_t> ret(32);
+		for (int i = 0; i < 8; ++i) {
+			store_be32(ret.data() + i * 4, state_[i]);
+		}
+		return ret;
+	}
+
+private:
+	uint32_t state_[8];
+	uint64_t total_{};
+	uint8_t buffer_[64];
+	size_t buffered_{};
+};
+}
+
+size_t digest_size(hash_algorithm algorithm)
+{
+	switch (algorithm) {
+	case hash_algorithm::crc32c:
+		return 4;
+	case hash_algorithm::xxh64:
+		return 8;
+	case hash_algorithm::sha256:
+		return 32;
+	}
+	return 0;
+}
+
+class hash_accumulator::impl
+{
+public:
+	virtual ~impl() = default;
+
+	virtual void reset() = 0;
+	virtual void update(uint8_t const* p, size_t size) = 0;
+	virtual std::vector<uint8_t> digest() = 0;
+};
+
+namespace {
+class crc32c_impl final : public hash_accumulator::impl
+{
+public:
+	virtual void reset() override
+	{
+		crc_ = 0;
+	}
+
+	virtual void update(uint8_t const* p, size_t size) override
+	{
+		crc_ = crc32c(p, size, crc_);
+	}
+
+	virtual std::vector<uint8_t> digest() override
+	{
+		std::vector<uint8_t> ret(4);
+		store_be32(ret.data(), crc_);
+		reset();
+		return ret;
+	}
+
+private:
+	uint32_t crc_{};
+};
+
+class xxh64_impl final : public hash_accumulator::impl
+{
+public:
+	virtual void reset() override
+	{
+		state_.reset();
+	}
+
+	virtual void update(uint8_t const* p, size_t size) override
+	{
+		state_.update(p, size);
+	}
+
+	virtual std::vector<uint8_t> digest() override
+	{
+		std::vector<uint8_t> ret(8);
+		store_be64(ret.data(), state_.digest());
+		reset();
+		return ret;
+	}
+
+private:
+	xxh64_state state_;
+};
+
+class sha256_impl final : public hash_accumulator::impl
+{
+public:
+	virtual void reset() override
+	{
+		state_.reset();
+	}
+
+	virtual void update(uint8_t const* p, size_t size) override
+	{
+		state_.update(p, size);
+	}
+
+	virtual std::vector<uint8_t> digest() override
+	{
+		auto ret = state_.digest();
+		reset();
+		return ret;
+	}
+
+private:
+	sha256_state state_;
+};
+}
+
+hash_accumulator::hash_accumulator(hash_algorithm algorithm)
+	: algorithm_(algorithm)
+{
+	switch (algorithm) {
+	case hash_algorithm::crc32c:
+		impl_ = std::make_unique<crc32c_impl>();
+		break;
+	case hash_algorithm::xxh64:
+		impl_ = std::make_unique<xxh64_impl>();
+		break;
+	case hash_algorithm::sha256:
+		impl_ = std::make_unique<sha256_impl>();
+		break;
+	}
+}
+
+hash_accumulator::~hash_accumulator()
+{
+}
+
+void hash_accumulator::reset()
+{
+	impl_->reset();
+}
+
+void hash_accumulator::update(void const* data, size_t size)
+{
+	impl_->update(static_cast<uint8_t const*>(data), size);
+}
+
+void hash_accumulator::update(std::string const& data)
+{
+	update(data.c_str(), data.size());
+}
+
+void hash_accumulator::update(std::vector<uint8_t> const& data)
+{
+	update(data.data(), data.size());
+}
+
+std::vector<uint8_t> hash_accumulator::digest()
+{
+	return impl_->digest();
+}
+
+uint32_t crc32c(void const* data, size_t size, uint32_t crc)
+{
+	return ~crc32c_update(~crc, static_cast<uint8_t const*>(data), size);
+}
+
+uint64_t xxh64(void const* data, size_t size, uint64_t seed)
+{
+	xxh64_state state(seed);
+	state.update(static_cast<uint8_t const*>(data), size);
+	return state.digest();
+}
+
+std::vector<uint8_t> sha256(void const* data, size_t size)
+{
+	sha256_state state;
+	state.update(static_cast<uint8_t const*>(data), size);
+	return state.digest();
+}
+
+std::vector<uint8_t> sha256(std::string const& data)
+{
+	return sha256(data.c_str(), data.size());
+}
+
+namespace {
+size_t const hash_chunk_size = 1024 * 1024;
+
+// How far ahead of the current position the system is asked to read
+int64_t const hash_readahead = 8 * 1024 * 1024;
+}
+
+std::vector<uint8_t> hash_file(file & f, hash_algorithm algorithm, int64_t offset, int64_t length)
+{
+	if (!f.opened() || offset < 0) {
+		return std::vector<uint8_t>();
+	}
+	if (length < 0) {
+		int64_t const size = f.size();
+		if (size < offset) {
+			return std::vector<uint8_t>();
+		}
+		length = size - offset;
+	}
+
+	aligned_buffer buf(hash_chunk_size);
+	if (!buf) {
+		return std::vector<uint8_t>();
+	}
+
+	hash_accumulator acc(algorithm);
+
+	int64_t const end = offset + length;
+	int64_t hinted = offset;
+	while (offset < end) {
+		if (hinted < std::min(end, offset + hash_readahead / 2)) {
+			int64_t const hint = std::min(end, offset + hash_readahead) - hinted;
+			f.readahead(hinted, hint);
+			hinted += hint;
+		}
+
+		int64_t const r = f.read_at(buf.data(), std::min(static_cast<int64_t>(buf.size()), end - offset), offset);
+		if (r <= 0) {
+			return std::vector<uint8_t>();
+		}
+		acc.update(buf.data(), static_cast<size_t>(r));
+		offset += r;
+	}
+
+	return acc.digest();
+}
+
+std::vector<std::vector<uint8_t>> hash_file_segments(file & f, hash_algorithm algorithm, int64_t segment_size, thread_pool & pool, size_t parallel)
+{
+	std::vector<std::vector<uint8_t>> ret;
+
+	int64_t const size = f.size();
+	if (size <= 0 || segment_size <= 0) {
+		return ret;
+	}
+
+	size_t const segments = static_cast<size_t>((size + segment_size - 1) / segment_size);
+	ret.resize(segments);
+
+	std::atomic<size_t> next{};
+	std::atomic<bool> failed{};
+	auto const worker = [&]() {
+		size_t i;
+		while (!failed && (i = next++) < segments) {
+			int64_t const offset = static_cast<int64_t>(i) * segment_size;
+			ret[i] = hash_file(f, algorithm, offset, std::min(segment_size, size - offset));
+			if (ret[i].empty()) {
+				failed = true;
+			}
+		}
+	};
+
+	std::vector<async_task> tasks;
+	size_t const threads = std::min(std::max(parallel, size_t(1)), segments);
+	for (size_t i = 1; i < threads; ++i) {
+		tasks.emplace_back(pool.spawn(worker));
+	}
+	// The calling thread also does its share of the work
+	worker();
+	for (auto & task : tasks) {
+		task.join();
+	}
+
+	if (failed) {
+		ret.clear();
+	}
+	return ret;
+}
+
+std::vector<uint8_t> hash_file_tree(file & f, hash_algorithm algorithm, int64_t segment_size, thread_pool & pool, size_t parallel)
+{
+	if (!f.opened() || segment_size <= 0) {
+		return std::vector<uint8_t>();
+	}
+
+	auto const segments = hash_file_segments(f, algorithm, segment_size, pool, parallel);
+	if (segments.empty() && f.size() != 0) {
+		return std::vector<uint8_t>();
+	}
+
+	hash_accumulator acc(algorithm);
+	for (auto const& segment : segments) {
+		acc.update(segment);
+	}
+	return acc.digest();
+}
+
+}
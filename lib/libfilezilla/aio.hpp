@@ -0,0 +1,110 @@
+#ifndef LIBFILEZILLA_AIO_HEADER
+#define LIBFILEZILLA_AIO_HEADER
+
+#include "libfilezilla.hpp"
+#include "event.hpp"
+#include "file.hpp"
+
+/** \file
+ * \brief Asynchronous file I/O: \ref fz::aio_engine "aio_engine"
+ */
+
+namespace fz {
+
+class event_handler;
+
+/// Identifies an operation started through \ref aio_engine, never 0.
+typedef uint64_t aio_id;
+
+/// \private
+struct aio_event_type{};
+
+/** \brief Sent to the handler once an asynchronous file operation has completed.
+ *
+ * The arguments are the id of the operation as returned when it was started, and its result:
+ * - For reads and writes: The number of octets read or written, or -1 on error.
+ *   Like \ref file::read_at and \ref file::write_at, this can be less than requested.
+ * - For fsync and open: 0 on success, -1 on error.
+ */
+typedef simple_event<aio_event_type, aio_id, int64_t> aio_event;
+
+/// \private
+/// This instantiation must be a public symbol
+extern template class FZ_PUBLIC_SYMBOL simple_event<aio_event_type, aio_id, int64_t>;
+
+/** \brief Performs file operations asynchronously
+ *
+ * Operations are started from any thread and complete in the background. Their completion
+ * is signalled by an \ref aio_event sent to the passed \ref event_handler.
+ *
+ * On Linux, io_uring is used if supported by the kernel. A single background thread then
+ * collects the completions of any number of operations in flight. Elsewhere, the operations
+ * are performed synchronously by a bounded number of worker threads.
+ *
+ * Files opened for direct I/O are supported. As with \ref file::read_at and \ref file::write_at,
+ * unaligned requests are slower as they go through an internal aligned buffer, on a worker thread.
+ *
+ * The file and the buffers passed must remain valid until the operation has completed.
+ * Don't otherwise use a file while an operation on it is in progress.
+ *
+ * Before destroying a handler with outstanding operations, call \ref cancel, followed by
+ * event_handler::remove_handler to discard completions already sent.
+ */
+class FZ_PUBLIC_SYMBOL aio_engine final
+{
+public:
+	/** \brief Creates the engine
+	 *
+	 * \param max_in_flight Maximum number of operations in progress at the same time. Further operations are queued.
+	 * \param threads Number of worker threads if io_uring is not available.
+	 * \param use_io_uring If false, worker threads are used even if io_uring is available.
+	 */
+	explicit aio_engine(size_t max_in_flight = 256, size_t threads = 8, bool use_io_uring = true);
+
+	/// Waits for all outstanding operations to complete.
+	~aio_engine();
+
+	aio_engine(aio_engine const&) = delete;
+	aio_engine& operator=(aio_engine const&) = delete;
+
+	/// Reads up to \c count octets from the given offset, like \ref file::read_at
+	aio_id read(event_handler & h, file & f, void *buf, int64_t count, int64_t offset);
+
+	/// Writes up to \c count octets at the given offset, like \ref file::write_at
+	aio_id write(event_handler & h, file & f, void const* buf, int64_t count, int64_t offset);
+
+	/// Flushes data and metadata of the file to the disk
+	aio_id fsync(event_handler & h, file & f);
+
+	/** \brief Opens the file, like \ref file::open
+	 *
+	 * If the file is already opened, it is closed first, synchronously.
+	 */
+	aio_id open(event_handler & h, file & f, native_string const& name, file::mode m, file::creation_flags d = file::existing);
+
+	/** \brief Cancels the completion events for the handler.
+	 *
+	 * Waits for all of the handler's operations in progress to complete. Queued operations
+	 * are not started. No events are sent to the handler for any of them.
+	 */
+	void cancel(event_handler & h);
+
+	/// Returns true if io_uring is used
+	bool uses_io_uring() const;
+
+private:
+	class impl;
+
+	// Access to the native file handle
+#ifdef FZ_WINDOWS
+	static HANDLE& native_handle(file & f);
+#else
+	static int& native_handle(file & f);
+#endif
+
+	impl* impl_;
+};
+
+}
+
+#endif
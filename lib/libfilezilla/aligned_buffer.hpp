@@ -0,0 +1,99 @@
+#ifndef LIBFILEZILLA_ALIGNED_BUFFER_HEADER
+#define LIBFILEZILLA_ALIGNED_BUFFER_HEADER
+
+#include "libfilezilla.hpp"
+#include "mutex.hpp"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+/** \file
+ * \brief Memory buffers with alignment suitable for direct I/O: \ref fz::aligned_buffer "aligned_buffer" and \ref fz::aligned_buffer_pool "aligned_buffer_pool"
+ */
+
+namespace fz {
+
+/** \brief A fixed-size buffer whose memory is aligned to a given boundary
+ *
+ * Files opened with \ref file::open_options::direct bypass the page cache. With such
+ * files, using buffers aligned to the page size avoids costly internal copies.
+ */
+class FZ_PUBLIC_SYMBOL aligned_buffer final
+{
+public:
+	/// Default alignment, the page size on most systems. Also sufficient for the logical block size of virtually all storage devices.
+	static size_t const default_alignment = 4096;
+
+	aligned_buffer() = default;
+
+	/** \brief Allocates the buffer
+	 *
+	 * \param size Size of the buffer
+	 * \param alignment Must be a power of two
+	 *
+	 * If allocation fails, the buffer is empty, check using \ref data.
+	 */
+	explicit aligned_buffer(size_t size, size_t alignment = default_alignment);
+
+	~aligned_buffer();
+
+	aligned_buffer(aligned_buffer const&) = delete;
+	aligned_buffer& operator=(aligned_buffer const&) = delete;
+
+	aligned_buffer(aligned_buffer && op) noexcept;
+	aligned_buffer& operator=(aligned_buffer && op) noexcept;
+
+	uint8_t* data() const { return data_; }
+	size_t size() const { return size_; }
+	size_t alignment() const { return alignment_; }
+
+	explicit operator bool() const { return data_ != nullptr; }
+
+private:
+	void reset();
+
+	uint8_t* data_{};
+	size_t size_{};
+	size_t alignment_{};
+};
+
+/** \brief Recycles aligned buffers of the same size
+ *
+ * Allocating large aligned buffers is expensive, a pool keeps a number of them around for reuse.
+ * All functions can be called from any thread.
+ */
+class FZ_PUBLIC_SYMBOL aligned_buffer_pool final
+{
+public:
+	/** \brief Creates the pool
+	 *
+	 * \param buffer_size Size of each buffer
+	 * \param alignment Alignment of each buffer, must be a power of two
+	 * \param max_cached Maximum number of unused buffers kept for reuse.
+	 */
+	explicit aligned_buffer_pool(size_t buffer_size, size_t alignment = aligned_buffer::default_alignment, size_t max_cached = 16);
+
+	aligned_buffer_pool(aligned_buffer_pool const&) = delete;
+	aligned_buffer_pool& operator=(aligned_buffer_pool const&) = delete;
+
+	/// Returns an unused buffer from the pool, or allocates a new one.
+	aligned_buffer get();
+
+	/// Returns a buffer to the pool. Buffers not matching the pool's size or alignment are freed.
+	void release(aligned_buffer && buffer);
+
+	size_t buffer_size() const { return buffer_size_; }
+
+private:
+	size_t const buffer_size_;
+	size_t const alignment_;
+	size_t const max_cached_;
+
+	mutex m_{false};
+	std::vector<aligned_buffer> cached_;
+};
+
+}
+
+#endif
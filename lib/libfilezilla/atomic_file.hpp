@@ -0,0 +1,91 @@
+#ifndef LIBFILEZILLA_ATOMIC_FILE_HEADER
+#define LIBFILEZILLA_ATOMIC_FILE_HEADER
+
+#include "libfilezilla.hpp"
+#include "file.hpp"
+
+#include <string>
+
+/** \file
+ * \brief Crash-safe replacement of files: \ref fz::atomic_file_writer "atomic_file_writer"
+ */
+
+namespace fz {
+
+/** \brief Replaces a file atomically
+ *
+ * Rewriting a file in place leaves a torn file behind if the program or the system crashes
+ * during the write. Instead, this class writes to a temporary file in the same directory,
+ * which on \ref commit gets flushed to disk and renamed over the target. Readers, even after a
+ * crash, see either the complete old or the complete new contents.
+ *
+ * On Linux, the temporary file is created using O_TMPFILE. It has no name while being written, so
+ * a crash before \ref commit leaves nothing behind. During commit it is briefly linked to a temporary
+ * name before being renamed over the target.
+ *
+ * A crash at the wrong moment can thus leave a temporary file behind, on Linux only during commit,
+ * elsewhere at any time before the rename. Temporary files are named after the target, followed by
+ * \c .tmp and a number, e.g. \c settings.xml.tmp12345. They can safely be deleted while no writer
+ * for the target is active, e.g. on startup.
+ *
+ * If the target already exists, its permissions are applied to the new file.
+ *
+ * Example:
+ * \code
+ * fz::atomic_file_writer w(fzT("settings.xml"));
+ * if (!w.opened() || !w.write(data) || !w.commit()) {
+ *     // Failed, the old settings.xml is unchanged
+ * }
+ * \endcode
+ */
+class FZ_PUBLIC_SYMBOL atomic_file_writer final
+{
+public:
+	/// Creates the temporary file, check success using \ref opened
+	explicit atomic_file_writer(native_string const& target);
+
+	/// Discards the new contents unless committed
+	~atomic_file_writer();
+
+	atomic_file_writer(atomic_file_writer const&) = delete;
+	atomic_file_writer& operator=(atomic_file_writer const&) = delete;
+
+	bool opened() const { return file_.opened(); }
+
+	/** \brief The temporary file receiving the new contents
+	 *
+	 * Use it directly or through a \ref file_writer. Don't close it.
+	 */
+	file & get_file() { return file_; }
+
+	/// Writes all the data, returns false on error.
+	bool write(void const* data, int64_t count);
+	bool write(std::string const& data) { return write(data.c_str(), static_cast<int64_t>(data.size())); }
+
+	/** \brief Replaces the target with the new contents
+	 *
+	 * \param durable If true, the data and the rename are flushed to disk before returning.
+	 *                If false, the replacement is still atomic for other processes, but not
+	 *                necessarily across a system crash.
+	 *
+	 * \return false on error. Unless flushing the directory failed, the target is left unchanged.
+	 *
+	 * Either way, the writer is closed afterwards.
+	 */
+	bool commit(bool durable = true);
+
+	/// Closes the writer, leaving the target unchanged.
+	void discard();
+
+private:
+	native_string temp_name();
+
+	native_string const target_;
+	native_string temp_;
+	file file_;
+	bool unnamed_{};
+};
+
+}
+
+#endif
@@ -0,0 +1,125 @@
+#ifndef LIBFILEZILLA_BUFFERED_FILE_HEADER
+#define LIBFILEZILLA_BUFFERED_FILE_HEADER
+
+#include "libfilezilla.hpp"
+#include "aligned_buffer.hpp"
+#include "file.hpp"
+
+#include <string>
+
+/** \file
+ * \brief Buffered sequential file access: \ref fz::file_reader "file_reader" and \ref fz::file_writer "file_writer"
+ */
+
+namespace fz {
+
+/** \brief Reads a file sequentially through a large buffer
+ *
+ * Avoids one system call per small record or line. The reader uses the file pointer of the
+ * underlying file, which must remain valid and should not be read from through other means
+ * while the reader is in use.
+ *
+ * The buffer is suitably aligned for files using direct I/O.
+ */
+class FZ_PUBLIC_SYMBOL file_reader final
+{
+public:
+	static size_t const default_buffer_size = 256 * 1024;
+
+	explicit file_reader(file & f, size_t buffer_size = default_buffer_size);
+
+	file_reader(file_reader const&) = delete;
+	file_reader& operator=(file_reader const&) = delete;
+
+	/** \brief Reads data
+	 *
+	 * Large reads bypass the buffer.
+	 *
+	 * \return Same as \ref file::read
+	 */
+	int64_t read(void *buf, int64_t count);
+
+	/** \brief Looks at upcoming data without consuming it
+	 *
+	 * \param data Set to the buffered data. Only valid until the next call to any function of the reader.
+	 * \param count Number of octets wanted, at most the size of the buffer.
+	 *
+	 * \return Number of octets available, less than \c count only near the end of the file
+	 * \return 0 at EOF
+	 * \return -1 on error
+	 */
+	int64_t peek(uint8_t const*& data, size_t count);
+
+	/// Consumes data previously returned by \ref peek
+	void consume(size_t count);
+
+	/** \brief Reads the next line
+	 *
+	 * Lines are terminated by LF or CRLF. The terminator is not part of the returned line.
+	 * The last line of a file does not need to be terminated.
+	 *
+	 * \return Number of octets consumed, including the terminator
+	 * \return 0 at EOF
+	 * \return -1 on error
+	 */
+	int64_t read_line(std::string & line);
+
+private:
+	// Reads more data into the buffer, moving the unread data to its front if needed.
+	int64_t fill();
+
+	file & file_;
+	aligned_buffer buffer_;
+	size_t start_{};
+	size_t end_{};
+};
+
+/** \brief Writes a file sequentially through a large buffer
+ *
+ * Data is flushed automatically once the buffer is full, and when the writer is destroyed.
+ * The writer uses the file pointer of the underlying file, which must remain valid while
+ * the writer is in use.
+ *
+ * The buffer is suitably aligned for files using direct I/O.
+ */
+class FZ_PUBLIC_SYMBOL file_writer final
+{
+public:
+	static size_t const default_buffer_size = 256 * 1024;
+
+	explicit file_writer(file & f, size_t buffer_size = default_buffer_size);
+
+	/// Flushes remaining data. Use \ref flush if you need to know whether it succeeded.
+	~file_writer();
+
+	file_writer(file_writer const&) = delete;
+	file_writer& operator=(file_writer const&) = delete;
+
+	/** \brief Writes data
+	 *
+	 * Unlike \ref file::write, all data is accepted unless there is an error.
+	 * Large writes bypass the buffer.
+	 *
+	 * \return false on error. Some of the data may have been written nevertheless.
+	 */
+	bool write(void const* data, int64_t count);
+	bool write(std::string const& data) { return write(data.c_str(), static_cast<int64_t>(data.size())); }
+
+	/** \brief Writes all buffered data to the file
+	 *
+	 * On error, data that could not be written remains buffered.
+	 */
+	bool flush();
+
+	/// Flushes the buffer, then flushes the file to the storage device using \ref file::fsync
+	bool sync();
+
+private:
+	file & file_;
+	aligned_buffer buffer_;
+	size_t used_{};
+};
+
+}
+
+#endif
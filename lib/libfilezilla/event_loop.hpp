@@ -60,6 +60,21 @@ public:
 	 */
 	void stop();
 
+	/** \brief Pins the loop's thread to a set of logical processors
+	 *
+	 * Keeping the loop on a fixed set of processors, ideally within a single NUMA node,
+	 * avoids bouncing the cache-hot state of its handlers between processors.
+	 *
+	 * \sa thread::set_affinity
+	 */
+	using thread::set_affinity;
+
+	/** \brief Returns the set of logical processors the loop's thread may run on
+	 *
+	 * \sa thread::affinity
+	 */
+	using thread::affinity;
+
 private:
 	friend class event_handler;
 
@@ -91,7 +106,7 @@ private:
 	Events pending_events_;
 	Timers timers_;
 
-	mutex sync_;
+	adaptive_mutex sync_{"event_loop"};
 	condition cond_;
 
 	bool quit_{};
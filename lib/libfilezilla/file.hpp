@@ -11,10 +11,35 @@
  * \brief File handling
  */
 
+#include <functional>
+
+#include <stddef.h>
 #include <stdint.h>
 
 namespace fz {
 
+class file;
+
+/** \brief Progress callback for \ref copy_file
+ *
+ * Gets passed the number of octets copied so far. Return false to abort the copy.
+ */
+typedef std::function<bool(int64_t)> copy_progress;
+
+/// Describes a buffer to read into, see \ref file::readv
+struct io_buffer final
+{
+	void* data;
+	size_t size;
+};
+
+/// Describes a buffer to write from, see \ref file::writev
+struct const_io_buffer final
+{
+	void const* data;
+	size_t size;
+};
+
 /** \brief Lean class for file access
  *
  * This class uses the system's native file access functions. It is a less convoluted and much faster alternative
@@ -45,8 +70,61 @@ public:
 		empty
 	};
 
+	/// Hints on how the file is going to be accessed, see \ref open_options and \ref advise
+	enum access_pattern {
+		/// No particular pattern
+		normal,
+
+		/// Data is read or written sequentially, aggressive read-ahead is beneficial.
+		sequential,
+
+		/// Data is accessed in random order, read-ahead is wasteful.
+		random,
+
+		/// Data will be accessed soon
+		willneed,
+
+		/// Data will not be accessed again any time soon, it can be evicted from the cache.
+		dontneed
+	};
+
+	/// Additional options when opening files
+	struct open_options final
+	{
+		/// Initial access pattern. Can be changed later on using \ref advise
+		access_pattern pattern{sequential};
+
+		/** \brief Bypass the system's page cache where supported
+		 *
+		 * Use it for large transfers that would otherwise evict everything else from the cache.
+		 *
+		 * For best performance, offsets, sizes and memory addresses of buffers used for reading and
+		 * writing should be aligned to the logical block size of the underlying storage, see \ref aligned_buffer.
+		 * Unaligned requests are handled transparently by going through an internal aligned
+		 * buffer, reading and rewriting the partial blocks at their head and tail.
+		 *
+		 * If the file system does not support direct I/O, the file is opened normally,
+		 * check using \ref direct.
+		 */
+		bool direct{};
+
+		/** \brief Do not update the last access time when reading.
+		 *
+		 * Silently ignored where not supported or not permitted.
+		 */
+		bool noatime{};
+
+		/** \brief When writing, reserve this many octets of disk space for the file.
+		 *
+		 * Reduces fragmentation and detects lack of space early. The size of the file
+		 * as reported by \ref size is not changed. Silently ignored where not supported.
+		 */
+		int64_t preallocate{};
+	};
+
 	file();
 	file(native_string const& f, mode m, creation_flags d = existing);
+	file(native_string const& f, mode m, creation_flags d, open_options const& o);
 
 	~file();
 
@@ -55,7 +133,11 @@ public:
 
 	bool opened() const;
 
+	/// Whether the file is using direct I/O, see \ref open_options::direct
+	bool direct() const { return direct_; }
+
 	bool open(native_string const& f, mode m, creation_flags d = existing);
+	bool open(native_string const& f, mode m, creation_flags d, open_options const& o);
 
 	void close();
 
@@ -100,6 +182,78 @@ public:
 	 */
 	bool truncate();
 
+	/** \brief Flushes data and metadata of the file to the storage device
+	 *
+	 * Only once this returns true, written data survives a crash or power loss.
+	 * To make many small writes durable, see \ref group_commit.
+	 */
+	bool fsync();
+
+	/** \brief Like \ref fsync, but skips metadata not needed to read the data back, such as timestamps
+	 *
+	 * Falls back to \ref fsync where not supported.
+	 */
+	bool fdatasync();
+
+	/** \brief Reserves disk space for a range of the file
+	 *
+	 * Reduces fragmentation when writing a file in chunks or out of order, and detects
+	 * lack of space before any data is written.
+	 *
+	 * \param offset Start of the range
+	 * \param length Length of the range
+	 * \param keep_size If false, the file is extended to cover the range if needed. If true,
+	 *                  the size as reported by \ref size does not change.
+	 *
+	 * \return false on error or if not supported. Allocated ranges read as zeroes.
+	 */
+	bool allocate(int64_t offset, int64_t length, bool keep_size = false);
+
+	/** \brief Deallocates a range of the file, making it a hole
+	 *
+	 * The range subsequently reads as zeroes and no longer occupies disk space. The
+	 * size of the file does not change. Partial blocks at the edges of the range are zeroed.
+	 *
+	 * \return false on error or if not supported by the file system.
+	 */
+	bool punch_hole(int64_t offset, int64_t length);
+
+	/** \brief Finds data in sparse files
+	 *
+	 * Returns the start of the first region containing data at or after the given offset,
+	 * or the size of the file if there is no more data. Where holes cannot be detected,
+	 * all of the file is considered to be data.
+	 *
+	 * Iterate over the data regions of a file like this:
+	 * \code
+	 * int64_t const size = f.size();
+	 * int64_t start = f.next_data(0);
+	 * while (start >= 0 && start < size) {
+	 *     int64_t const end = f.next_hole(start);
+	 *     // Process [start, end)
+	 *     start = f.next_data(end);
+	 * }
+	 * \endcode
+	 *
+	 * Holes may be reported as data, but never the other way around.
+	 *
+	 * \return -1 on error
+	 * \note On POSIX systems, the file pointer is moved to find the region, then restored. Unlike
+	 *       \ref read_at and \ref write_at, this must not be called concurrently with any other
+	 *       operation on the same file.
+	 */
+	int64_t next_data(int64_t offset);
+
+	/** \brief Returns the start of the first hole at or after the given offset.
+	 *
+	 * The end of the file is considered a hole. See \ref next_data.
+	 *
+	 * \return -1 on error
+	 * \note Like \ref next_data, this temporarily moves the file pointer and must not be called
+	 *       concurrently with any other operation on the same file.
+	 */
+	int64_t next_hole(int64_t offset);
+
 	/** \brief Read data from file
 	 *
 	 * Reading from file advances the file pointer with the number of octets read.
@@ -127,15 +281,125 @@ public:
 	 */
 	int64_t write(void const* buf, int64_t count);
 
+	/** \brief Read data from the given offset in the file
+	 *
+	 * Unlike \ref read, the file pointer is not used. Multiple threads can thus read
+	 * different parts of the same file concurrently.
+	 *
+	 * \return Same as \ref read
+	 *
+	 * \note On Windows, the file pointer is changed, on other platforms it is left untouched.
+	 */
+	int64_t read_at(void *buf, int64_t count, int64_t offset);
+
+	/** \brief Write data at the given offset in the file
+	 *
+	 * Unlike \ref write, the file pointer is not used. Multiple threads can thus write
+	 * different parts of the same file concurrently.
+	 *
+	 * \return Same as \ref write
+	 *
+	 * \note On Windows, the file pointer is changed, on other platforms it is left untouched.
+	 *
+	 * \note In direct mode, unaligned writes need to rewrite whole blocks. Concurrent unaligned
+	 *       writes to different parts of the same block are not safe.
+	 */
+	int64_t write_at(void const* buf, int64_t count, int64_t offset);
+
+	/** \brief Scatter read
+	 *
+	 * Fills the buffers in order, like a single read into one large buffer would,
+	 * using as few system calls as possible.
+	 *
+	 * \return Same as \ref read. Short reads can end in any of the buffers.
+	 */
+	int64_t readv(io_buffer const* buffers, size_t count);
+
+	/// Gather write, see \ref readv
+	int64_t writev(const_io_buffer const* buffers, size_t count);
+
+	/// Like \ref readv, but reads from the given offset like \ref read_at
+	int64_t readv_at(io_buffer const* buffers, size_t count, int64_t offset);
+
+	/// Like \ref writev, but writes at the given offset like \ref write_at
+	int64_t writev_at(const_io_buffer const* buffers, size_t count, int64_t offset);
+
+	/** \brief Tells the system how a range of the file is going to be accessed
+	 *
+	 * \param offset Start of the range
+	 * \param length Length of the range, 0 to extend to the end of the file
+	 * \param pattern The expected access pattern
+	 *
+	 * \return false if the hint could not be applied. Hints are optional, this is not fatal.
+	 */
+	bool advise(int64_t offset, int64_t length, access_pattern pattern);
+
+	/** \brief Starts reading a range of the file into the system's cache in the background
+	 *
+	 * Use it to prefetch the next chunk of data while processing the current one.
+	 *
+	 * \param offset Start of the range
+	 * \param length Length of the range, 0 to extend to the end of the file
+	 *
+	 * \return false if not supported.
+	 */
+	bool readahead(int64_t offset, int64_t length);
+
 private:
+	friend class aio_engine;
+	friend class atomic_file_writer;
+	friend class file_cache;
+	friend int64_t copy_file(file & src, file & dst, int64_t offset, int64_t length, copy_progress const& progress);
+	friend bool copy_file(native_string const& src, native_string const& dst, bool resume, copy_progress const& progress);
+
+	int64_t native_read_at(void *buf, int64_t count, int64_t offset);
+	int64_t native_write_at(void const* buf, int64_t count, int64_t offset);
+	bool truncate_at(int64_t length);
+
+	// Direct I/O with unaligned offset, size or buffer, goes through an aligned bounce buffer.
+	int64_t unaligned_read_at(void *buf, int64_t count, int64_t offset);
+	int64_t unaligned_write_at(void const* buf, int64_t count, int64_t offset);
+
 #ifdef FZ_WINDOWS
 	HANDLE hFile_{INVALID_HANDLE_VALUE};
 #else
 	int fd_{-1};
 #endif
+	bool direct_{};
 };
 
 bool FZ_PUBLIC_SYMBOL remove_file(native_string const& name);
 
+/** \brief Copies a range of one file into another file
+ *
+ * The data is copied to the same offset in the destination file. Wherever possible, the data
+ * does not pass through user space:
+ * - On file systems supporting it, the range is cloned by reference (reflink), making the copy nearly instant.
+ * - Otherwise copy_file_range or sendfile are used, letting the kernel or even the storage do the work.
+ * - If all else fails, the data is copied in chunks using \ref file::read_at and \ref file::write_at.
+ *
+ * \param src Source, must be opened for reading
+ * \param dst Destination, must be opened for writing
+ * \param offset Start of the range. To resume an interrupted copy, pass the size of the destination.
+ * \param length Length of the range, -1 to copy everything up to the end of the source.
+ * \param progress Optional, called after every chunk copied.
+ *
+ * \return The number of octets copied. It is less than \c length only if the source is shorter.
+ * \return -1 on error or if aborted by the progress callback.
+ *
+ * \note The file pointers of both files may be changed.
+ */
+int64_t FZ_PUBLIC_SYMBOL copy_file(file & src, file & dst, int64_t offset = 0, int64_t length = -1, copy_progress const& progress = copy_progress());
+
+/** \brief Copies a whole file
+ *
+ * If \c resume is set and the destination exists, only the data past the end of
+ * the destination is copied. Otherwise the destination is created or truncated.
+ *
+ * \return true if the file has been copied completely.
+ * \return false on error, or if source and destination are the same file.
+ */
+bool FZ_PUBLIC_SYMBOL copy_file(native_string const& src, native_string const& dst, bool resume = false, copy_progress const& progress = copy_progress());
+
 }
 #endif
@@ -0,0 +1,129 @@
+#ifndef LIBFILEZILLA_FILE_CACHE_HEADER
+#define LIBFILEZILLA_FILE_CACHE_HEADER
+
+#include "libfilezilla.hpp"
+#include "file.hpp"
+#include "mutex.hpp"
+#include "time.hpp"
+
+#include <list>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+/** \file
+ * \brief Declares \ref fz::file_cache "file_cache", a cache of open files
+ */
+
+namespace fz {
+
+/** \brief LRU cache of files opened for reading, keyed by path
+ *
+ * Serving the same small files over and over again spends much of the time opening and
+ * closing them. The cache keeps them open instead, and hands out leases to the open files.
+ * Concurrent users of the same path share a single descriptor. They must only use
+ * \ref file::read_at and other functions not depending on the file pointer.
+ *
+ * Before handing out a cached file, the cache checks whether the path still refers to the
+ * same file, unchanged: Device, inode number, size and modification time must all match.
+ * Otherwise the file is opened anew. Existing leases of the old file remain valid.
+ *
+ * Size and modification time are also available from the lease, so that hot files need
+ * neither open nor close, nor \ref local_filesys::get_file_info.
+ *
+ * Example:
+ * \code
+ * fz::file_cache::lease l = cache.open(path);
+ * if (l) {
+ *     l->read_at(buf, std::min(l.size(), buf_size), 0);
+ * }
+ * \endcode
+ */
+class FZ_PUBLIC_SYMBOL file_cache final
+{
+	struct entry;
+
+public:
+	/** \brief Creates the cache
+	 *
+	 * \param max_open Maximum number of files kept open by the cache. Files with outstanding leases are never
+	 *                 closed, if all cached files are leased, the limit is temporarily exceeded.
+	 * \param revalidate How long a successful check whether the file is unchanged stays valid. The default of
+	 *                   zero checks on every \ref open.
+	 */
+	explicit file_cache(size_t max_open = 256, duration const& revalidate = duration());
+	~file_cache();
+
+	file_cache(file_cache const&) = delete;
+	file_cache& operator=(file_cache const&) = delete;
+
+	/// Reference-counted access to a cached file. The file stays open as long as leases exist.
+	class FZ_PUBLIC_SYMBOL lease final
+	{
+	public:
+		lease() = default;
+
+		explicit operator bool() const { return entry_ != nullptr; }
+
+		file& operator*() const;
+		file* operator->() const;
+
+		/// Size of the file at the time it was last validated
+		int64_t size() const;
+
+		/// Modification time of the file at the time it was last validated
+		datetime const& modification_time() const;
+
+	private:
+		friend class file_cache;
+		explicit lease(std::shared_ptr<entry> const& e)
+			: entry_(e)
+		{}
+
+		std::shared_ptr<entry> entry_;
+	};
+
+	/** \brief Returns a lease to the file at the given path
+	 *
+	 * Opens the file for reading if it is not cached, or if it has changed.
+	 *
+	 * \return An empty lease if the file cannot be opened.
+	 */
+	lease open(native_string const& path);
+
+	/// Removes the path from the cache, e.g. after writing to it. Existing leases remain valid.
+	void invalidate(native_string const& path);
+
+	/// Removes all files from the cache. Existing leases remain valid.
+	void clear();
+
+	/// Number of files held by the cache
+	size_t size() const;
+
+	/// Number of calls to \ref open that could reuse an open file
+	uint64_t hits() const;
+
+	/// Number of calls to \ref open that had to open the file
+	uint64_t misses() const;
+
+private:
+	typedef std::list<std::shared_ptr<entry>> lru_list;
+
+	void evict(std::vector<std::shared_ptr<entry>> & closed);
+
+	size_t const max_open_;
+	duration const revalidate_;
+
+	mutable mutex m_{false};
+
+	// Most recently used entries first
+	lru_list lru_;
+	std::unordered_map<native_string, lru_list::iterator> entries_;
+
+	uint64_t hits_{};
+	uint64_t misses_{};
+};
+
+}
+
+#endif
@@ -0,0 +1,100 @@
+#ifndef LIBFILEZILLA_GROUP_COMMIT_HEADER
+#define LIBFILEZILLA_GROUP_COMMIT_HEADER
+
+#include "libfilezilla.hpp"
+#include "event.hpp"
+#include "file.hpp"
+#include "mutex.hpp"
+#include "thread_pool.hpp"
+#include "time.hpp"
+
+#include <vector>
+
+/** \file
+ * \brief Batched durability for many small writes: \ref fz::group_commit "group_commit"
+ */
+
+namespace fz {
+
+class event_handler;
+
+/// \private
+struct group_commit_event_type{};
+
+/** \brief Sent to the handler once data written to a file is durable.
+ *
+ * The arguments are the file passed to \ref group_commit::commit and whether flushing it succeeded.
+ */
+typedef simple_event<group_commit_event_type, file*, bool> group_commit_event;
+
+/// \private
+/// This instantiation must be a public symbol
+extern template class FZ_PUBLIC_SYMBOL simple_event<group_commit_event_type, file*, bool>;
+
+/** \brief Batches sync requests from many writers into few flushes
+ *
+ * Flushing a file to the storage device takes about as long for a single small record
+ * as it does for thousands of them. Instead of flushing after each write, writers
+ * request a commit and a background thread flushes each file once for all requests
+ * gathered in the meantime.
+ *
+ * Requests gather while the previous flush is running, and additionally for the given
+ * interval after the first request of a batch arrives. A longer interval increases
+ * throughput at the cost of latency.
+ *
+ * Files must remain valid until all their commits have completed.
+ *
+ * Before destroying a handler with outstanding commits, call \ref cancel, followed by
+ * event_handler::remove_handler to discard completions already sent.
+ */
+class FZ_PUBLIC_SYMBOL group_commit final
+{
+public:
+	/** \brief Starts the background thread
+	 *
+	 * \param interval Time to wait for more requests before flushing.
+	 * \param data_only If true, \ref file::fdatasync is used instead of \ref file::fsync
+	 */
+	explicit group_commit(duration const& interval = duration(), bool data_only = true);
+
+	/// Completes all outstanding commits.
+	~group_commit();
+
+	group_commit(group_commit const&) = delete;
+	group_commit& operator=(group_commit const&) = delete;
+
+	/** \brief Waits until everything written to the file so far is durable.
+	 *
+	 * \return Whether the flush succeeded.
+	 */
+	bool commit(file & f);
+
+	/// Returns immediately, a \ref group_commit_event is sent to the handler once everything written to the file so far is durable.
+	void commit(file & f, event_handler & h);
+
+	/// Completions of outstanding commits are no longer sent to the handler
+	void cancel(event_handler & h);
+
+private:
+	struct request;
+
+	void run();
+
+	duration const interval_;
+	bool const data_only_;
+
+	mutex m_{false};
+	condition wakeup_;
+	broadcast_condition done_;
+
+	std::vector<request*> pending_;
+	std::vector<request*> flushing_;
+	bool quit_{};
+
+	thread_pool pool_;
+	async_task task_;
+};
+
+}
+
+#endif
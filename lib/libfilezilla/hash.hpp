@@ -0,0 +1,123 @@
+#ifndef LIBFILEZILLA_HASH_HEADER
+#define LIBFILEZILLA_HASH_HEADER
+
+#include "libfilezilla.hpp"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+
+/** \file
+ * \brief Checksums and hash functions: CRC32C, XXH64 and SHA-256, as well as helpers to hash files
+ *
+ * Where the CPU supports them, dedicated instructions are used, selected at runtime:
+ * SSE4.2 for CRC32C and the SHA extensions for SHA-256.
+ */
+
+namespace fz {
+
+class file;
+class thread_pool;
+
+/// Supported algorithms, see \ref hash_accumulator
+enum class hash_algorithm
+{
+	/// Castagnoli CRC, as used by iSCSI, ext4 and many others. Not cryptographically secure.
+	crc32c,
+
+	/// Very fast 64 bit non-cryptographic hash, the digest is in canonical (big-endian) form.
+	xxh64,
+
+	sha256
+};
+
+/// Size of the digest of the given algorithm in octets
+size_t FZ_PUBLIC_SYMBOL digest_size(hash_algorithm algorithm);
+
+/** \brief Accumulator for hashing large amounts of data
+ *
+ * Feed data in chunks of any size using \ref update, the result does not depend on how the data is split.
+ */
+class FZ_PUBLIC_SYMBOL hash_accumulator final
+{
+public:
+	explicit hash_accumulator(hash_algorithm algorithm);
+	~hash_accumulator();
+
+	hash_accumulator(hash_accumulator const&) = delete;
+	hash_accumulator& operator=(hash_accumulator const&) = delete;
+
+	hash_algorithm algorithm() const { return algorithm_; }
+
+	/// Discards all data fed so far
+	void reset();
+
+	void update(void const* data, size_t size);
+	void update(std::string const& data);
+	void update(std::vector<uint8_t> const& data);
+
+	/// Returns the digest of all data fed so far and resets the accumulator.
+	std::vector<uint8_t> digest();
+
+	class impl;
+
+private:
+	hash_algorithm const algorithm_;
+	std::unique_ptr<impl> impl_;
+};
+
+/** \brief Calculates the CRC32C of the data
+ *
+ * To checksum data in pieces, pass the result of the previous piece as \c crc.
+ */
+uint32_t FZ_PUBLIC_SYMBOL crc32c(void const* data, size_t size, uint32_t crc = 0);
+
+/// Calculates the XXH64 hash of the data
+uint64_t FZ_PUBLIC_SYMBOL xxh64(void const* data, size_t size, uint64_t seed = 0);
+
+/// Calculates the SHA-256 digest of the data
+std::vector<uint8_t> FZ_PUBLIC_SYMBOL sha256(void const* data, size_t size);
+std::vector<uint8_t> FZ_PUBLIC_SYMBOL sha256(std::string const& data);
+
+/** \brief Hashes a range of the file
+ *
+ * The file is read with positional reads in large chunks, asking the system to read ahead.
+ *
+ * \param f The file, must be opened for reading.
+ * \param algorithm The hash algorithm
+ * \param offset Start of the range
+ * \param length Length of the range, -1 to hash everything up to the end of the file.
+ *
+ * \return The digest, empty on error or if the file is shorter than the given range.
+ */
+std::vector<uint8_t> FZ_PUBLIC_SYMBOL hash_file(file & f, hash_algorithm algorithm, int64_t offset = 0, int64_t length = -1);
+
+/** \brief Hashes consecutive segments of the file in parallel
+ *
+ * Useful to verify parallel segmented transfers, and to find out which parts of a file differ.
+ *
+ * \param f The file, must be opened for reading.
+ * \param algorithm The hash algorithm
+ * \param segment_size Size of each segment, only the last segment can be smaller.
+ * \param pool Pool to run the tasks hashing the segments on
+ * \param parallel Maximum number of segments hashed at the same time
+ *
+ * \return The digest of each segment, empty on error or if the file is empty.
+ */
+std::vector<std::vector<uint8_t>> FZ_PUBLIC_SYMBOL hash_file_segments(file & f, hash_algorithm algorithm, int64_t segment_size, thread_pool & pool, size_t parallel = 4);
+
+/** \brief Hashes a large file using multiple threads
+ *
+ * The file is split into segments that are hashed in parallel using \ref hash_file_segments.
+ * The result is the hash of the concatenated segment digests. It thus differs from the plain
+ * hash of the file, and depends on the segment size.
+ *
+ * \return The digest, empty on error.
+ */
+std::vector<uint8_t> FZ_PUBLIC_SYMBOL hash_file_tree(file & f, hash_algorithm algorithm, int64_t segment_size, thread_pool & pool, size_t parallel = 4);
+
+}
+
+#endif
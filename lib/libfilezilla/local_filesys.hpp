@@ -89,6 +89,9 @@ public:
 private:
 #ifndef FZ_WINDOWS
 	void alloc_path_buffer(char const* filename); // Ensures m_raw_path is large enough to hold path and filename
+
+	// Like get_file_info, but for an entry of the directory being enumerated
+	type get_entry_info(char const* name, bool &is_link, int64_t* size, datetime* modification_time, int* mode);
 #endif
 
 	// State for directory enumeration
@@ -0,0 +1,169 @@
+#ifndef LIBFILEZILLA_MAPPED_FILE_HEADER
+#define LIBFILEZILLA_MAPPED_FILE_HEADER
+
+#include "libfilezilla.hpp"
+
+#ifdef FZ_WINDOWS
+#include "private/windows.hpp"
+#endif
+
+/** \file
+ * \brief Memory-mapped file access: \ref fz::mapped_file "mapped_file"
+ */
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+namespace fz {
+
+/** \brief Maps a file, or a window of it, into memory
+ *
+ * Allows accessing the contents of a file directly without copying it through
+ * intermediate buffers like \ref file::read does.
+ *
+ * Only a window of the file is mapped at any time. Files exceeding the available
+ * address space can thus be processed by sliding the window over the file using \ref map.
+ *
+ * If the file gets truncated by someone else while mapped, accessing the part of the window
+ * past the new end of the file would normally result in the process getting killed by SIGBUS.
+ * mapped_file instead replaces the affected pages with zeroes and remembers that the file has
+ * been truncated, see \ref truncated. At most 256 windows, counted across all instances in
+ * the process, can be protected this way at the same time. Use \ref guarded to check whether
+ * a window is protected.
+ *
+ * The size of the file cannot be changed through mapped_file, use \ref file for that.
+ */
+class FZ_PUBLIC_SYMBOL mapped_file final
+{
+public:
+	enum mode {
+		/// Maps the file read-only
+		reading,
+
+		/// Maps the file for reading and writing. The file must exist. Changes are written back to the file.
+		writing
+	};
+
+	/// Hints on how the mapped data is going to be accessed, see \ref advise
+	enum access_pattern {
+		/// No particular pattern
+		normal,
+
+		/// Data is accessed sequentially, aggressive read-ahead is beneficial.
+		sequential,
+
+		/// Data is accessed in random order, read-ahead is wasteful.
+		random,
+
+		/// All of the window will be accessed soon.
+		willneed
+	};
+
+	mapped_file();
+	explicit mapped_file(native_string const& f, mode m = reading);
+
+	~mapped_file();
+
+	mapped_file(mapped_file const&) = delete;
+	mapped_file& operator=(mapped_file const&) = delete;
+
+	/** \brief Opens the file without mapping anything yet
+	 *
+	 * Call \ref map afterwards.
+	 */
+	bool open(native_string const& f, mode m = reading);
+
+	/// Unmaps the window and closes the file
+	void close();
+
+	bool opened() const;
+
+	/// Size of the file at the time it was opened, or -1 if not opened
+	int64_t size() const { return size_; }
+
+	/** \brief Maps a window of the file, replacing any previously mapped window.
+	 *
+	 * The offset need not be aligned to any boundary.
+	 *
+	 * \param offset Start of the window in the file
+	 * \param length Length of the window. It is clipped to the end of the file. If 0, the window extends to the end of the file.
+	 *
+	 * \return false if the offset is beyond the end of the file or if mapping failed, in which case nothing is mapped.
+	 *
+	 * \note Mapping a window at the end of the file results in an empty window, it is not an error.
+	 */
+	bool map(int64_t offset = 0, int64_t length = 0);
+
+	/// Unmaps the current window, the file stays open.
+	void unmap();
+
+	/** \brief Start of the mapped window.
+	 *
+	 * nullptr if nothing is mapped. Only writeable if opened for \ref writing.
+	 */
+	uint8_t* data() const { return data_; }
+
+	/// Length of the mapped window
+	size_t length() const { return length_; }
+
+	/// Offset of the mapped window in the file
+	int64_t offset() const { return offset_; }
+
+	/** \brief Tells the system how the window is going to be accessed.
+	 *
+	 * The hint is remembered and applied to subsequently mapped windows as well.
+	 *
+	 * \return false if the hint could not be applied. Hints are optional, this is not fatal.
+	 */
+	bool advise(access_pattern pattern);
+
+	/// Writes modified pages of the window back to the file and waits for the data to reach the disk.
+	bool flush();
+
+	/** \brief Returns true if the file has been truncated while being accessed.
+	 *
+	 * Parts of the window that lay past the new end of the file read as zeroes and writes to
+	 * them are lost.
+	 */
+	bool truncated() const { return truncated_; }
+
+	/** \brief Returns true if a window is mapped and protected against truncation of the file.
+	 *
+	 * If false for a mapped window, too many windows are mapped at the same time. Accessing the
+	 * window after someone else truncated the file then kills the process with SIGBUS.
+	 *
+	 * On Windows, mapped files cannot be truncated, every mapped window is protected.
+	 */
+	bool guarded() const;
+
+	/// Offsets of windows are internally aligned to this value, the page size or allocation granularity.
+	static size_t granularity();
+
+private:
+	bool apply_advice();
+
+#ifdef FZ_WINDOWS
+	HANDLE hFile_{INVALID_HANDLE_VALUE};
+	HANDLE mapping_{};
+#else
+	int fd_{-1};
+	int slot_{-1};
+#endif
+	mode mode_{reading};
+	access_pattern pattern_{normal};
+	int64_t size_{-1};
+
+	void* base_{};
+	size_t base_length_{};
+
+	uint8_t* data_{};
+	size_t length_{};
+	int64_t offset_{};
+
+	std::atomic<bool> truncated_{};
+};
+
+}
+
+#endif
@@ -2,11 +2,17 @@
 #define LIBFILEZILLA_MUTEX_HEADER
 
 /** \file
- * \brief Thread synchronization primitives: mutex, scoped_lock and condition
+ * \brief Thread synchronization primitives: mutex, adaptive_mutex, scoped_lock, condition, broadcast_condition, rwlock and seqlock, as well as lock profiling
  */
 #include "libfilezilla.hpp"
 #include "time.hpp"
 
+#include <atomic>
+#include <cstring>
+#include <string>
+#include <type_traits>
+#include <vector>
+
 #ifdef FZ_WINDOWS
 #include "private/windows.hpp"
 #else
@@ -15,6 +21,8 @@
 
 namespace fz {
 
+class lock_profile;
+
 /**
  * \brief Lean replacement for std::(recursive_)mutex
  *
@@ -28,6 +36,14 @@ class FZ_PUBLIC_SYMBOL mutex final
 {
 public:
 	explicit mutex(bool recursive = true);
+
+	/** \brief Creates a mutex with a name under which it shows up in the lock statistics
+	 *
+	 * All mutexes sharing the same name share their statistics.
+	 * See \ref enable_lock_profiling
+	 */
+	explicit mutex(char const* name, bool recursive = true);
+
 	~mutex();
 
 	mutex(mutex const&) = delete;
@@ -48,6 +64,75 @@ private:
 #else
 	pthread_mutex_t m_;
 #endif
+	lock_profile * const profile_{};
+};
+
+/**
+ * \brief Non-recursive mutex that spins for a short while before putting the thread to sleep
+ *
+ * Intended for very short critical sections under contention. Instead of immediately going to
+ * sleep in the kernel if the mutex is already locked, the thread first spins, expecting the
+ * owner to release the mutex soon. The number of spins adapts to how long it took to obtain
+ * the mutex in the past, and is bounded.
+ *
+ * Spinning is skipped entirely on single-processor systems.
+ *
+ * Can be used with \ref scoped_lock and \ref condition just like \ref mutex.
+ */
+class FZ_PUBLIC_SYMBOL adaptive_mutex final
+{
+public:
+	adaptive_mutex();
+
+	/// See \ref mutex::mutex(char const*, bool)
+	explicit adaptive_mutex(char const* name);
+
+	~adaptive_mutex();
+
+	adaptive_mutex(adaptive_mutex const&) = delete;
+	adaptive_mutex& operator=(adaptive_mutex const&) = delete;
+
+	/// Beware, manual locking isn't exception safe, use scoped_lock
+	void lock()
+	{
+#ifdef FZ_WINDOWS
+		EnterCriticalSection(&m_);
+#else
+		if (pthread_mutex_trylock(&m_)) {
+			lock_slow();
+		}
+#endif
+	}
+
+	/// Beware, manual locking isn't exception safe, use scoped_lock
+	void unlock()
+	{
+#ifdef FZ_WINDOWS
+		LeaveCriticalSection(&m_);
+#else
+		pthread_mutex_unlock(&m_);
+#endif
+	}
+
+	/// Returns true if the mutex could be locked without waiting
+	bool try_lock();
+
+private:
+	friend class condition;
+	friend class scoped_lock;
+
+#ifdef FZ_WINDOWS
+	CRITICAL_SECTION m_;
+#else
+	void lock_slow();
+
+	pthread_mutex_t m_;
+
+	// Moving average of the spins needed to obtain the lock. Only written with the mutex held,
+	// but read before trying to obtain it.
+	std::atomic<int> spins_{};
+#endif
+	lock_profile * const profile_{};
 };
 
 /** \brief A simple scoped lock.
@@ -63,7 +148,12 @@ class FZ_PUBLIC_SYMBOL scoped_lock final
 public:
 	explicit scoped_lock(mutex& m)
 		: m_(&m.m_)
+		, profile_(m.profile_)
 	{
+		if (profiling_.load(std::memory_order_relaxed)) {
+			lock_profiled();
+			return;
+		}
 #ifdef FZ_WINDOWS
 		EnterCriticalSection(m_);
 #else
@@ -71,9 +161,24 @@ public:
 #endif
 	}
 
+	explicit scoped_lock(adaptive_mutex& m)
+		: m_(&m.m_)
+		, adaptive_(&m)
+		, profile_(m.profile_)
+	{
+		if (profiling_.load(std::memory_order_relaxed)) {
+			lock_profiled();
+			return;
+		}
+		m.lock();
+	}
+
 	~scoped_lock()
 	{
 		if (locked_) {
+			if (profiled_) {
+				unlock_profiled();
+			}
 #ifdef FZ_WINDOWS
 			LeaveCriticalSection(m_);
 #else
@@ -93,6 +198,14 @@ public:
 	void lock()
 	{
 		locked_ = true;
+		if (profiling_.load(std::memory_order_relaxed)) {
+			lock_profiled();
+			return;
+		}
+		if (adaptive_) {
+			adaptive_->lock();
+			return;
+		}
 #ifdef FZ_WINDOWS
 		EnterCriticalSection(m_);
 #else
@@ -107,6 +220,9 @@ public:
 	void unlock()
 	{
 		locked_ = false;
+		if (profiled_) {
+			unlock_profiled();
+		}
 #ifdef FZ_WINDOWS
 		LeaveCriticalSection(m_);
 #else
@@ -116,13 +232,30 @@ public:
 
 private:
 	friend class condition;
+	friend class broadcast_condition;
+	friend void FZ_PUBLIC_SYMBOL enable_lock_profiling(bool);
+	friend bool FZ_PUBLIC_SYMBOL lock_profiling_enabled();
+
+	// Slow paths taken while lock profiling is enabled.
+	void lock_profiled();
+	void unlock_profiled();
+
+	// Excludes time spent waiting on a condition from the hold time
+	class profiled_wait;
+
+	static std::atomic<bool> profiling_;
 
 #ifdef FZ_WINDOWS
 	CRITICAL_SECTION * const m_;
 #else
 	pthread_mutex_t * const m_;
 #endif
+	adaptive_mutex * const adaptive_{};
 	bool locked_{true};
+
+	lock_profile * const profile_{};
+	bool profiled_{};
+	int64_t locked_at_{};
 };
 
 /** \brief Waitable condition variable
@@ -159,6 +292,16 @@ public:
 	 */
 	bool wait(scoped_lock& l, duration const& timeout);
 
+	/** \brief Wait until the deadline for condition to become signalled.
+	 *
+	 * Like wait(scoped_lock&, duration const&), but takes an absolute deadline. This is cheaper
+	 * if waiting repeatedly for the same deadline, no clock needs to be queried.
+	 *
+	 * \return true if the condition has been signalled.
+	 * \return false if the condition could not be obtained before the deadline.
+	 */
+	bool wait_until(scoped_lock& l, monotonic_clock const& deadline);
+
 	/** \brief Signal condition variable
 	 *
 	 * To avoid race conditions leading to lost signals, you must pass
@@ -187,5 +330,359 @@ private:
 	bool signalled_{};
 };
 
+/** \brief Condition variable which can wake up any number of waiters
+ *
+ * Unlike \ref condition, signals are not latched: Waking up threads only affects the threads
+ * waiting at that very moment. Hence waiting always needs to be done in conjunction with a
+ * predicate protected by the same mutex, which the predicate-based overloads of \ref wait and
+ * \ref wait_until take care of.
+ *
+ * Useful for one-to-many notifications, e.g. shutting down all workers of a pool or
+ * releasing all threads waiting at a barrier.
+ *
+ * \note The lock must be on the same mutex that is used for both signalling and for waiting.
+ */
+class FZ_PUBLIC_SYMBOL broadcast_condition final
+{
+public:
+	broadcast_condition();
+	~broadcast_condition();
+
+	broadcast_condition(broadcast_condition const&) = delete;
+	broadcast_condition& operator=(broadcast_condition const&) = delete;
+
+	/** \brief Atomically unlocks the mutex and waits until woken up, then re-locks the mutex.
+	 *
+	 * \note Spurious wakeups are possible, use the predicate-based overload.
+	 */
+	void wait(scoped_lock& l);
+
+	/// Waits until the predicate returns true. The predicate is evaluated with the mutex locked.
+	template<typename Pred>
+	void wait(scoped_lock& l, Pred pred)
+	{
+		while (!pred()) {
+			wait(l);
+		}
+	}
+
+	/** \brief Waits until woken up or until the absolute deadline has passed.
+	 *
+	 * \return false if the deadline has passed.
+	 *
+	 * \note Spurious wakeups are possible, use the predicate-based overload.
+	 */
+	bool wait_until(scoped_lock& l, monotonic_clock const& deadline);
+
+	/** \brief Waits until the predicate returns true or until the absolute deadline has passed.
+	 *
+	 * The predicate is evaluated with the mutex locked.
+	 *
+	 * \return the result of the last evaluation of the predicate.
+	 */
+	template<typename Pred>
+	bool wait_until(scoped_lock& l, monotonic_clock const& deadline, Pred pred)
+	{
+		while (!pred()) {
+			if (!wait_until(l, deadline)) {
+				return pred();
+			}
+		}
+		return true;
+	}
+
+	/// Wakes up one waiting thread, if any.
+	void signal(scoped_lock& l);
+
+	/// Wakes up all waiting threads.
+	void broadcast(scoped_lock& l);
+
+private:
+#ifdef FZ_WINDOWS
+	CONDITION_VARIABLE cond_;
+#else
+	pthread_cond_t cond_;
+#endif
+};
+
+/** \brief Reader-writer lock
+ *
+ * Any number of readers can hold the lock concurrently, writers have exclusive access.
+ *
+ * With glibc, writers are preferred: Once a writer waits for the lock, new readers are held
+ * back until the writer is done, so that a steady stream of readers cannot starve writers.
+ * Other platforms use their native policy: Slim reader/writer locks on Windows and other
+ * pthread implementations make no such guarantee.
+ *
+ * The lock is not recursive, neither for readers nor for writers.
+ *
+ * Use \ref scoped_read_lock and \ref scoped_write_lock to obtain the lock.
+ */
+class FZ_PUBLIC_SYMBOL rwlock final
+{
+public:
+	rwlock();
+	~rwlock();
+
+	rwlock(rwlock const&) = delete;
+	rwlock& operator=(rwlock const&) = delete;
+
+	/// Beware, manual locking isn't exception safe, use scoped_read_lock
+	void lock_read()
+	{
+#ifdef FZ_WINDOWS
+		AcquireSRWLockShared(&l_);
+#else
+		pthread_rwlock_rdlock(&l_);
+#endif
+	}
+
+	/// Beware, manual locking isn't exception safe, use scoped_read_lock
+	void unlock_read()
+	{
+#ifdef FZ_WINDOWS
+		ReleaseSRWLockShared(&l_);
+#else
+		pthread_rwlock_unlock(&l_);
+#endif
+	}
+
+	/// Beware, manual locking isn't exception safe, use scoped_write_lock
+	void lock_write()
+	{
+#ifdef FZ_WINDOWS
+		AcquireSRWLockExclusive(&l_);
+#else
+		pthread_rwlock_wrlock(&l_);
+#endif
+	}
+
+	/// Beware, manual locking isn't exception safe, use scoped_write_lock
+	void unlock_write()
+	{
+#ifdef FZ_WINDOWS
+		ReleaseSRWLockExclusive(&l_);
+#else
+		pthread_rwlock_unlock(&l_);
+#endif
+	}
+
+private:
+#ifdef FZ_WINDOWS
+	SRWLOCK l_;
+#else
+	pthread_rwlock_t l_;
+#endif
+};
+
+/** \brief A simple scoped read lock.
+ *
+ * Shared access is obtained on construction and, if still locked, released on destruction.
+ */
+class FZ_PUBLIC_SYMBOL scoped_read_lock final
+{
+public:
+	explicit scoped_read_lock(rwlock& l)
+		: l_(l)
+	{
+		l_.lock_read();
+	}
+
+	~scoped_read_lock()
+	{
+		if (locked_) {
+			l_.unlock_read();
+		}
+	}
+
+	scoped_read_lock(scoped_read_lock const&) = delete;
+	scoped_read_lock& operator=(scoped_read_lock const&) = delete;
+
+	/// Locking an already locked scoped_read_lock results in undefined behavior.
+	void lock()
+	{
+		locked_ = true;
+		l_.lock_read();
+	}
+
+	/// Releasing a scoped_read_lock that isn't locked results in undefined behavior.
+	void unlock()
+	{
+		locked_ = false;
+		l_.unlock_read();
+	}
+
+private:
+	rwlock & l_;
+	bool locked_{true};
+};
+
+/** \brief A simple scoped write lock.
+ *
+ * Exclusive access is obtained on construction and, if still locked, released on destruction.
+ */
+class FZ_PUBLIC_SYMBOL scoped_write_lock final
+{
+public:
+	explicit scoped_write_lock(rwlock& l)
+		: l_(l)
+	{
+		l_.lock_write();
+	}
+
+	~scoped_write_lock()
+	{
+		if (locked_) {
+			l_.unlock_write();
+		}
+	}
+
+	scoped_write_lock(scoped_write_lock const&) = delete;
+	scoped_write_lock& operator=(scoped_write_lock const&) = delete;
+
+	/// Locking an already locked scoped_write_lock results in undefined behavior.
+	void lock()
+	{
+		locked_ = true;
+		l_.lock_write();
+	}
+
+	/// Releasing a scoped_write_lock that isn't locked results in undefined behavior.
+	void unlock()
+	{
+		locked_ = false;
+		l_.unlock_write();
+	}
+
+private:
+	rwlock & l_;
+	bool locked_{true};
+};
+
+/** \brief Sequence lock protecting a small value that is read far more often than it is written.
+ *
+ * Readers never write to shared memory, so any number of readers on any number of processors
+ * scale perfectly, there is no cache line bouncing between them. Instead, readers optimistically
+ * copy the value and retry if a writer modified it in the meantime.
+ *
+ * Writers are serialized by a mutex and never wait for readers.
+ *
+ * Suitable for configuration values, limits, counters and the like, read millions of times
+ * per second. For larger structures, store an immutable snapshot behind a pointer and
+ * protect that, or use \ref rwlock.
+ *
+ * \tparam T must be trivially copyable. Keep it small, readers copy the entire value.
+ */
+template<typename T>
+class seqlock final
+{
+	static_assert(std::is_trivially_copyable<T>::value, "seqlock only supports trivially copyable types");
+
+public:
+	seqlock()
+		: seqlock(T())
+	{}
+
+	explicit seqlock(T const& v)
+	{
+		write_words(v);
+	}
+
+	seqlock(seqlock const&) = delete;
+	seqlock& operator=(seqlock const&) = delete;
+
+	/// Returns a consistent copy of the value. Never blocks on other readers. Can be called from any thread.
+	T load() const
+	{
+		for (;;) {
+			size_t const seq = seq_.load(std::memory_order_acquire);
+			if (seq & 1) {
+				// Writer in progress
+				continue;
+			}
+
+			size_t words[word_count];
+			for (size_t i = 0; i < word_count; ++i) {
+				words[i] = data_[i].load(std::memory_order_relaxed);
+			}
+
+			std::atomic_thread_fence(std::memory_order_acquire);
+			if (seq_.load(std::memory_order_relaxed) == seq) {
+				T ret;
+				std::memcpy(&ret, words, sizeof(T));
+				return ret;
+			}
+		}
+	}
+
+	/// Replaces the value. Can be called from any thread.
+	void store(T const& v)
+	{
+		scoped_lock l(m_);
+		seq_.store(seq_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+		write_words(v);
+		seq_.store(seq_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+	}
+
+private:
+	static size_t const word_count = (sizeof(T) + sizeof(size_t) - 1) / sizeof(size_t);
+
+	void write_words(T const& v)
+	{
+		size_t words[word_count]{};
+		std::memcpy(words, &v, sizeof(T));
+		for (size_t i = 0; i < word_count; ++i) {
+			data_[i].store(words[i], std::memory_order_relaxed);
+		}
+	}
+
+	std::atomic<size_t> seq_{};
+	std::atomic<size_t> data_[word_count];
+	mutex m_{false};
+};
+
+/// Contention statistics of all mutexes sharing a name, see \ref enable_lock_profiling
+struct lock_statistics final
+{
+	std::string name;
+
+	/// How often the mutexes have been locked
+	uint64_t acquisitions{};
+
+	/// How often the mutexes were already locked by another thread
+	uint64_t contended{};
+
+	/// Total time in nanoseconds spent waiting to obtain the mutexes
+	uint64_t wait_time{};
+
+	/// Total time in nanoseconds the mutexes have been held
+	uint64_t hold_time{};
+};
+
+/** \brief Enables or disables lock profiling.
+ *
+ * While enabled, \ref scoped_lock records statistics for all mutexes and adaptive mutexes
+ * that have been given a name at construction. Mutexes locked manually through
+ * \ref mutex::lock are not recorded, neither is time spent in a \ref condition waiting.
+ *
+ * Disabled by default. While disabled, the only overhead is the check of a flag.
+ */
+void FZ_PUBLIC_SYMBOL enable_lock_profiling(bool enable = true);
+
+/// Returns true if lock profiling is enabled
+bool FZ_PUBLIC_SYMBOL lock_profiling_enabled();
+
+/** \brief Returns the lock statistics, hottest first
+ *
+ * Locks are ordered by the total time spent waiting for them.
+ *
+ * \param max If non-zero, only that many entries are returned.
+ */
+std::vector<lock_statistics> FZ_PUBLIC_SYMBOL get_lock_statistics(size_t max = 0);
+
+/// Resets all lock statistics to zero
+void FZ_PUBLIC_SYMBOL reset_lock_statistics();
+
 }
 #endif
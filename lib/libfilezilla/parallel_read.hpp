@@ -0,0 +1,72 @@
+#ifndef LIBFILEZILLA_PARALLEL_READ_HEADER
+#define LIBFILEZILLA_PARALLEL_READ_HEADER
+
+#include "libfilezilla.hpp"
+
+#include <functional>
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** \file
+ * \brief Reading large files using multiple concurrent reads, see \ref fz::read_segments "read_segments"
+ */
+
+namespace fz {
+
+class file;
+class thread_pool;
+
+/** \brief Consumer of segments read by \ref read_segments
+ *
+ * Gets passed the data of a segment and its offset in the file. The data is only valid
+ * during the call. Return false to abort reading.
+ */
+typedef std::function<bool(uint8_t const* data, size_t size, int64_t offset)> segment_consumer;
+
+/// Options for \ref read_segments
+struct parallel_read_options final
+{
+	/// Size of each segment, only the last one can be smaller.
+	size_t segment_size{4 * 1024 * 1024};
+
+	/// Maximum number of segments read at the same time
+	size_t parallel{4};
+
+	/** \brief Deliver the segments in order
+	 *
+	 * If true, the consumer is called on the calling thread, one segment after another in order
+	 * of their offsets. Up to twice as many segments as can be read in parallel are buffered.
+	 *
+	 * If false, the consumer is called on the reading threads as soon as a segment has been read,
+	 * possibly concurrently. Use it if the order does not matter, e.g. to write the segments to
+	 * the same offsets of another file.
+	 */
+	bool in_order{true};
+};
+
+/** \brief Reads a range of a file using multiple concurrent positional reads
+ *
+ * A single stream of sequential reads keeps at most one request in flight, leaving fast
+ * storage such as NVMe drives mostly idle. This function splits the range into segments which
+ * are read concurrently by multiple threads through the same descriptor using \ref file::read_at.
+ *
+ * Combine it with \ref file::open_options::direct to bypass the page cache for files that get
+ * read just once.
+ *
+ * \param f The file, must be opened for reading.
+ * \param pool Pool to run the reading tasks on. The calling thread reads as well, so reading
+ *             completes even if the pool cannot start any of the tasks.
+ * \param consumer Called for every segment read
+ * \param offset Start of the range
+ * \param length Length of the range, -1 to read everything up to the end of the file.
+ * \param options Segment size, concurrency and order of delivery
+ *
+ * \return The number of octets read. It is less than \c length only if the file is shorter.
+ * \return -1 on error or if aborted by the consumer.
+ */
+int64_t FZ_PUBLIC_SYMBOL read_segments(file & f, thread_pool & pool, segment_consumer const& consumer, int64_t offset = 0, int64_t length = -1, parallel_read_options const& options = parallel_read_options());
+
+}
+
+#endif
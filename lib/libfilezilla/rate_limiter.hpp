@@ -0,0 +1,129 @@
+#ifndef LIBFILEZILLA_RATE_LIMITER_HEADER
+#define LIBFILEZILLA_RATE_LIMITER_HEADER
+
+#include "libfilezilla.hpp"
+#include "event_handler.hpp"
+#include "time.hpp"
+
+#include <atomic>
+
+/** \file
+ * \brief Bandwidth limiting: \ref fz::token_bucket "token_bucket" and \ref fz::rate_limited_reader "rate_limited_reader"
+ */
+
+namespace fz {
+
+class file;
+class process;
+
+/** \brief A token bucket for limiting bandwidth, optionally part of a hierarchy
+ *
+ * Tokens, each allowing the transfer of one octet, are added to the bucket at a fixed rate,
+ * up to the burst size. Transfers take tokens out of the bucket. If the bucket has a parent,
+ * tokens are taken from all buckets up to the root, so that e.g. per-transfer buckets can have
+ * per-user buckets as parent, which in turn have a global bucket as parent.
+ *
+ * Refilling happens lazily when tokens are requested. All functions are lock-free and can be
+ * called from any thread. Under contention, buckets can temporarily go slightly into debt,
+ * which is paid back from subsequent refills.
+ *
+ * Event handlers wait for tokens using timers, e.g.:
+ * \code
+ * int64_t const allowed = bucket.consume(wanted);
+ * if (!allowed) {
+ *     bucket.wait(*this); // Try again on the timer_event
+ * }
+ * \endcode
+ */
+class FZ_PUBLIC_SYMBOL token_bucket final
+{
+public:
+	/// Rate of buckets not limiting the bandwidth
+	static int64_t const unlimited = -1;
+
+	/** \brief Creates the bucket
+	 *
+	 * \param rate Tokens added per second, \ref unlimited, or 0 to block all transfers.
+	 * \param burst Maximum number of tokens in the bucket. If 0, the rate is used, allowing bursts of up to a second.
+	 * \param parent Optional parent bucket, must outlive this bucket.
+	 *
+	 * The bucket starts out full.
+	 */
+	explicit token_bucket(int64_t rate = unlimited, int64_t burst = 0, token_bucket* parent = nullptr);
+
+	token_bucket(token_bucket const&) = delete;
+	token_bucket& operator=(token_bucket const&) = delete;
+
+	/// Changes rate and burst size, see the constructor.
+	void set_limit(int64_t rate, int64_t burst = 0);
+
+	int64_t rate() const { return rate_.load(std::memory_order_relaxed); }
+
+	token_bucket* parent() const { return parent_; }
+
+	/** \brief Takes tokens out of this bucket and its ancestors
+	 *
+	 * \return The number of tokens taken, at most \c max. 0 if any of the buckets is empty.
+	 */
+	int64_t consume(int64_t max);
+
+	/// Puts back tokens that were consumed but ended up not being used.
+	void refund(int64_t tokens);
+
+	/** \brief Number of tokens currently available from this bucket and its ancestors
+	 *
+	 * Useful only as a hint, tokens can be taken by other threads at any time.
+	 */
+	int64_t available();
+
+	/// Time until \c tokens will be available, assuming no competing consumers. Zero if already available.
+	duration wait_time(int64_t tokens = 1);
+
+	/** \brief Starts a one-shot timer that fires once tokens are expected to be available again.
+	 *
+	 * The handler receives a timer_event, upon which it should retry \ref consume.
+	 */
+	timer_id wait(event_handler & h, int64_t tokens = 1);
+
+private:
+	void refill(int64_t now);
+
+	token_bucket* const parent_;
+
+	std::atomic<int64_t> rate_;
+	std::atomic<int64_t> burst_;
+	std::atomic<int64_t> tokens_;
+
+	// Time of the last refill in nanoseconds
+	std::atomic<int64_t> last_refill_;
+};
+
+/** \brief Reads from a file or process, respecting a bandwidth limit
+ *
+ * Reads block while the bucket is empty. Event-driven code should use \ref token_bucket::consume
+ * and \ref token_bucket::wait instead.
+ */
+class FZ_PUBLIC_SYMBOL rate_limited_reader final
+{
+public:
+	rate_limited_reader(file & f, token_bucket & bucket);
+	rate_limited_reader(process & p, token_bucket & bucket);
+
+	rate_limited_reader(rate_limited_reader const&) = delete;
+	rate_limited_reader& operator=(rate_limited_reader const&) = delete;
+
+	/** \brief Reads data once the bucket allows it
+	 *
+	 * \return Same as \ref file::read
+	 */
+	int64_t read(void *buf, int64_t count);
+
+private:
+	file* const file_{};
+	process* const process_{};
+	token_bucket & bucket_;
+};
+
+}
+
+#endif
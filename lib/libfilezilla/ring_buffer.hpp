@@ -0,0 +1,392 @@
+#ifndef LIBFILEZILLA_RING_BUFFER_HEADER
+#define LIBFILEZILLA_RING_BUFFER_HEADER
+
+#include "libfilezilla.hpp"
+#include "mutex.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+/** \file
+ * \brief Bounded lock-free ring buffers for passing data between threads: \ref fz::spsc_ring_buffer "spsc_ring_buffer" and \ref fz::mpmc_ring_buffer "mpmc_ring_buffer"
+ */
+
+namespace fz {
+
+/** \private
+ * \brief Blocking support shared by the ring buffers
+ *
+ * Pushing and popping is lock-free. Only threads that have to wait for a full or empty buffer
+ * take the mutex and park on a condition. The other side only touches the mutex if it sees
+ * that there are parked threads.
+ */
+class ring_buffer_sync
+{
+public:
+	/** \brief Closes the buffer.
+	 *
+	 * Blocked and future blocking pushes fail. Blocking pops still return the remaining
+	 * elements, then fail instead of blocking.
+	 */
+	void close()
+	{
+		closed_ = true;
+		scoped_lock l(m_);
+		not_empty_.broadcast(l);
+		not_full_.broadcast(l);
+	}
+
+	/// Returns true if \ref close has been called.
+	bool closed() const { return closed_; }
+
+protected:
+	ring_buffer_sync() = default;
+
+	// Assumed size of a cache line. Members modified by different threads are separated by
+	// padding of this size to avoid false sharing. Padding is used instead of alignment, as
+	// over-aligned types do not get aligned when allocated on the heap before C++17.
+	static size_t const cache_line_size = 64;
+
+	// Tries the operation a few times, then parks until it succeeds or until the buffer is closed.
+	template<typename Attempt>
+	bool block(std::atomic<int> & waiting, broadcast_condition & cond, bool fail_on_close, Attempt const& attempt)
+	{
+		for (int i = 0; i < 64; ++i) {
+			if (fail_on_close && closed_) {
+				return false;
+			}
+			if (attempt()) {
+				return true;
+			}
+		}
+
+		scoped_lock l(m_);
+		++waiting;
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		bool ret;
+		while (!(ret = !(fail_on_close && closed_) && attempt())) {
+			if (closed_) {
+				// Check once more, an element might have been pushed right before closing
+				ret = !fail_on_close && attempt();
+				break;
+			}
+			cond.wait(l);
+		}
+		--waiting;
+		return ret;
+	}
+
+	// Wakes a parked thread on the other side, if any
+	void notify(std::atomic<int> & waiting, broadcast_condition & cond)
+	{
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (waiting.load(std::memory_order_relaxed)) {
+			scoped_lock l(m_);
+			cond.signal(l);
+		}
+	}
+
+	std::atomic<int> waiting_consumers_{};
+	std::atomic<int> waiting_producers_{};
+	std::atomic<bool> closed_{};
+	mutex m_{false};
+	broadcast_condition not_empty_;
+	broadcast_condition not_full_;
+};
+
+/** \brief Bounded single-producer/single-consumer ring buffer
+ *
+ * Exactly one thread may push and exactly one thread may pop at any time. The non-blocking
+ * operations are wait-free unless the other side is parked. The producer and consumer positions are padded to reside
+ * in different cache lines, each side caches the other's position to avoid touching the other's cache line on
+ * every operation.
+ *
+ * \tparam T must be move-constructible and move-assignable.
+ */
+template<typename T>
+class spsc_ring_buffer final : public ring_buffer_sync
+{
+public:
+	/// The capacity is rounded up to the next power of two, it is at least 2.
+	explicit spsc_ring_buffer(size_t capacity)
+		: mask_(round_capacity(capacity) - 1)
+		, slots_(new slot[mask_ + 1])
+	{}
+
+	~spsc_ring_buffer()
+	{
+		for (size_t i = head_; i != tail_; ++i) {
+			reinterpret_cast<T*>(&slots_[i & mask_])->~T();
+		}
+	}
+
+	spsc_ring_buffer(spsc_ring_buffer const&) = delete;
+	spsc_ring_buffer& operator=(spsc_ring_buffer const&) = delete;
+
+	size_t capacity() const { return mask_ + 1; }
+
+	/// Pushes the element if there is room. Returns false if the buffer is full.
+	template<typename U>
+	bool try_push(U && v)
+	{
+		if (!push_impl(std::forward<U>(v))) {
+			return false;
+		}
+		notify(waiting_consumers_, not_empty_);
+		return true;
+	}
+
+	/// Pops the oldest element into \c v. Returns false if the buffer is empty.
+	bool try_pop(T & v)
+	{
+		if (!pop_impl(v)) {
+			return false;
+		}
+		notify(waiting_producers_, not_full_);
+		return true;
+	}
+
+	/// Pushes the element, waiting for room if needed. Returns false if the buffer has been closed.
+	template<typename U>
+	bool push(U && v)
+	{
+		if (!block(waiting_producers_, not_full_, true, [&]() { return push_impl(std::forward<U>(v)); })) {
+			return false;
+		}
+		notify(waiting_consumers_, not_empty_);
+		return true;
+	}
+
+	/// Pops the oldest element, waiting if the buffer is empty. Returns false once the buffer is closed and empty.
+	bool pop(T & v)
+	{
+		if (!block(waiting_consumers_, not_empty_, false, [&]() { return pop_impl(v); })) {
+			return false;
+		}
+		notify(waiting_producers_, not_full_);
+		return true;
+	}
+
+private:
+	template<typename U>
+	bool push_impl(U && v)
+	{
+		size_t const tail = tail_.load(std::memory_order_relaxed);
+		if (tail - cached_head_ > mask_) {
+			cached_head_ = head_.load(std::memory_order_acquire);
+			if (tail - cached_head_ > mask_) {
+				return false;
+			}
+		}
+		new (&slots_[tail & mask_]) T(std::forward<U>(v));
+		tail_.store(tail + 1, std::memory_order_release);
+		return true;
+	}
+
+	bool pop_impl(T & v)
+	{
+		size_t const head = head_.load(std::memory_order_relaxed);
+		if (head == cached_tail_) {
+			cached_tail_ = tail_.load(std::memory_order_acquire);
+			if (head == cached_tail_) {
+				return false;
+			}
+		}
+		T* p = reinterpret_cast<T*>(&slots_[head & mask_]);
+		v = std::move(*p);
+		p->~T();
+		head_.store(head + 1, std::memory_order_release);
+		return true;
+	}
+
+	typedef typename std::aligned_storage<sizeof(T), alignof(T)>::type slot;
+
+	static size_t round_capacity(size_t capacity)
+	{
+		size_t ret = 2;
+		while (ret < capacity) {
+			ret <<= 1;
+		}
+		return ret;
+	}
+
+	size_t const mask_;
+	std::unique_ptr<slot[]> slots_;
+
+	char pad0_[cache_line_size];
+
+	// Consumer side
+	std::atomic<size_t> head_{};
+	size_t cached_tail_{};
+
+	char pad1_[cache_line_size];
+
+	// Producer side
+	std::atomic<size_t> tail_{};
+	size_t cached_head_{};
+
+	char pad2_[cache_line_size];
+};
+
+/** \brief Bounded multi-producer/multi-consumer ring buffer
+ *
+ * Any number of threads may push and pop concurrently. Based on Dmitry Vyukov's bounded MPMC
+ * queue: Each slot carries a sequence number telling producers and consumers whether it is
+ * theirs to use, so that a single compare-and-swap on the respective position claims a slot.
+ *
+ * \tparam T must be move-constructible and move-assignable.
+ */
+template<typename T>
+class mpmc_ring_buffer final : public ring_buffer_sync
+{
+public:
+	/// The capacity is rounded up to the next power of two, it is at least 2.
+	explicit mpmc_ring_buffer(size_t capacity)
+		: mask_(round_capacity(capacity) - 1)
+		, cells_(new cell[mask_ + 1])
+	{
+		for (size_t i = 0; i <= mask_; ++i) {
+			cells_[i].sequence_.store(i, std::memory_order_relaxed);
+		}
+	}
+
+	~mpmc_ring_buffer()
+	{
+		for (size_t i = dequeue_pos_; i != enqueue_pos_; ++i) {
+			reinterpret_cast<T*>(&cells_[i & mask_].data_)->~T();
+		}
+	}
+
+	mpmc_ring_buffer(mpmc_ring_buffer const&) = delete;
+	mpmc_ring_buffer& operator=(mpmc_ring_buffer const&) = delete;
+
+	size_t capacity() const { return mask_ + 1; }
+
+	/// Pushes the element if there is room. Returns false if the buffer is full.
+	template<typename U>
+	bool try_push(U && v)
+	{
+		if (!push_impl(std::forward<U>(v))) {
+			return false;
+		}
+		notify(waiting_consumers_, not_empty_);
+		return true;
+	}
+
+	/// Pops the oldest element into \c v. Returns false if the buffer is empty.
+	bool try_pop(T & v)
+	{
+		if (!pop_impl(v)) {
+			return false;
+		}
+		notify(waiting_producers_, not_full_);
+		return true;
+	}
+
+	/// Pushes the element, waiting for room if needed. Returns false if the buffer has been closed.
+	template<typename U>
+	bool push(U && v)
+	{
+		if (!block(waiting_producers_, not_full_, true, [&]() { return push_impl(std::forward<U>(v)); })) {
+			return false;
+		}
+		notify(waiting_consumers_, not_empty_);
+		return true;
+	}
+
+	/// Pops the oldest element, waiting if the buffer is empty. Returns false once the buffer is closed and empty.
+	bool pop(T & v)
+	{
+		if (!block(waiting_consumers_, not_empty_, false, [&]() { return pop_impl(v); })) {
+			return false;
+		}
+		notify(waiting_producers_, not_full_);
+		return true;
+	}
+
+private:
+	template<typename U>
+	bool push_impl(U && v)
+	{
+		cell* c;
+		size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+		for (;;) {
+			c = &cells_[pos & mask_];
+			size_t const seq = c->sequence_.load(std::memory_order_acquire);
+			intptr_t const diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+			if (!diff) {
+				if (enqueue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+					break;
+				}
+			}
+			else if (diff < 0) {
+				return false;
+			}
+			else {
+				pos = enqueue_pos_.load(std::memory_order_relaxed);
+			}
+		}
+		new (&c->data_) T(std::forward<U>(v));
+		c->sequence_.store(pos + 1, std::memory_order_release);
+		return true;
+	}
+
+	bool pop_impl(T & v)
+	{
+		cell* c;
+		size_t pos = dequeue_pos_.load(std::memory_order_relaxed);
+		for (;;) {
+			c = &cells_[pos & mask_];
+			size_t const seq = c->sequence_.load(std::memory_order_acquire);
+			intptr_t const diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+			if (!diff) {
+				if (dequeue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+					break;
+				}
+			}
+			else if (diff < 0) {
+				return false;
+			}
+			else {
+				pos = dequeue_pos_.load(std::memory_order_relaxed);
+			}
+		}
+		T* p = reinterpret_cast<T*>(&c->data_);
+		v = std::move(*p);
+		p->~T();
+		c->sequence_.store(pos + mask_ + 1, std::memory_order_release);
+		return true;
+	}
+
+	struct cell
+	{
+		std::atomic<size_t> sequence_;
+		typename std::aligned_storage<sizeof(T), alignof(T)>::type data_;
+	};
+
+	static size_t round_capacity(size_t capacity)
+	{
+		size_t ret = 2;
+		while (ret < capacity) {
+			ret <<= 1;
+		}
+		return ret;
+	}
+
+	size_t const mask_;
+	std::unique_ptr<cell[]> cells_;
+
+	char pad0_[cache_line_size];
+	std::atomic<size_t> enqueue_pos_{};
+	char pad1_[cache_line_size];
+	std::atomic<size_t> dequeue_pos_{};
+	char pad2_[cache_line_size];
+};
+
+}
+
+#endif
@@ -0,0 +1,164 @@
+#ifndef LIBFILEZILLA_SEMAPHORE_HEADER
+#define LIBFILEZILLA_SEMAPHORE_HEADER
+
+/** \file
+ * \brief Thread coordination primitives: semaphore, latch and barrier
+ */
+#include "libfilezilla.hpp"
+#include "time.hpp"
+
+#include <atomic>
+#include <functional>
+
+namespace fz {
+
+/** \brief Counting semaphore
+ *
+ * Acquiring decrements the count, waiting while it is zero. Releasing increments the count.
+ *
+ * Uncontended operations only touch an atomic counter. Threads that need to wait sleep in
+ * the kernel using a futex on Linux, other platforms use a small table of mutexes and
+ * conditions.
+ */
+class FZ_PUBLIC_SYMBOL semaphore final
+{
+public:
+	explicit semaphore(int initial = 0)
+		: count_(initial)
+	{}
+
+	semaphore(semaphore const&) = delete;
+	semaphore& operator=(semaphore const&) = delete;
+
+	/// Decrements the count, waits until it is positive first
+	void acquire()
+	{
+		if (!try_acquire()) {
+			acquire_slow(nullptr);
+		}
+	}
+
+	/** \brief Decrements the count, waits until it is positive first
+	 *
+	 * \return false if the count did not become positive within the timeout
+	 */
+	bool acquire(duration const& timeout);
+
+	/// Like \ref acquire(duration const&), but with an absolute deadline
+	bool acquire_until(monotonic_clock const& deadline);
+
+	/// Decrements the count if positive, never waits.
+	bool try_acquire()
+	{
+		int c = count_.load(std::memory_order_relaxed);
+		while (c > 0) {
+			if (count_.compare_exchange_weak(c, c - 1, std::memory_order_acquire, std::memory_order_relaxed)) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	/// Increments the count by n, waking up to n waiting threads
+	void release(int n = 1)
+	{
+		count_.fetch_add(n);
+		if (waiters_.load()) {
+			wake(n);
+		}
+	}
+
+private:
+	bool acquire_slow(monotonic_clock const* deadline);
+	void wake(int n);
+
+	std::atomic<int> count_;
+	std::atomic<int> waiters_{};
+};
+
+/** \brief Single-use countdown
+ *
+ * Threads can wait until the counter, set at construction, has been counted down to zero.
+ * Typically used to wait for a fixed number of tasks to finish, without having to join each of them.
+ */
+class FZ_PUBLIC_SYMBOL latch final
+{
+public:
+	explicit latch(int count)
+		: count_(count)
+	{}
+
+	latch(latch const&) = delete;
+	latch& operator=(latch const&) = delete;
+
+	/// Decrements the counter by n, releasing all waiting threads once it reaches zero.
+	void count_down(int n = 1)
+	{
+		if (count_.fetch_sub(n, std::memory_order_acq_rel) == n && waiters_.load()) {
+			wake_all();
+		}
+	}
+
+	/// Returns true if the counter has reached zero
+	bool try_wait() const
+	{
+		return !count_.load(std::memory_order_acquire);
+	}
+
+	/// Waits until the counter has reached zero
+	void wait()
+	{
+		if (!try_wait()) {
+			wait_slow(nullptr);
+		}
+	}
+
+	/// Waits until the counter has reached zero, returns false if the deadline has been reached first.
+	bool wait_until(monotonic_clock const& deadline);
+
+	/// Shorthand for count_down followed by wait
+	void arrive_and_wait(int n = 1)
+	{
+		count_down(n);
+		wait();
+	}
+
+private:
+	bool wait_slow(monotonic_clock const* deadline);
+	void wake_all();
+
+	std::atomic<int> count_;
+	std::atomic<int> waiters_{};
+};
+
+/** \brief Reusable thread barrier
+ *
+ * A fixed number of threads repeatedly meet at the barrier, none can proceed until all
+ * have arrived. Afterwards, the barrier resets itself for the next phase.
+ *
+ * Optionally, a completion function is called by the last thread to arrive, before
+ * any of the threads are released. It can be used to prepare the next phase.
+ */
+class FZ_PUBLIC_SYMBOL barrier final
+{
+public:
+	explicit barrier(int count, std::function<void()> const& completion = std::function<void()>());
+
+	barrier(barrier const&) = delete;
+	barrier& operator=(barrier const&) = delete;
+
+	/// Waits until all threads have arrived.
+	void arrive_and_wait();
+
+private:
+	int const count_;
+	std::function<void()> const completion_;
+
+	std::atomic<int> arrived_{};
+	std::atomic<int> phase_{};
+	std::atomic<int> waiters_{};
+};
+
+}
+
+#endif
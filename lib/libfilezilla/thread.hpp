@@ -3,8 +3,10 @@
 
 #include "libfilezilla.hpp"
 
+#include <vector>
+
 /** \file
- * \brief Declares \ref fz::thread "thread"
+ * \brief Declares \ref fz::thread "thread" and functions to query and control processor placement
  */
 
 namespace fz {
@@ -58,6 +60,25 @@ public:
 	 */
 	bool joinable() const;
 
+	/** \brief Restricts the thread to the passed set of logical processors.
+	 *
+	 * Can be called before and after the thread has been started. If the thread
+	 * is not yet running, the affinity gets applied once the thread starts.
+	 *
+	 * Passing an empty set lifts any restriction previously set through this function.
+	 *
+	 * \return false if the set is invalid or if setting the affinity is not supported
+	 *         on this platform.
+	 */
+	bool set_affinity(std::vector<int> const& cpus);
+
+	/** \brief Returns the set of logical processors the thread may run on.
+	 *
+	 * If the thread is not running, the set passed to \ref set_affinity is returned.
+	 * Returns an empty set if the placement cannot be determined.
+	 */
+	std::vector<int> affinity() const;
+
 protected:
 	/// The thread's entry point, override in your derived class.
 	virtual void entry() = 0;
@@ -68,6 +89,33 @@ private:
 	impl* impl_{};
 };
 
+/** \brief Returns the logical processor the calling thread currently runs on.
+ *
+ * Returns -1 if this cannot be determined. The result is merely a snapshot, unless
+ * the thread has been pinned to a single processor it may be migrated at any time.
+ */
+int FZ_PUBLIC_SYMBOL current_cpu();
+
+/** \brief Returns the NUMA topology of the system.
+ *
+ * Each element is a NUMA node holding the logical processors belonging to that node.
+ * On systems without NUMA, or if the topology cannot be determined, a single node
+ * containing all processors is returned.
+ */
+std::vector<std::vector<int>> FZ_PUBLIC_SYMBOL numa_nodes();
+
+/// Returns the index of the NUMA node the given logical processor belongs to, or 0 if unknown.
+int FZ_PUBLIC_SYMBOL numa_node_of_cpu(int cpu);
+
+/** \brief Restricts the calling thread to the given set of logical processors.
+ *
+ * Passing an empty set allows the thread to run on all processors.
+ */
+bool FZ_PUBLIC_SYMBOL set_current_thread_affinity(std::vector<int> const& cpus);
+
+/// Returns the set of logical processors the calling thread may run on, empty if unknown.
+std::vector<int> FZ_PUBLIC_SYMBOL current_thread_affinity();
+
 }
 
 #endif
@@ -3,7 +3,11 @@
 
 #include "libfilezilla.hpp"
 #include "mutex.hpp"
+#include "time.hpp"
 
+#include <array>
+#include <chrono>
+#include <deque>
 #include <functional>
 #include <memory>
 #include <vector>
@@ -16,6 +20,8 @@ namespace fz {
 
 class thread_pool;
 class pooled_thread_impl;
+class async_task_impl;
+class cancellation_state;
 
 /** \brief Handle for asynchronous tasks
  */
@@ -32,29 +38,70 @@ public:
 	async_task(async_task && other) noexcept;
 	async_task& operator=(async_task && other) noexcept;
 
-	/// Wait for the task to finish, adds the now idle thread back into the pool
+	/** \brief Wait for the task to finish
+	 *
+	 * Returns immediately if the task has been cancelled before it started running.
+	 */
 	void join();
 
 	/// Check whether it's a spawned, unjoined task.
 	explicit operator bool() const { return impl_ != 0; }
 
-	/// Detach the running thread from the task. Once done, the thread adds itself back into the pool
+	/// Detach the task. Once it has finished, its resources are released automatically.
 	void detach();
 
 private:
 	friend class thread_pool;
 	friend class pooled_thread_impl;
 
-	pooled_thread_impl* impl_{};
+	async_task_impl* impl_{};
+};
+
+/** \brief Cooperative cancellation of tasks spawned in a \ref thread_pool
+ *
+ * Copies of a token share the same state, cancelling one copy cancels all of them.
+ * A single token can be passed to any number of tasks, e.g. to abort all tasks belonging
+ * to a batch of work.
+ *
+ * Tasks that have not yet started running when the token gets cancelled are never run,
+ * their function objects are destroyed right away. Running tasks are not interrupted,
+ * long-running tasks should periodically poll \ref cancelled and return early.
+ */
+class FZ_PUBLIC_SYMBOL cancellation_token final
+{
+public:
+	/// Creates a new token which is not cancelled.
+	cancellation_token();
+
+	/** \brief Cancels the token
+	 *
+	 * Removes all queued tasks associated with the token from the pools they
+	 * were spawned in.
+	 */
+	void cancel();
+
+	/// Returns true if the token has been cancelled. Can be called from any thread.
+	bool cancelled() const;
+
+private:
+	friend class thread_pool;
+
+	std::shared_ptr<cancellation_state> state_;
 };
 
 /** \brief A dumb thread-pool for asynchronous tasks
  *
  * If there are no idle threads, threads are created on-demand if spawning an asynchronous task.
  * Once an asynchronous task finishes, the corresponding thread is kept idle until the pool is
- * destroyed.
+ * destroyed, unless an idle timeout has been set using \ref set_idle_timeout.
+ *
+ * Any number of tasks can be run concurrently, unless the number of threads has been
+ * limited using \ref set_max_threads. In that case tasks are queued until a thread
+ * becomes available, queued tasks with higher priority are started first.
  *
- * Any number of tasks can be run concurrently.
+ * By default the pool's threads may run on any processor. Use \ref set_affinity to restrict
+ * them to a set of processors and \ref set_numa_placement to keep tasks on the NUMA node
+ * they were spawned from.
  */
 class FZ_PUBLIC_SYMBOL thread_pool final
 {
@@ -65,16 +112,158 @@ public:
 	thread_pool(thread_pool const&) = delete;
 	thread_pool& operator=(thread_pool const&) = delete;
 
-	/// Spawns a new asynchronous task.
+	/// Priority classes of tasks
+	enum priority {
+		/// Background work, e.g. directory scans or checksumming
+		low,
+
+		normal,
+
+		/// Latency-sensitive work
+		high
+	};
+
+	/// Spawns a new asynchronous task with normal priority.
 	async_task spawn(std::function<void()> const& f);
 
+	/** \brief Spawns a new asynchronous task with the given priority.
+	 *
+	 * The priority only affects the order in which queued tasks are started,
+	 * see \ref set_max_threads.
+	 */
+	async_task spawn(std::function<void()> const& f, priority p);
+
+	/** \brief Spawns a new asynchronous task with the given priority which can be cancelled through the passed token.
+	 *
+	 * If the token is cancelled before the task starts running, the task is not run at all.
+	 * The task can poll the token to check whether it should finish early.
+	 */
+	async_task spawn(std::function<void()> const& f, priority p, cancellation_token const& token);
+
+	/** \brief Limits the number of threads in the pool.
+	 *
+	 * If all threads are busy and the limit has been reached, newly spawned tasks are queued.
+	 * Passing 0, the default, allows an unlimited number of threads.
+	 */
+	void set_max_threads(size_t count);
+
+	/// Returns the limit set with \ref set_max_threads, 0 if unlimited.
+	size_t get_max_threads() const;
+
+	/** \brief Restricts all threads of the pool to the given set of logical processors.
+	 *
+	 * Applies to both existing and future threads. Passing an empty set lifts the restriction.
+	 */
+	void set_affinity(std::vector<int> const& cpus);
+
+	/** \brief Enables or disables NUMA-aware placement.
+	 *
+	 * If enabled, each thread of the pool is pinned to the processors of a single NUMA
+	 * node, with the threads being spread across all nodes. Idle threads are tracked per node
+	 * and \ref spawn runs the task on a thread of the node the calling thread is currently
+	 * running on, so that the data the caller prepared for the task stays node-local.
+	 * If that node has no idle thread, an idle thread of another node is used before
+	 * a new thread is created.
+	 *
+	 * If combined with \ref set_affinity, threads are pinned to the intersection of the
+	 * node's processors and the configured set.
+	 *
+	 * Use \ref current_cpu and \ref numa_node_of_cpu inside a task to query its placement.
+	 */
+	void set_numa_placement(bool enable);
+
+	/** \brief Lets surplus idle threads exit.
+	 *
+	 * Threads that have been idle for longer than the timeout exit as long as the pool has
+	 * more than \c min_threads threads. This releases the resources, in particular the
+	 * stacks, of threads created during a transient burst of tasks.
+	 *
+	 * Passing an empty duration, the default, keeps idle threads around until the pool
+	 * is destroyed.
+	 */
+	void set_idle_timeout(duration const& timeout, size_t min_threads = 0);
+
+	/** \brief Logarithmic histogram of durations.
+	 *
+	 * Element \c i counts the durations in the half-open interval [2^i, 2^(i+1)) microseconds,
+	 * with the first element also counting durations below one microsecond and the last
+	 * element also counting all longer durations.
+	 */
+	typedef std::array<uint64_t, 32> histogram;
+
+	/// A snapshot of the pool's statistics, see \ref get_statistics
+	struct statistics final
+	{
+		/// Number of threads currently alive
+		size_t threads{};
+
+		/// Number of threads currently idle
+		size_t idle{};
+
+		/// Number of threads that have exited due to the idle timeout
+		uint64_t threads_reaped{};
+
+		/// Number of tasks that have finished running
+		uint64_t tasks_run{};
+
+		/// Number of tasks that have been cancelled before they started running
+		uint64_t tasks_cancelled{};
+
+		/// Number of tasks currently queued, waiting for a thread to become available
+		size_t queued{};
+
+		/// Time between spawning a task and a thread starting to run it
+		histogram wait_time{};
+
+		/// Time it took to run the tasks
+		histogram run_time{};
+	};
+
+	/** \brief Returns a snapshot of the pool's statistics.
+	 *
+	 * Useful to right-size pools and their idle timeouts.
+	 */
+	statistics get_statistics() const;
+
 private:
 	friend class async_task;
+	friend class cancellation_token;
 	friend class pooled_thread_impl;
 
+	async_task FZ_PRIVATE_SYMBOL do_spawn(std::function<void()> const& f, priority p, std::shared_ptr<cancellation_state> const& token);
+	void FZ_PRIVATE_SYMBOL finish(async_task_impl* task, scoped_lock & l);
+	FZ_PRIVATE_SYMBOL async_task_impl* dequeue(size_t node);
+	void FZ_PRIVATE_SYMBOL purge_cancelled();
+
+	void FZ_PRIVATE_SYMBOL make_idle(pooled_thread_impl* t);
+	bool FZ_PRIVATE_SYMBOL reap(pooled_thread_impl* t, scoped_lock & l);
+	void FZ_PRIVATE_SYMBOL record(std::chrono::steady_clock::time_point const& spawned, std::chrono::steady_clock::time_point const& start);
+	std::vector<int> FZ_PRIVATE_SYMBOL node_affinity(size_t node) const;
+
 	std::vector<pooled_thread_impl*> threads_;
-	std::vector<pooled_thread_impl*> idle_;
-	mutex m_{false};
+
+	// Idle threads and queued tasks, indexed by NUMA node. Only one entry each if NUMA placement is disabled.
+	std::vector<std::vector<pooled_thread_impl*>> idle_;
+	std::vector<std::array<std::deque<async_task_impl*>, 3>> queues_;
+	size_t max_threads_{};
+
+	// Tokens used by tasks of this pool. The pool registers itself with each one so that
+	// cancelling the token can remove queued tasks.
+	std::vector<std::shared_ptr<cancellation_state>> tokens_;
+	size_t prune_tokens_at_{16};
+
+	std::vector<int> affinity_;
+	std::vector<std::vector<int>> nodes_;
+	size_t next_node_{};
+
+	// Threads which have exited due to the idle timeout and need to be joined
+	std::vector<pooled_thread_impl*> reaped_;
+	duration idle_timeout_;
+	size_t min_threads_{};
+
+	statistics stats_;
+
+	mutable mutex m_{"thread_pool", false};
 };
 
 }
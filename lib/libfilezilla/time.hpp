@@ -367,6 +367,9 @@ private:
 
 	clock_type::time_point t_;
 
+	friend class condition;
+	friend class broadcast_condition;
+
 	friend duration operator-(monotonic_clock const& a, monotonic_clock const& b);
 	friend bool operator==(monotonic_clock const& a, monotonic_clock const& b);
 	friend bool operator<(monotonic_clock const& a, monotonic_clock const& b);
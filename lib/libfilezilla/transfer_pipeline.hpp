@@ -0,0 +1,93 @@
+#ifndef LIBFILEZILLA_TRANSFER_PIPELINE_HEADER
+#define LIBFILEZILLA_TRANSFER_PIPELINE_HEADER
+
+#include "libfilezilla.hpp"
+#include "file.hpp"
+
+#include <functional>
+#include <vector>
+
+/** \file
+ * \brief Declares \ref fz::transfer_pipeline "transfer_pipeline" for copying data with overlapped reading, processing and writing
+ */
+
+namespace fz {
+
+class hash_accumulator;
+class thread_pool;
+
+/** \brief Copies data between files, overlapping reads, processing and writes
+ *
+ * Copying in a single thread alternates between waiting for the source and waiting for the
+ * destination. The pipeline instead reads on one thread, writes on another, and runs each
+ * processing stage on a thread of its own. Data is passed between them in a fixed number of
+ * rotating buffers. If a stage falls behind, the stages before it block once all buffers are
+ * in use, so memory usage is bounded.
+ *
+ * The throughput thus approaches that of the slowest stage, usually the slower one of the
+ * two files.
+ *
+ * Example, copying a file while calculating its hash:
+ * \code
+ * fz::hash_accumulator acc(fz::hash_algorithm::sha256);
+ * fz::transfer_pipeline pipeline(pool);
+ * pipeline.add_hash_stage(acc);
+ * if (pipeline.run(src, dst) >= 0) {
+ *     auto const digest = acc.digest();
+ * }
+ * \endcode
+ */
+class FZ_PUBLIC_SYMBOL transfer_pipeline final
+{
+public:
+	/** \brief Processing stage
+	 *
+	 * Gets passed each chunk of data in order, along with its offset in the file. Stages may
+	 * modify the data in place, but cannot change its size. Return false to abort the transfer.
+	 */
+	typedef std::function<bool(uint8_t* data, size_t size, int64_t offset)> stage;
+
+	/** \brief Creates the pipeline
+	 *
+	 * \param pool Pool for the reading thread and the stages. If it is limited to fewer threads than
+	 *             there are stages plus one, \ref run fails.
+	 * \param buffer_count Number of buffers, at least two.
+	 * \param buffer_size Size of each buffer
+	 */
+	explicit transfer_pipeline(thread_pool & pool, size_t buffer_count = 4, size_t buffer_size = 1024 * 1024);
+
+	transfer_pipeline(transfer_pipeline const&) = delete;
+	transfer_pipeline& operator=(transfer_pipeline const&) = delete;
+
+	/// Appends a stage, run in the order added between reading and writing
+	void add_stage(stage const& s);
+
+	/// Appends a stage feeding all data to the given accumulator
+	void add_hash_stage(hash_accumulator & acc);
+
+	/** \brief Copies a range of one file into another
+	 *
+	 * Like \ref copy_file, the data is copied to the same offset in the destination file.
+	 * Writing happens on the calling thread, which is also where the progress callback is invoked.
+	 *
+	 * \param src Source, must be opened for reading
+	 * \param dst Destination, must be opened for writing
+	 * \param offset Start of the range
+	 * \param length Length of the range, -1 to copy everything up to the end of the source.
+	 * \param progress Optional, called after every chunk written.
+	 *
+	 * \return The number of octets copied. It is less than \c length only if the source is shorter.
+	 * \return -1 on error, if the pool cannot provide the threads or if aborted by a stage or the progress callback.
+	 */
+	int64_t run(file & src, file & dst, int64_t offset = 0, int64_t length = -1, copy_progress const& progress = copy_progress());
+
+private:
+	thread_pool & pool_;
+	size_t const buffer_count_;
+	size_t const buffer_size_;
+	std::vector<stage> stages_;
+};
+
+}
+
+#endif
@@ -1,8 +1,12 @@
 #include "libfilezilla/local_filesys.hpp"
 
+#include <atomic>
+
 #ifndef FZ_WINDOWS
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <string.h>
 #include <utime.h>
@@ -368,9 +372,7 @@ bool local_filesys::get_next_file(native_string& name)
 #if HAVE_STRUCT_DIRENT_D_TYPE
 			if (entry->d_type == DT_LNK) {
 				bool wasLink;
-				alloc_path_buffer(entry->d_name);
-				strcpy(m_file_part, entry->d_name);
-				if (get_file_info(m_raw_path, wasLink, 0, 0, 0) != dir)
+				if (get_entry_info(entry->d_name, wasLink, 0, 0, 0) != dir)
 					continue;
 			}
 			else if (entry->d_type != DT_DIR)
@@ -378,9 +380,7 @@ bool local_filesys::get_next_file(native_string& name)
 #else
 			// Solaris doesn't have d_type
 			bool wasLink;
-			alloc_path_buffer(entry->d_name);
-			strcpy(m_file_part, entry->d_name);
-			if (get_file_info(m_raw_path, wasLink, 0, 0, 0) != dir)
+			if (get_entry_info(entry->d_name, wasLink, 0, 0, 0) != dir)
 				continue;
 #endif
 		}
@@ -498,9 +498,7 @@ bool local_filesys::get_next_file(native_string& name, bool &is_link, bool &is_d
 #if HAVE_STRUCT_DIRENT_D_TYPE
 		if (m_dirs_only) {
 			if (entry->d_type == DT_LNK) {
-				alloc_path_buffer(entry->d_name);
-				strcpy(m_file_part, entry->d_name);
-				type t = get_file_info(m_raw_path, is_link, size, modification_time, mode);
+				type t = get_entry_info(entry->d_name, is_link, size, modification_time, mode);
 				if (t != dir)
 					continue;
 
@@ -514,9 +512,20 @@ bool local_filesys::get_next_file(native_string& name, bool &is_link, bool &is_d
 		}
 #endif
 
-		alloc_path_buffer(entry->d_name);
-		strcpy(m_file_part, entry->d_name);
-		type t = get_file_info(m_raw_path, is_link, size, modification_time, mode);
+#if HAVE_STRUCT_DIRENT_D_TYPE
+		// Without any attributes requested, the type of the entry is all that's needed
+		if (!size && !modification_time && !mode && entry->d_type != DT_UNKNOWN && entry->d_type != DT_LNK) {
+			if (m_dirs_only && entry->d_type != DT_DIR) {
+				continue;
+			}
+			is_link = false;
+			is_dir = entry->d_type == DT_DIR;
+			name = entry->d_name;
+			return true;
+		}
+#endif
+
+		type t = get_entry_info(entry->d_name, is_link, size, modification_time, mode);
 
 		if (t == unknown) { // Happens for example in case of permission denied
 #if HAVE_STRUCT_DIRENT_D_TYPE
@@ -546,6 +555,107 @@ bool local_filesys::get_next_file(native_string& name, bool &is_link, bool &is_d
 #endif
 }
 
+#ifndef FZ_WINDOWS
+local_filesys::type local_filesys::get_entry_info(char const* name, bool &is_link, int64_t* size, datetime* modification_time, int* mode)
+{
+#if HAVE_FSTATAT
+	// Relative to the open directory, the lookup does not have to walk the full path again.
+	// With statx, only the requested fields are retrieved.
+	int const fd = dirfd(m_dir);
+
+	mode_t st_mode{};
+	bool ok{};
+	bool done{};
+#if HAVE_STATX
+	// Set once statx turned out to be unavailable, e.g. blocked by a seccomp filter
+	static std::atomic<bool> no_statx{};
+
+	unsigned int mask = STATX_TYPE;
+	if (size) {
+		mask |= STATX_SIZE;
+	}
+	if (modification_time) {
+		mask |= STATX_MTIME;
+	}
+	if (mode) {
+		mask |= STATX_MODE;
+	}
+
+	if (!no_statx) {
+		struct statx buf;
+		ok = !statx(fd, name, AT_SYMLINK_NOFOLLOW | AT_NO_AUTOMOUNT, mask, &buf);
+		if (!ok && (errno == ENOSYS || errno == EPERM)) {
+			no_statx = true;
+		}
+		else {
+			done = true;
+			is_link = ok && S_ISLNK(buf.stx_mode);
+			if (is_link) {
+				ok = !statx(fd, name, AT_NO_AUTOMOUNT, mask, &buf);
+			}
+			if (ok) {
+				st_mode = buf.stx_mode;
+				if (modification_time) {
+					*modification_time = datetime(static_cast<time_t>(buf.stx_mtime.tv_sec), datetime::seconds);
+				}
+				if (size) {
+					*size = static_cast<int64_t>(buf.stx_size);
+				}
+			}
+		}
+	}
+#endif
+	if (!done) {
+		struct stat buf;
+		ok = !fstatat(fd, name, &buf, AT_SYMLINK_NOFOLLOW);
+		is_link = ok && S_ISLNK(buf.st_mode);
+		if (is_link) {
+			ok = !fstatat(fd, name, &buf, 0);
+		}
+		if (ok) {
+			st_mode = buf.st_mode;
+			if (modification_time) {
+				*modification_time = datetime(buf.st_mtime, datetime::seconds);
+			}
+			if (size) {
+				*size = buf.st_size;
+			}
+		}
+	}
+
+	if (!ok) {
+		if (size) {
+			*size = -1;
+		}
+		if (mode) {
+			*mode = -1;
+		}
+		if (modification_time) {
+			*modification_time = datetime();
+		}
+		return unknown;
+	}
+
+	if (mode) {
+		*mode = st_mode & 0x777;
+	}
+
+	if (S_ISDIR(st_mode)) {
+		if (size) {
+			*size = -1;
+		}
+		return dir;
+	}
+
+	return file;
+#else
+	alloc_path_buffer(name);
+	strcpy(m_file_part, name);
+	return get_file_info(m_raw_path, is_link, size, modification_time, mode);
+#endif
+}
+#endif
+
 #ifndef FZ_WINDOWS
 void local_filesys::alloc_path_buffer(char const* filename)
 {
@@ -0,0 +1,385 @@
+#include "libfilezilla/libfilezilla.hpp"
+#include "libfilezilla/mapped_file.hpp"
+
+#ifndef FZ_WINDOWS
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#endif
+
+#include <limits>
+
+namespace fz {
+
+#ifndef FZ_WINDOWS
+namespace {
+// Mapped windows the SIGBUS handler is responsible for.
+// Accessed from within the signal handler, so it has to be lock-free.
+struct guarded_range final
+{
+	std::atomic<uintptr_t> begin_{};
+	std::atomic<uintptr_t> end_{};
+	std::atomic<std::atomic<bool>*> truncated_{};
+};
+
+size_t const max_guarded_ranges = 256;
+guarded_range guarded_ranges[max_guarded_ranges];
+
+size_t page_size()
+{
+	static size_t const size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+	return size;
+}
+
+struct sigaction previous_sigbus_action;
+size_t sigbus_page_size;
+
+void sigbus_handler(int sig, siginfo_t * info, void * context)
+{
+	uintptr_t const addr = reinterpret_cast<uintptr_t>(info->si_addr);
+	for (auto & range : guarded_ranges) {
+		uintptr_t const begin = range.begin_.load(std::memory_order_acquire);
+		if (begin && addr >= begin && addr < range.end_.load(std::memory_order_acquire)) {
+			// The file got truncated, the page we tried to access no longer exists.
+			// Put a page of zeroes in its place so that the faulting access succeeds once we return.
+			// mmap isn't officially async-signal-safe, but it is a plain system call everywhere.
+			void * page = reinterpret_cast<void*>(addr & ~(sigbus_page_size - 1));
+			if (mmap(page, sigbus_page_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) != MAP_FAILED) {
+				auto truncated = range.truncated_.load(std::memory_order_acquire);
+				if (truncated) {
+					*truncated = true;
+				}
+				return;
+			}
+			break;
+		}
+	}
+
+	// Not caused by any of our mappings, pass it on.
+	if (previous_sigbus_action.sa_flags & SA_SIGINFO) {
+		if (previous_sigbus_action.sa_sigaction) {
+			previous_sigbus_action.sa_sigaction(sig, info, context);
+			return;
+		}
+	}
+	else if (previous_sigbus_action.sa_handler != SIG_DFL && previous_sigbus_action.sa_handler != SIG_IGN) {
+		previous_sigbus_action.sa_handler(sig);
+		return;
+	}
+
+	if (previous_sigbus_action.sa_handler == SIG_IGN && info->si_code <= 0) {
+		// Sent by someone, not caused by a fault.
+		return;
+	}
+
+	// Default action. The signal is blocked while in the handler, it gets delivered after returning.
+	struct sigaction sa{};
+	sa.sa_handler = SIG_DFL;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGBUS, &sa, nullptr);
+	raise(SIGBUS);
+}
+
+void install_sigbus_handler()
+{
+	static bool const installed = []() {
+		sigbus_page_size = page_size();
+
+		struct sigaction sa{};
+		sa.sa_sigaction = &sigbus_handler;
+		sa.sa_flags = SA_SIGINFO;
+		sigemptyset(&sa.sa_mask);
+		return !sigaction(SIGBUS, &sa, &previous_sigbus_action);
+	}();
+	(void)installed;
+}
+
+int guard_range(void * p, size_t length, std::atomic<bool> * truncated)
+{
+	uintptr_t const begin = reinterpret_cast<uintptr_t>(p);
+	for (size_t i = 0; i < max_guarded_ranges; ++i) {
+		uintptr_t expected{};
+		if (guarded_ranges[i].begin_.compare_exchange_strong(expected, begin)) {
+			guarded_ranges[i].truncated_.store(truncated, std::memory_order_release);
+			guarded_ranges[i].end_.store(begin + length, std::memory_order_release);
+			return static_cast<int>(i);
+		}
+	}
+
+	// Too many mappings, this one remains unprotected.
+	return -1;
+}
+
+void unguard_range(int slot)
+{
+	if (slot >= 0) {
+		auto & range = guarded_ranges[slot];
+		range.end_.store(0, std::memory_order_release);
+		range.truncated_.store(nullptr, std::memory_order_release);
+		range.begin_.store(0, std::memory_order_release);
+	}
+}
+}
+#endif
+
+mapped_file::mapped_file()
+{
+}
+
+mapped_file::mapped_file(native_string const& f, mode m)
+{
+	open(f, m);
+}
+
+mapped_file::~mapped_file()
+{
+	close();
+}
+
+bool mapped_file::map(int64_t offset, int64_t length)
+{
+	unmap();
+
+	if (!opened() || offset < 0 || offset > size_ || length < 0) {
+		return false;
+	}
+
+	if (!length || length > size_ - offset) {
+		length = size_ - offset;
+	}
+	offset_ = offset;
+	if (!length) {
+		return true;
+	}
+
+	int64_t const aligned_offset = offset - offset % static_cast<int64_t>(granularity());
+	size_t const delta = static_cast<size_t>(offset - aligned_offset);
+	if (static_cast<uint64_t>(length) > std::numeric_limits<size_t>::max() - delta) {
+		// Window exceeds address space
+		return false;
+	}
+
+#ifdef FZ_WINDOWS
+	base_ = MapViewOfFile(mapping_, (mode_ == writing) ? FILE_MAP_WRITE : FILE_MAP_READ,
+		static_cast<DWORD>(aligned_offset >> 32), static_cast<DWORD>(aligned_offset), static_cast<SIZE_T>(length + delta));
+	if (!base_) {
+		return false;
+	}
+#else
+	base_ = mmap(nullptr, static_cast<size_t>(length) + delta, (mode_ == writing) ? (PROT_READ | PROT_WRITE) : PROT_READ,
+		MAP_SHARED, fd_, static_cast<off_t>(aligned_offset));
+	if (base_ == MAP_FAILED) {
+		base_ = nullptr;
+		return false;
+	}
+#endif
+	base_length_ = static_cast<size_t>(length) + delta;
+	data_ = static_cast<uint8_t*>(base_) + delta;
+	length_ = static_cast<size_t>(length);
+
+#ifndef FZ_WINDOWS
+	slot_ = guard_range(base_, base_length_, &truncated_);
+#endif
+
+	if (pattern_ != normal) {
+		apply_advice();
+	}
+
+	return true;
+}
+
+void mapped_file::unmap()
+{
+	if (base_) {
+#ifdef FZ_WINDOWS
+		UnmapViewOfFile(base_);
+#else
+		unguard_range(slot_);
+		slot_ = -1;
+		munmap(base_, base_length_);
+#endif
+		base_ = nullptr;
+		base_length_ = 0;
+	}
+	data_ = nullptr;
+	length_ = 0;
+	offset_ = 0;
+}
+
+bool mapped_file::advise(access_pattern pattern)
+{
+	pattern_ = pattern;
+	return !base_ || apply_advice();
+}
+
+#ifdef FZ_WINDOWS
+
+bool mapped_file::open(native_string const& f, mode m)
+{
+	close();
+
+	DWORD shareMode = FILE_SHARE_READ;
+	if (m == reading) {
+		shareMode |= FILE_SHARE_WRITE;
+	}
+	hFile_ = CreateFile(f.c_str(), (m == reading) ? GENERIC_READ : (GENERIC_READ | GENERIC_WRITE), shareMode, 0, OPEN_EXISTING, 0, 0);
+	if (hFile_ == INVALID_HANDLE_VALUE) {
+		return false;
+	}
+
+	LARGE_INTEGER size{};
+	if (!GetFileSizeEx(hFile_, &size)) {
+		close();
+		return false;
+	}
+
+	// Empty files cannot be mapped
+	if (size.QuadPart) {
+		mapping_ = CreateFileMapping(hFile_, 0, (m == reading) ? PAGE_READONLY : PAGE_READWRITE, 0, 0, 0);
+		if (!mapping_) {
+			close();
+			return false;
+		}
+	}
+
+	mode_ = m;
+	size_ = static_cast<int64_t>(size.QuadPart);
+	truncated_ = false;
+	return true;
+}
+
+void mapped_file::close()
+{
+	unmap();
+	if (mapping_) {
+		CloseHandle(mapping_);
+		mapping_ = 0;
+	}
+	if (hFile_ != INVALID_HANDLE_VALUE) {
+		CloseHandle(hFile_);
+		hFile_ = INVALID_HANDLE_VALUE;
+	}
+	size_ = -1;
+}
+
+bool mapped_file::opened() const
+{
+	return hFile_ != INVALID_HANDLE_VALUE;
+}
+
+bool mapped_file::guarded() const
+{
+	return base_ != nullptr;
+}
+
+bool mapped_file::apply_advice()
+{
+	// Access patterns can only be specified when opening files.
+	return pattern_ == normal;
+}
+
+bool mapped_file::flush()
+{
+	if (!base_ || mode_ != writing) {
+		return true;
+	}
+	return FlushViewOfFile(base_, base_length_) && FlushFileBuffers(hFile_);
+}
+
+size_t mapped_file::granularity()
+{
+	static size_t const granularity = []() {
+		SYSTEM_INFO info{};
+		GetSystemInfo(&info);
+		return static_cast<size_t>(info.dwAllocationGranularity);
+	}();
+	return granularity;
+}
+
+#else
+
+bool mapped_file::open(native_string const& f, mode m)
+{
+	close();
+
+	fd_ = ::open(f.c_str(), ((m == reading) ? O_RDONLY : O_RDWR) | O_CLOEXEC);
+	if (fd_ == -1) {
+		return false;
+	}
+
+	struct stat buf;
+	if (fstat(fd_, &buf)) {
+		close();
+		return false;
+	}
+
+	install_sigbus_handler();
+
+	mode_ = m;
+	size_ = buf.st_size;
+	truncated_ = false;
+	return true;
+}
+
+void mapped_file::close()
+{
+	unmap();
+	if (fd_ != -1) {
+		::close(fd_);
+		fd_ = -1;
+	}
+	size_ = -1;
+}
+
+bool mapped_file::opened() const
+{
+	return fd_ != -1;
+}
+
+bool mapped_file::guarded() const
+{
+	return slot_ != -1;
+}
+
+bool mapped_file::apply_advice()
+{
+#if HAVE_MADVISE
+	int advice = MADV_NORMAL;
+	switch (pattern_) {
+	case sequential:
+		advice = MADV_SEQUENTIAL;
+		break;
+	case random:
+		advice = MADV_RANDOM;
+		break;
+	case willneed:
+		advice = MADV_WILLNEED;
+		break;
+	default:
+		break;
+	}
+	return !madvise(base_, base_length_, advice);
+#else
+	return pattern_ == normal;
+#endif
+}
+
+bool mapped_file::flush()
+{
+	if (!base_ || mode_ != writing) {
+		return true;
+	}
+	return !msync(base_, base_length_, MS_SYNC);
+}
+
+size_t mapped_file::granularity()
+{
+	return page_size();
+}
+
+#endif
+
+}
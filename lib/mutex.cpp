@@ -1,5 +1,15 @@
 #include "libfilezilla/mutex.hpp"
 
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <thread>
+
+#if defined(__i386__) || defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
 #ifndef FZ_WINDOWS
 #include <errno.h>
 #include <sys/time.h>
@@ -41,6 +51,31 @@ pthread_mutexattr_t* get_mutex_attributes(bool recursive)
 	}
 }
 
+// Upper bound for the number of spins before going to sleep
+int const max_spins = 100;
+
+bool const multiprocessor = std::thread::hardware_concurrency() != 1;
+
+inline void cpu_relax()
+{
+#if defined(__i386__) || defined(__x86_64__)
+	_mm_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+	__asm__ __volatile__("yield");
+#endif
+}
+
+pthread_rwlockattr_t* init_rwlockattr()
+{
+	static pthread_rwlockattr_t attr;
+	pthread_rwlockattr_init(&attr);
+#if HAVE_DECL_PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP
+	// glibc prefers readers by default, which can starve writers.
+	pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+#endif
+	return &attr;
+}
+
 pthread_condattr_t* init_condattr()
 {
 #if HAVE_CLOCK_GETTIME && HAVE_DECL_PTHREAD_CONDATTR_SETCLOCK
@@ -52,12 +87,229 @@ pthread_condattr_t* init_condattr()
 	return 0;
 #endif
 }
+
+// Converts a point in time of the steady clock to what pthread_cond_timedwait expects
+timespec to_timespec(std::chrono::steady_clock::time_point const& t)
+{
+#if HAVE_CLOCK_GETTIME && HAVE_DECL_PTHREAD_CONDATTR_SETCLOCK
+	// Our condition variables use CLOCK_MONOTONIC, same as std::chrono::steady_clock
+	auto const ns = std::chrono::duration_cast<std::chrono::nanoseconds>(t.time_since_epoch()).count();
+#else
+	// Condition variables use the wallclock, translate.
+	auto const ns = std::chrono::duration_cast<std::chrono::nanoseconds>(t - std::chrono::steady_clock::now() + std::chrono::system_clock::now().time_since_epoch()).count();
+#endif
+	timespec ts;
+	ts.tv_sec = static_cast<time_t>(ns / 1000000000);
+	ts.tv_nsec = static_cast<long>(ns % 1000000000);
+	return ts;
+}
+}
+#else
+namespace {
+DWORD remaining_ms(std::chrono::steady_clock::time_point const& t)
+{
+	auto const ms = std::chrono::duration_cast<std::chrono::milliseconds>(t - std::chrono::steady_clock::now()).count();
+	if (ms <= 0) {
+		return 0;
+	}
+	// Round up, otherwise we'd wake up too early and spin until the deadline.
+	return static_cast<DWORD>(ms + 1);
+}
 }
 #endif
 
 namespace fz {
 
+class lock_profile final
+{
+public:
+	explicit lock_profile(std::string const& name)
+		: name_(name)
+	{}
+
+	std::string const name_;
+	std::atomic<uint64_t> acquisitions_{};
+	std::atomic<uint64_t> contended_{};
+	std::atomic<uint64_t> wait_time_{};
+	std::atomic<uint64_t> hold_time_{};
+};
+
+namespace {
+int64_t profile_now()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+struct lock_profiles
+{
+	// Unnamed, thus never profiled itself
+	mutex m_{false};
+	std::map<std::string, std::unique_ptr<lock_profile>> profiles_;
+};
+
+lock_profiles& get_lock_profiles()
+{
+	// Intentionally leaked, mutexes with static storage duration may outlive it otherwise
+	static lock_profiles* profiles = new lock_profiles;
+	return *profiles;
+}
+
+lock_profile* get_lock_profile(char const* name)
+{
+	if (!name) {
+		return nullptr;
+	}
+
+	auto & profiles = get_lock_profiles();
+	scoped_lock l(profiles.m_);
+	auto & profile = profiles.profiles_[name];
+	if (!profile) {
+		profile.reset(new lock_profile(name));
+	}
+	return profile.get();
+}
+}
+
+std::atomic<bool> scoped_lock::profiling_{false};
+
+void scoped_lock::lock_profiled()
+{
+	if (!profile_) {
+		if (adaptive_) {
+			adaptive_->lock();
+		}
+		else {
+#ifdef FZ_WINDOWS
+			EnterCriticalSection(m_);
+#else
+			pthread_mutex_lock(m_);
+#endif
+		}
+		return;
+	}
+
+#ifdef FZ_WINDOWS
+	bool const contended = !TryEnterCriticalSection(m_);
+#else
+	bool const contended = pthread_mutex_trylock(m_) != 0;
+#endif
+	if (contended) {
+		int64_t const start = profile_now();
+		if (adaptive_) {
+			adaptive_->lock();
+		}
+		else {
+#ifdef FZ_WINDOWS
+			EnterCriticalSection(m_);
+#else
+			pthread_mutex_lock(m_);
+#endif
+		}
+		locked_at_ = profile_now();
+		profile_->contended_.fetch_add(1, std::memory_order_relaxed);
+		profile_->wait_time_.fetch_add(static_cast<uint64_t>(locked_at_ - start), std::memory_order_relaxed);
+	}
+	else {
+		locked_at_ = profile_now();
+	}
+	profile_->acquisitions_.fetch_add(1, std::memory_order_relaxed);
+	profiled_ = true;
+}
+
+void scoped_lock::unlock_profiled()
+{
+	profiled_ = false;
+	profile_->hold_time_.fetch_add(static_cast<uint64_t>(profile_now() - locked_at_), std::memory_order_relaxed);
+}
+
+class scoped_lock::profiled_wait final
+{
+public:
+	explicit profiled_wait(scoped_lock & l)
+		: l_(l)
+		, profiled_(l.profiled_)
+	{
+		if (profiled_) {
+			l_.unlock_profiled();
+		}
+	}
+
+	~profiled_wait()
+	{
+		if (profiled_) {
+			l_.profiled_ = true;
+			l_.locked_at_ = profile_now();
+		}
+	}
+
+	profiled_wait(profiled_wait const&) = delete;
+	profiled_wait& operator=(profiled_wait const&) = delete;
+
+private:
+	scoped_lock & l_;
+	bool const profiled_;
+};
+
+void enable_lock_profiling(bool enable)
+{
+	scoped_lock::profiling_ = enable;
+}
+
+bool lock_profiling_enabled()
+{
+	return scoped_lock::profiling_;
+}
+
+std::vector<lock_statistics> get_lock_statistics(size_t max)
+{
+	std::vector<lock_statistics> ret;
+
+	auto & profiles = get_lock_profiles();
+	{
+		scoped_lock l(profiles.m_);
+		for (auto const& profile : profiles.profiles_) {
+			lock_statistics stats;
+			stats.name = profile.first;
+			stats.acquisitions = profile.second->acquisitions_;
+			stats.contended = profile.second->contended_;
+			stats.wait_time = profile.second->wait_time_;
+			stats.hold_time = profile.second->hold_time_;
+			ret.push_back(std::move(stats));
+		}
+	}
+
+	std::stable_sort(ret.begin(), ret.end(), [](lock_statistics const& lhs, lock_statistics const& rhs) {
+		if (lhs.wait_time != rhs.wait_time) {
+			return lhs.wait_time > rhs.wait_time;
+		}
+		return lhs.contended > rhs.contended;
+	});
+	if (max && ret.size() > max) {
+		ret.resize(max);
+	}
+
+	return ret;
+}
+
+void reset_lock_statistics()
+{
+	auto & profiles = get_lock_profiles();
+	scoped_lock l(profiles.m_);
+	for (auto & profile : profiles.profiles_) {
+		profile.second->acquisitions_ = 0;
+		profile.second->contended_ = 0;
+		profile.second->wait_time_ = 0;
+		profile.second->hold_time_ = 0;
+	}
+}
+
 mutex::mutex(bool recursive)
+	: mutex(nullptr, recursive)
+{
+}
+
+mutex::mutex(char const* name, bool recursive)
+	: profile_(get_lock_profile(name))
 {
 #ifdef FZ_WINDOWS
 	(void)recursive; // Critical sections are always recursive
@@ -95,6 +347,68 @@ void mutex::unlock()
 }
 
 
+adaptive_mutex::adaptive_mutex()
+	: adaptive_mutex(nullptr)
+{
+}
+
+adaptive_mutex::adaptive_mutex(char const* name)
+	: profile_(get_lock_profile(name))
+{
+#ifdef FZ_WINDOWS
+	// Critical sections natively support spinning before waiting.
+	InitializeCriticalSectionEx(&m_, 4000, CRITICAL_SECTION_NO_DEBUG_INFO);
+#else
+	pthread_mutex_init(&m_, get_mutex_attributes(false));
+#endif
+}
+
+adaptive_mutex::~adaptive_mutex()
+{
+#ifdef FZ_WINDOWS
+	DeleteCriticalSection(&m_);
+#else
+	pthread_mutex_destroy(&m_);
+#endif
+}
+
+bool adaptive_mutex::try_lock()
+{
+#ifdef FZ_WINDOWS
+	return TryEnterCriticalSection(&m_) != 0;
+#else
+	return pthread_mutex_trylock(&m_) == 0;
+#endif
+}
+
+#ifndef FZ_WINDOWS
+void adaptive_mutex::lock_slow()
+{
+	if (multiprocessor) {
+		// Like glibc's adaptive mutexes: Spin up to twice the average number of spins
+		// it took in the past, plus a small constant.
+		// The estimate is read without holding the mutex, it is only a heuristic, relaxed ordering suffices.
+		int const spins = spins_.load(std::memory_order_relaxed);
+		int const limit = std::min(max_spins, spins * 2 + 10);
+		for (int i = 0; i < limit; ++i) {
+			cpu_relax();
+			if (!pthread_mutex_trylock(&m_)) {
+				// Updates happen with the mutex held, so they do not get lost
+				int const old = spins_.load(std::memory_order_relaxed);
+				spins_.store(old + (i - old) / 8, std::memory_order_relaxed);
+				return;
+			}
+		}
+		pthread_mutex_lock(&m_);
+		int const old = spins_.load(std::memory_order_relaxed);
+		spins_.store(old + (limit - old) / 8, std::memory_order_relaxed);
+	}
+	else {
+		pthread_mutex_lock(&m_);
+	}
+}
+#endif
+
 condition::condition()
 {
 #ifdef FZ_WINDOWS
@@ -117,6 +431,7 @@ condition::~condition()
 
 void condition::wait(scoped_lock& l)
 {
+	scoped_lock::profiled_wait w(l);
 	while (!signalled_) {
 #ifdef FZ_WINDOWS
 		SleepConditionVariableCS(&cond_, l.m_, INFINITE);
@@ -133,6 +448,8 @@ bool condition::wait(scoped_lock& l, duration const& timeout)
 		signalled_ = false;
 		return true;
 	}
+
+	scoped_lock::profiled_wait w(l);
 #ifdef FZ_WINDOWS
 	auto ms = timeout.get_milliseconds();
 	if (ms < 0) {
@@ -172,6 +489,33 @@ bool condition::wait(scoped_lock& l, duration const& timeout)
 }
 
 
+bool condition::wait_until(scoped_lock& l, monotonic_clock const& deadline)
+{
+	if (!signalled_) {
+		scoped_lock::profiled_wait w(l);
+#ifdef FZ_WINDOWS
+		while (!signalled_) {
+			DWORD const ms = remaining_ms(deadline.t_);
+			if (!ms || !SleepConditionVariableCS(&cond_, l.m_, ms)) {
+				break;
+			}
+		}
+#else
+		timespec const ts = to_timespec(deadline.t_);
+		while (!signalled_) {
+			int const res = pthread_cond_timedwait(&cond_, l.m_, &ts);
+			if (res && res != EINTR) {
+				break;
+			}
+		}
+#endif
+	}
+
+	bool const success = signalled_;
+	signalled_ = false;
+	return success;
+}
+
 void condition::signal(scoped_lock &)
 {
 	if (!signalled_) {
@@ -184,4 +528,83 @@ void condition::signal(scoped_lock &)
 	}
 }
 
+broadcast_condition::broadcast_condition()
+{
+#ifdef FZ_WINDOWS
+	InitializeConditionVariable(&cond_);
+#else
+	static pthread_condattr_t *attr = init_condattr();
+	pthread_cond_init(&cond_, attr);
+#endif
+}
+
+broadcast_condition::~broadcast_condition()
+{
+#ifndef FZ_WINDOWS
+	pthread_cond_destroy(&cond_);
+#endif
+}
+
+void broadcast_condition::wait(scoped_lock& l)
+{
+	scoped_lock::profiled_wait w(l);
+#ifdef FZ_WINDOWS
+	SleepConditionVariableCS(&cond_, l.m_, INFINITE);
+#else
+	pthread_cond_wait(&cond_, l.m_);
+#endif
+}
+
+bool broadcast_condition::wait_until(scoped_lock& l, monotonic_clock const& deadline)
+{
+	scoped_lock::profiled_wait w(l);
+#ifdef FZ_WINDOWS
+	DWORD const ms = remaining_ms(deadline.t_);
+	return ms && SleepConditionVariableCS(&cond_, l.m_, ms);
+#else
+	timespec const ts = to_timespec(deadline.t_);
+	int res;
+	do {
+		res = pthread_cond_timedwait(&cond_, l.m_, &ts);
+	}
+	while (res == EINTR);
+	return res == 0;
+#endif
+}
+
+void broadcast_condition::signal(scoped_lock &)
+{
+#ifdef FZ_WINDOWS
+	WakeConditionVariable(&cond_);
+#else
+	pthread_cond_signal(&cond_);
+#endif
+}
+
+void broadcast_condition::broadcast(scoped_lock &)
+{
+#ifdef FZ_WINDOWS
+	WakeAllConditionVariable(&cond_);
+#else
+	pthread_cond_broadcast(&cond_);
+#endif
+}
+
+rwlock::rwlock()
+{
+#ifdef FZ_WINDOWS
+	InitializeSRWLock(&l_);
+#else
+	static pthread_rwlockattr_t *attr = init_rwlockattr();
+	pthread_rwlock_init(&l_, attr);
+#endif
+}
+
+rwlock::~rwlock()
+{
+#ifndef FZ_WINDOWS
+	pthread_rwlock_destroy(&l_);
+#endif
+}
+
 }
@@ -0,0 +1,190 @@
+#include "libfilezilla/parallel_read.hpp"
+#include "libfilezilla/aligned_buffer.hpp"
+#include "libfilezilla/file.hpp"
+#include "libfilezilla/thread_pool.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <map>
+
+namespace fz {
+
+namespace {
+// Reads the segment completely, returns false on error or if the file is shorter than expected.
+bool read_segment(file & f, uint8_t* buf, size_t size, int64_t offset)
+{
+	size_t done{};
+	while (done < size) {
+		int64_t const r = f.read_at(buf + done, static_cast<int64_t>(size - done), offset + static_cast<int64_t>(done));
+		if (r <= 0) {
+			return false;
+		}
+		done += static_cast<size_t>(r);
+	}
+	return true;
+}
+
+struct segment final
+{
+	aligned_buffer buffer;
+	size_t size{};
+};
+}
+
+int64_t read_segments(file & f, thread_pool & pool, segment_consumer const& consumer, int64_t offset, int64_t length, parallel_read_options const& options)
+{
+	if (!f.opened() || !consumer || offset < 0 || !options.segment_size) {
+		return -1;
+	}
+
+	int64_t const size = f.size();
+	if (size < 0) {
+		return -1;
+	}
+	if (offset >= size) {
+		return 0;
+	}
+	if (length < 0 || length > size - offset) {
+		length = size - offset;
+	}
+	if (!length) {
+		return 0;
+	}
+
+	int64_t const segment_size = static_cast<int64_t>(options.segment_size);
+	size_t const segments = static_cast<size_t>((length + segment_size - 1) / segment_size);
+	size_t const parallel = std::min(std::max(options.parallel, size_t(1)), segments);
+
+	auto const segment_length = [&](size_t i) {
+		return static_cast<size_t>(std::min(segment_size, length - static_cast<int64_t>(i) * segment_size));
+	};
+
+	// How far the readers may get ahead of the consumer when delivering in order
+	size_t const window = parallel * 2;
+
+	// Keep every buffer that can be in use at the same time, fresh buffers are expensive to fault in.
+	aligned_buffer_pool buffers(options.segment_size, aligned_buffer::default_alignment, window + 1);
+
+	std::atomic<size_t> next{};
+	std::atomic<bool> failed{};
+
+	// Readers still queued in the pool when done get cancelled, so that waiting for them cannot block.
+	cancellation_token token;
+	std::vector<async_task> tasks;
+
+	if (!options.in_order) {
+		auto const worker = [&]() {
+			aligned_buffer buf = buffers.get();
+			if (!buf) {
+				failed = true;
+				return;
+			}
+			size_t i;
+			while (!failed && (i = next++) < segments) {
+				int64_t const pos = offset + static_cast<int64_t>(i) * segment_size;
+				size_t const len = segment_length(i);
+				if (!read_segment(f, buf.data(), len, pos) || !consumer(buf.data(), len, pos)) {
+					failed = true;
+				}
+			}
+		};
+
+		for (size_t i = 1; i < parallel; ++i) {
+			tasks.emplace_back(pool.spawn(worker, thread_pool::normal, token));
+		}
+		// The calling thread also does its share of the work
+		worker();
+		token.cancel();
+		tasks.clear();
+
+		return failed ? -1 : length;
+	}
+
+	// Segments that have been read, but not yet delivered, keyed by index
+	mutex m(false);
+	broadcast_condition cond;
+	std::map<size_t, segment> ready;
+	size_t delivered{};
+
+	auto const worker = [&]() {
+		while (true) {
+			size_t i;
+			{
+				scoped_lock l(m);
+				cond.wait(l, [&]() { return failed || next >= segments || next < delivered + window; });
+				if (failed || next >= segments) {
+					return;
+				}
+				i = next++;
+			}
+
+			segment s;
+			s.buffer = buffers.get();
+			s.size = segment_length(i);
+			bool const ok = s.buffer && read_segment(f, s.buffer.data(), s.size, offset + static_cast<int64_t>(i) * segment_size);
+
+			scoped_lock l(m);
+			if (!ok) {
+				failed = true;
+			}
+			else {
+				ready[i] = std::move(s);
+			}
+			cond.broadcast(l);
+		}
+	};
+
+	for (size_t i = 0; i < parallel; ++i) {
+		tasks.emplace_back(pool.spawn(worker, thread_pool::normal, token));
+	}
+
+	for (size_t i = 0; i < segments; ++i) {
+		segment s;
+		bool claimed{};
+		{
+			scoped_lock l(m);
+			// If no reader has claimed the segment yet, e.g. because the pool could not start them, read it here.
+			cond.wait(l, [&]() { return failed || ready.count(i) || next == i; });
+			if (failed) {
+				break;
+			}
+			auto it = ready.find(i);
+			if (it != ready.end()) {
+				s = std::move(it->second);
+				ready.erase(it);
+			}
+			else {
+				++next;
+				claimed = true;
+			}
+			++delivered;
+			cond.broadcast(l);
+		}
+
+		if (claimed) {
+			s.buffer = buffers.get();
+			s.size = segment_length(i);
+			if (!s.buffer || !read_segment(f, s.buffer.data(), s.size, offset + static_cast<int64_t>(i) * segment_size)) {
+				scoped_lock l(m);
+				failed = true;
+				cond.broadcast(l);
+				break;
+			}
+		}
+
+		if (!consumer(s.buffer.data(), s.size, offset + static_cast<int64_t>(i) * segment_size)) {
+			scoped_lock l(m);
+			failed = true;
+			cond.broadcast(l);
+			break;
+		}
+		buffers.release(std::move(s.buffer));
+	}
+
+	token.cancel();
+	tasks.clear();
+
+	return failed ? -1 : length;
+}
+
+}
@@ -0,0 +1,224 @@
+#include "libfilezilla/rate_limiter.hpp"
+#include "libfilezilla/file.hpp"
+#include "libfilezilla/process.hpp"
+#include "libfilezilla/util.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <limits>
+
+namespace fz {
+
+namespace {
+int64_t now_ns()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+int64_t const ns_per_second = 1000000000;
+
+// How often to check buckets that block all transfers
+duration const blocked_poll_interval = duration::from_seconds(1);
+}
+
+int64_t const token_bucket::unlimited;
+
+token_bucket::token_bucket(int64_t rate, int64_t burst, token_bucket* parent)
+	: parent_(parent)
+	, rate_(rate)
+	, burst_(burst > 0 ? burst : std::max(rate, int64_t(0)))
+	, tokens_(burst_.load())
+	, last_refill_(now_ns())
+{
+}
+
+void token_bucket::set_limit(int64_t rate, int64_t burst)
+{
+	if (burst <= 0) {
+		burst = std::max(rate, int64_t(0));
+	}
+	refill(now_ns());
+	burst_.store(burst, std::memory_order_relaxed);
+	rate_.store(rate, std::memory_order_relaxed);
+
+	// Drop excess tokens
+	int64_t tokens = tokens_.load(std::memory_order_relaxed);
+	while (tokens > burst && !tokens_.compare_exchange_weak(tokens, burst, std::memory_order_relaxed)) {
+	}
+}
+
+void token_bucket::refill(int64_t now)
+{
+	int64_t const rate = rate_.load(std::memory_order_relaxed);
+	int64_t last = last_refill_.load(std::memory_order_relaxed);
+	int64_t const elapsed = now - last;
+	if (elapsed <= 0) {
+		return;
+	}
+	if (rate <= 0) {
+		// Nothing to add, just keep the clock current for when a limit is set
+		last_refill_.compare_exchange_strong(last, now, std::memory_order_relaxed);
+		return;
+	}
+
+	int64_t const burst = burst_.load(std::memory_order_relaxed);
+	double const earned = static_cast<double>(elapsed) * static_cast<double>(rate) / ns_per_second;
+
+	int64_t add;
+	int64_t next;
+	if (earned >= static_cast<double>(burst)) {
+		add = burst;
+		next = now;
+	}
+	else {
+		add = static_cast<int64_t>(earned);
+		if (!add) {
+			return;
+		}
+		// Only account for the time the added tokens correspond to, so that fractions are not lost.
+		next = last + static_cast<int64_t>(static_cast<double>(add) * ns_per_second / static_cast<double>(rate));
+	}
+
+	// Whoever wins the race does the refill
+	if (!last_refill_.compare_exchange_strong(last, next, std::memory_order_relaxed)) {
+		return;
+	}
+
+	int64_t tokens = tokens_.load(std::memory_order_relaxed);
+	while (tokens < burst && !tokens_.compare_exchange_weak(tokens, std::min(tokens + add, burst), std::memory_order_relaxed)) {
+	}
+}
+
+int64_t token_bucket::consume(int64_t max)
+{
+	if (max <= 0) {
+		return 0;
+	}
+
+	int64_t const now = now_ns();
+
+	int64_t amount = max;
+	for (token_bucket* b = this; b; b = b->parent_) {
+		if (b->rate() == unlimited) {
+			continue;
+		}
+		b->refill(now);
+		amount = std::min(amount, b->tokens_.load(std::memory_order_relaxed));
+	}
+	if (amount <= 0) {
+		return 0;
+	}
+
+	for (token_bucket* b = this; b; b = b->parent_) {
+		if (b->rate() != unlimited) {
+			b->tokens_.fetch_sub(amount, std::memory_order_relaxed);
+		}
+	}
+
+	return amount;
+}
+
+void token_bucket::refund(int64_t tokens)
+{
+	if (tokens <= 0) {
+		return;
+	}
+	for (token_bucket* b = this; b; b = b->parent_) {
+		if (b->rate() != unlimited) {
+			b->tokens_.fetch_add(tokens, std::memory_order_relaxed);
+		}
+	}
+}
+
+int64_t token_bucket::available()
+{
+	int64_t const now = now_ns();
+
+	int64_t ret = std::numeric_limits<int64_t>::max();
+	for (token_bucket* b = this; b; b = b->parent_) {
+		if (b->rate() == unlimited) {
+			continue;
+		}
+		b->refill(now);
+		ret = std::min(ret, b->tokens_.load(std::memory_order_relaxed));
+	}
+	return std::max(ret, int64_t(0));
+}
+
+duration token_bucket::wait_time(int64_t tokens)
+{
+	int64_t const now = now_ns();
+
+	int64_t wait_ns{};
+	for (token_bucket* b = this; b; b = b->parent_) {
+		int64_t const rate = b->rate();
+		if (rate == unlimited) {
+			continue;
+		}
+		if (!rate) {
+			return blocked_poll_interval;
+		}
+
+		b->refill(now);
+		int64_t const needed = std::min(tokens, std::max(b->burst_.load(std::memory_order_relaxed), int64_t(1)));
+		int64_t const deficit = needed - b->tokens_.load(std::memory_order_relaxed);
+		if (deficit > 0) {
+			// Refills are measured from the last refill, not from now
+			int64_t const since_refill = now - b->last_refill_.load(std::memory_order_relaxed);
+			int64_t const ns = static_cast<int64_t>(static_cast<double>(deficit) * ns_per_second / static_cast<double>(rate)) - since_refill;
+			wait_ns = std::max(wait_ns, ns);
+		}
+	}
+
+	if (wait_ns <= 0) {
+		return duration();
+	}
+	// Round up, the timer resolution is one millisecond
+	return duration::from_milliseconds((wait_ns + 999999) / 1000000);
+}
+
+timer_id token_bucket::wait(event_handler & h, int64_t tokens)
+{
+	duration d = wait_time(tokens);
+	if (!d) {
+		d = duration::from_milliseconds(1);
+	}
+	return h.add_timer(d, true);
+}
+
+rate_limited_reader::rate_limited_reader(file & f, token_bucket & bucket)
+	: file_(&f)
+	, bucket_(bucket)
+{
+}
+
+rate_limited_reader::rate_limited_reader(process & p, token_bucket & bucket)
+	: process_(&p)
+	, bucket_(bucket)
+{
+}
+
+int64_t rate_limited_reader::read(void *buf, int64_t count)
+{
+	if (count <= 0) {
+		return count ? -1 : 0;
+	}
+
+	int64_t allowed;
+	while (!(allowed = bucket_.consume(count))) {
+		sleep(std::max(bucket_.wait_time(std::min(count, int64_t(1024 * 1024))), duration::from_milliseconds(1)));
+	}
+
+	int64_t r;
+	if (file_) {
+		r = file_->read(buf, allowed);
+	}
+	else {
+		r = process_->read(static_cast<char*>(buf), static_cast<unsigned int>(std::min(allowed, int64_t(std::numeric_limits<int>::max()))));
+	}
+
+	bucket_.refund(allowed - std::max(r, int64_t(0)));
+	return r;
+}
+
+}
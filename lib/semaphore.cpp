@@ -0,0 +1,186 @@
+#include "libfilezilla/semaphore.hpp"
+
+#include <climits>
+
+#if HAVE_LINUX_FUTEX_H
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#else
+#include "libfilezilla/mutex.hpp"
+
+#include <cstdint>
+#endif
+
+namespace fz {
+
+namespace {
+#if HAVE_LINUX_FUTEX_H
+int* futex_addr(std::atomic<int> & v)
+{
+	static_assert(sizeof(std::atomic<int>) == sizeof(int), "std::atomic<int> cannot be used as futex");
+	return reinterpret_cast<int*>(&v);
+}
+
+// Sleeps if the value equals expected, until woken or until the deadline.
+// May return spuriously, returns false only if the deadline has been reached.
+bool wait_on(std::atomic<int> & v, int expected, monotonic_clock const* deadline)
+{
+	timespec ts;
+	timespec * timeout{};
+	if (deadline) {
+		auto const now = monotonic_clock::now();
+		if (now >= *deadline) {
+			return false;
+		}
+		int64_t ms = (*deadline - now).get_milliseconds();
+		if (ms < 1) {
+			ms = 1;
+		}
+		ts.tv_sec = static_cast<time_t>(ms / 1000);
+		ts.tv_nsec = static_cast<long>(ms % 1000) * 1000000;
+		timeout = &ts;
+	}
+	syscall(SYS_futex, futex_addr(v), FUTEX_WAIT_PRIVATE, expected, timeout, nullptr, 0);
+	return true;
+}
+
+void wake(std::atomic<int> & v, int n)
+{
+	syscall(SYS_futex, futex_addr(v), FUTEX_WAKE_PRIVATE, n, nullptr, nullptr, 0);
+}
+#else
+// Without futexes, waiters park on one of a fixed number of conditions, chosen by address.
+struct bucket final
+{
+	mutex m_{false};
+	broadcast_condition cond_;
+};
+
+size_t const bucket_count = 64;
+
+bucket& get_bucket(std::atomic<int> const& v)
+{
+	static bucket buckets[bucket_count];
+	return buckets[(reinterpret_cast<uintptr_t>(&v) / sizeof(int)) % bucket_count];
+}
+
+bool wait_on(std::atomic<int> & v, int expected, monotonic_clock const* deadline)
+{
+	auto & b = get_bucket(v);
+	scoped_lock l(b.m_);
+	if (v.load() != expected) {
+		return true;
+	}
+	if (deadline) {
+		if (monotonic_clock::now() >= *deadline) {
+			return false;
+		}
+		b.cond_.wait_until(l, *deadline);
+	}
+	else {
+		b.cond_.wait(l);
+	}
+	return true;
+}
+
+void wake(std::atomic<int> & v, int)
+{
+	// Buckets are shared, wake everyone
+	auto & b = get_bucket(v);
+	scoped_lock l(b.m_);
+	b.cond_.broadcast(l);
+}
+#endif
+
+int const wake_everyone = INT_MAX;
+}
+
+bool semaphore::acquire(duration const& timeout)
+{
+	if (try_acquire()) {
+		return true;
+	}
+	auto const deadline = monotonic_clock::now() + timeout;
+	return acquire_slow(&deadline);
+}
+
+bool semaphore::acquire_until(monotonic_clock const& deadline)
+{
+	return try_acquire() || acquire_slow(&deadline);
+}
+
+bool semaphore::acquire_slow(monotonic_clock const* deadline)
+{
+	++waiters_;
+	bool ret = true;
+	while (!try_acquire()) {
+		if (!wait_on(count_, 0, deadline)) {
+			ret = try_acquire();
+			break;
+		}
+	}
+	--waiters_;
+	return ret;
+}
+
+void semaphore::wake(int n)
+{
+	fz::wake(count_, n);
+}
+
+bool latch::wait_until(monotonic_clock const& deadline)
+{
+	return try_wait() || wait_slow(&deadline);
+}
+
+bool latch::wait_slow(monotonic_clock const* deadline)
+{
+	++waiters_;
+	bool ret = true;
+	int c;
+	while ((c = count_.load())) {
+		if (!wait_on(count_, c, deadline)) {
+			ret = try_wait();
+			break;
+		}
+	}
+	--waiters_;
+	return ret;
+}
+
+void latch::wake_all()
+{
+	wake(count_, wake_everyone);
+}
+
+barrier::barrier(int count, std::function<void()> const& completion)
+	: count_(count)
+	, completion_(completion)
+{
+}
+
+void barrier::arrive_and_wait()
+{
+	int const phase = phase_.load(std::memory_order_acquire);
+	if (arrived_.fetch_add(1, std::memory_order_acq_rel) + 1 == count_) {
+		if (completion_) {
+			completion_();
+		}
+		arrived_.store(0, std::memory_order_relaxed);
+		phase_.fetch_add(1);
+		if (waiters_.load()) {
+			wake(phase_, wake_everyone);
+		}
+		return;
+	}
+
+	++waiters_;
+	while (phase_.load() == phase) {
+		wait_on(phase_, phase, nullptr);
+	}
+	--waiters_;
+}
+
+}
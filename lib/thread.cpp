@@ -1,7 +1,11 @@
 #include "libfilezilla/thread.hpp"
 #include "libfilezilla/mutex.hpp"
 
+#include <algorithm>
 #include <cstdlib>
+#include <fstream>
+#include <map>
+#include <string>
 #include <thread>
 
 #if defined(FZ_WINDOWS) && (defined(__MINGW32__) || defined(__MINGW64__))
@@ -9,8 +13,225 @@
 #include <process.h>
 #endif
 
+#ifdef FZ_WINDOWS
+#include "libfilezilla/private/windows.hpp"
+#else
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#if !defined(FZ_WINDOWS) && HAVE_PTHREAD_SETAFFINITY_NP && HAVE_PTHREAD_GETAFFINITY_NP && defined(CPU_SETSIZE)
+#define USE_PTHREAD_AFFINITY 1
+#endif
+
 namespace fz {
 
+namespace {
+#ifdef FZ_WINDOWS
+typedef HANDLE native_thread_handle;
+
+bool apply_affinity(HANDLE h, std::vector<int> const& cpus)
+{
+	DWORD_PTR mask{};
+	if (cpus.empty()) {
+		DWORD_PTR system_mask{};
+		if (!GetProcessAffinityMask(GetCurrentProcess(), &mask, &system_mask)) {
+			return false;
+		}
+	}
+	else {
+		for (int cpu : cpus) {
+			if (cpu < 0 || cpu >= static_cast<int>(sizeof(DWORD_PTR) * 8)) {
+				return false;
+			}
+			mask |= static_cast<DWORD_PTR>(1) << cpu;
+		}
+	}
+	return SetThreadAffinityMask(h, mask) != 0;
+}
+
+std::vector<int> query_affinity(HANDLE h)
+{
+	std::vector<int> ret;
+
+	// There is no GetThreadAffinityMask, set the process mask and restore the old value.
+	DWORD_PTR process_mask{};
+	DWORD_PTR system_mask{};
+	if (GetProcessAffinityMask(GetCurrentProcess(), &process_mask, &system_mask)) {
+		DWORD_PTR const old = SetThreadAffinityMask(h, process_mask);
+		if (old) {
+			SetThreadAffinityMask(h, old);
+			for (int cpu = 0; cpu < static_cast<int>(sizeof(DWORD_PTR) * 8); ++cpu) {
+				if (old & (static_cast<DWORD_PTR>(1) << cpu)) {
+					ret.push_back(cpu);
+				}
+			}
+		}
+	}
+	return ret;
+}
+#elif USE_PTHREAD_AFFINITY
+typedef pthread_t native_thread_handle;
+
+bool apply_affinity(pthread_t h, std::vector<int> const& cpus)
+{
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	if (cpus.empty()) {
+		// The kernel masks out processors that do not exist
+		for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+			CPU_SET(cpu, &set);
+		}
+	}
+	else {
+		for (int cpu : cpus) {
+			if (cpu < 0 || cpu >= CPU_SETSIZE) {
+				return false;
+			}
+			CPU_SET(cpu, &set);
+		}
+	}
+	return pthread_setaffinity_np(h, sizeof(set), &set) == 0;
+}
+
+std::vector<int> query_affinity(pthread_t h)
+{
+	std::vector<int> ret;
+
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	if (!pthread_getaffinity_np(h, sizeof(set), &set)) {
+		for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+			if (CPU_ISSET(cpu, &set)) {
+				ret.push_back(cpu);
+			}
+		}
+	}
+	return ret;
+}
+#endif
+
+#ifdef FZ_UNIX
+// Parses cpulist strings as found in sysfs, e.g. "0-3,8,10-11"
+std::vector<int> parse_cpulist(std::string const& list)
+{
+	std::vector<int> ret;
+
+	size_t pos = 0;
+	while (pos < list.size()) {
+		size_t end = list.find(',', pos);
+		if (end == std::string::npos) {
+			end = list.size();
+		}
+		std::string const token = list.substr(pos, end - pos);
+		pos = end + 1;
+
+		size_t const dash = token.find('-');
+		int const first = std::atoi(token.c_str());
+		int const last = (dash == std::string::npos) ? first : std::atoi(token.c_str() + dash + 1);
+		if (token.empty() || first < 0 || last < first) {
+			continue;
+		}
+		for (int cpu = first; cpu <= last; ++cpu) {
+			ret.push_back(cpu);
+		}
+	}
+
+	return ret;
+}
+#endif
+
+std::vector<std::vector<int>> load_numa_nodes()
+{
+	std::vector<std::vector<int>> nodes;
+
+#ifdef FZ_WINDOWS
+	ULONG highest{};
+	if (GetNumaHighestNodeNumber(&highest)) {
+		for (ULONG node = 0; node <= highest; ++node) {
+			ULONGLONG mask{};
+			if (!GetNumaNodeProcessorMask(static_cast<UCHAR>(node), &mask)) {
+				continue;
+			}
+			std::vector<int> cpus;
+			for (int cpu = 0; cpu < 64; ++cpu) {
+				if (mask & (1ull << cpu)) {
+					cpus.push_back(cpu);
+				}
+			}
+			if (!cpus.empty()) {
+				nodes.emplace_back(std::move(cpus));
+			}
+		}
+	}
+#elif defined(FZ_UNIX)
+	// Node numbers can be sparse, tolerate a few gaps.
+	int misses = 0;
+	for (int node = 0; misses < 8; ++node) {
+		std::ifstream f("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+		std::string list;
+		if (!f || !std::getline(f, list)) {
+			++misses;
+			continue;
+		}
+		misses = 0;
+		auto cpus = parse_cpulist(list);
+		if (!cpus.empty()) {
+			nodes.emplace_back(std::move(cpus));
+		}
+	}
+#endif
+
+	if (nodes.empty()) {
+		std::vector<int> cpus;
+		int const count = std::max(1u, std::thread::hardware_concurrency());
+		for (int cpu = 0; cpu < count; ++cpu) {
+			cpus.push_back(cpu);
+		}
+		nodes.emplace_back(std::move(cpus));
+	}
+
+	return nodes;
+}
+
+// Affinities passed to thread::set_affinity, kept outside of the thread objects so that their
+// layout stays unchanged. Needed to apply the affinity once a thread starts.
+struct stored_affinities final
+{
+	mutex m_{false};
+	std::map<thread const*, std::vector<int>> sets_;
+};
+
+stored_affinities& get_stored_affinities()
+{
+	static stored_affinities affinities;
+	return affinities;
+}
+
+void store_affinity(thread const* t, std::vector<int> const& cpus)
+{
+	auto & affinities = get_stored_affinities();
+	scoped_lock l(affinities.m_);
+	if (cpus.empty()) {
+		affinities.sets_.erase(t);
+	}
+	else {
+		affinities.sets_[t] = cpus;
+	}
+}
+
+std::vector<int> stored_affinity(thread const* t)
+{
+	auto & affinities = get_stored_affinities();
+	scoped_lock l(affinities.m_);
+	auto it = affinities.sets_.find(t);
+	if (it != affinities.sets_.end()) {
+		return it->second;
+	}
+	return std::vector<int>();
+}
+}
+
 thread::thread()
 {
 }
@@ -59,6 +280,8 @@ public:
 	mutex m_{false};
 
 	virtual void entry();
+
+	native_thread_handle native_handle() { return handle_; }
 };
 
 thread::impl::impl(thread& t)
@@ -71,6 +294,10 @@ void thread::impl::entry()
 	{
 		// Obtain mutex once. Once we have it, handle_ is assigned.
 		scoped_lock l(m_);
+		std::vector<int> const cpus = stored_affinity(&t_);
+		if (!cpus.empty()) {
+			set_current_thread_affinity(cpus);
+		}
 	}
 	t_.entry();
 }
@@ -120,6 +347,10 @@ public:
 	mutex m_{false};
 
 	static void entry(thread & t);
+
+#if defined(FZ_WINDOWS) || USE_PTHREAD_AFFINITY
+	native_thread_handle native_handle() { return t_.native_handle(); }
+#endif
 };
 
 
@@ -132,6 +363,10 @@ void thread::impl::entry(thread& t)
 	{
 		// Obtain mutex once. Once we have it, t.impl_->t_ is assigned.
 		scoped_lock l(t.impl_->m_);
+		std::vector<int> const cpus = stored_affinity(&t);
+		if (!cpus.empty()) {
+			set_current_thread_affinity(cpus);
+		}
 	}
 
 	t.entry();
@@ -175,6 +410,90 @@ thread::~thread()
 		std::abort();
 	}
 	delete impl_;
+	store_affinity(this, std::vector<int>());
+}
+
+bool thread::set_affinity(std::vector<int> const& cpus)
+{
+#if defined(FZ_WINDOWS) || USE_PTHREAD_AFFINITY
+	if (!impl_) {
+		store_affinity(this, cpus);
+		return true;
+	}
+
+	scoped_lock l(impl_->m_);
+	if (!apply_affinity(impl_->native_handle(), cpus)) {
+		return false;
+	}
+	store_affinity(this, cpus);
+	return true;
+#else
+	(void)cpus;
+	return false;
+#endif
+}
+
+std::vector<int> thread::affinity() const
+{
+#if defined(FZ_WINDOWS) || USE_PTHREAD_AFFINITY
+	if (impl_) {
+		scoped_lock l(impl_->m_);
+		return query_affinity(impl_->native_handle());
+	}
+#endif
+	return stored_affinity(this);
+}
+
+int current_cpu()
+{
+#ifdef FZ_WINDOWS
+	return static_cast<int>(GetCurrentProcessorNumber());
+#elif HAVE_SCHED_GETCPU
+	return sched_getcpu();
+#else
+	return -1;
+#endif
+}
+
+std::vector<std::vector<int>> numa_nodes()
+{
+	// The topology does not change during the lifetime of the process
+	static std::vector<std::vector<int>> const nodes = load_numa_nodes();
+	return nodes;
+}
+
+int numa_node_of_cpu(int cpu)
+{
+	static std::vector<std::vector<int>> const nodes = numa_nodes();
+	for (size_t i = 0; i < nodes.size(); ++i) {
+		if (std::find(nodes[i].cbegin(), nodes[i].cend(), cpu) != nodes[i].cend()) {
+			return static_cast<int>(i);
+		}
+	}
+	return 0;
+}
+
+bool set_current_thread_affinity(std::vector<int> const& cpus)
+{
+#ifdef FZ_WINDOWS
+	return apply_affinity(GetCurrentThread(), cpus);
+#elif USE_PTHREAD_AFFINITY
+	return apply_affinity(pthread_self(), cpus);
+#else
+	(void)cpus;
+	return false;
+#endif
+}
+
+std::vector<int> current_thread_affinity()
+{
+#ifdef FZ_WINDOWS
+	return query_affinity(GetCurrentThread());
+#elif USE_PTHREAD_AFFINITY
+	return query_affinity(pthread_self());
+#else
+	return std::vector<int>();
+#endif
 }
 
 }
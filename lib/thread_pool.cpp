@@ -1,17 +1,72 @@
 #include "libfilezilla/thread_pool.hpp"
 #include "libfilezilla/thread.hpp"
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+
 #include <assert.h>
 
 namespace fz {
 
+namespace {
+typedef std::chrono::steady_clock clock_type;
+
+void add_sample(thread_pool::histogram & h, clock_type::duration const& d)
+{
+	auto us = std::chrono::duration_cast<std::chrono::microseconds>(d).count();
+	size_t bucket = 0;
+	while (us > 1 && bucket + 1 < h.size()) {
+		us >>= 1;
+		++bucket;
+	}
+	++h[bucket];
+}
+}
+
+class cancellation_state final
+{
+public:
+	std::atomic<bool> cancelled_{};
+
+	// Recursive, destroying the functions of cancelled tasks may spawn or cancel further tasks.
+	mutex m_;
+
+	std::vector<thread_pool*> pools_;
+};
+
+class async_task_impl final
+{
+public:
+	async_task_impl(thread_pool & pool, std::function<void()> const& f, std::shared_ptr<cancellation_state> const& token)
+		: f_(f)
+		, token_(token)
+		, pool_(pool)
+	{}
+
+	bool cancelled() const {
+		return token_ && token_->cancelled_;
+	}
+
+	std::function<void()> f_;
+	std::shared_ptr<cancellation_state> token_;
+	thread_pool & pool_;
+
+	clock_type::time_point spawned_{clock_type::now()};
+
+	// Members below are protected by the pool's mutex
+	condition cond_;
+	bool done_{};
+	bool detached_{};
+};
+
 class pooled_thread_impl final : public thread
 {
 public:
-	pooled_thread_impl(thread_pool & pool)
+	pooled_thread_impl(thread_pool & pool, size_t node)
 		: m_(pool.m_)
 		, pool_(pool)
-	    , detached_()
+		, node_(node)
 	{}
 
 	virtual ~pooled_thread_impl()
@@ -22,19 +77,38 @@ public:
 	virtual void entry() {
 		scoped_lock l(m_);
 		while (!quit_) {
-			thread_cond_.wait(l);
-
-			if (f_) {
-				l.unlock();
-				f_();
-				l.lock();
-				if (detached_) {
-					f_ = std::function<void()>();
-					pool_.idle_.push_back(this);
+			if (!task_) {
+				if (pool_.idle_timeout_) {
+					if (!thread_cond_.wait(l, pool_.idle_timeout_) && pool_.reap(this, l)) {
+						return;
+					}
 				}
 				else {
-					task_cond_.signal(l);
+					thread_cond_.wait(l);
 				}
+				continue;
+			}
+
+			async_task_impl* task = task_;
+			if (!task->cancelled()) {
+				auto const start = clock_type::now();
+				l.unlock();
+				task->f_();
+				task->f_ = std::function<void()>();
+				l.lock();
+				pool_.record(task->spawned_, start);
+			}
+			else {
+				l.unlock();
+				task->f_ = std::function<void()>();
+				l.lock();
+				++pool_.stats_.tasks_cancelled;
+			}
+			pool_.finish(task, l);
+
+			task_ = pool_.dequeue(node_);
+			if (!task_) {
+				pool_.make_idle(this);
 			}
 		}
 	}
@@ -45,13 +119,15 @@ public:
 		thread_cond_.signal(l);
 	}
 
-	std::function<void()> f_{};
 	mutex & m_;
 	condition thread_cond_;
-	condition task_cond_;
 	thread_pool& pool_;
 
-	bool detached_{};
+	// The task the thread is running, protected by m_
+	async_task_impl* task_{};
+
+	// Index of the NUMA node the thread is pinned to, protected by m_
+	size_t node_{};
 private:
 	bool quit_{};
 };
@@ -76,10 +152,13 @@ async_task::~async_task()
 void async_task::join()
 {
 	if (impl_) {
-		scoped_lock l(impl_->m_);
-		impl_->task_cond_.wait(l);
-		impl_->f_ = std::function<void()>();
-		impl_->pool_.idle_.push_back(impl_);
+		{
+			scoped_lock l(impl_->pool_.m_);
+			while (!impl_->done_) {
+				impl_->cond_.wait(l);
+			}
+		}
+		delete impl_;
 		impl_ = 0;
 	}
 }
@@ -87,26 +166,73 @@ void async_task::join()
 void async_task::detach()
 {
 	if (impl_) {
-		scoped_lock l(impl_->m_);
-		if (impl_->task_cond_.signalled(l)) {
-			join();
+		scoped_lock l(impl_->pool_.m_);
+		if (impl_->done_) {
+			l.unlock();
+			delete impl_;
 		}
 		else {
 			impl_->detached_ = true;
-			impl_ = 0;
 		}
+		impl_ = 0;
 	}
 }
 
+cancellation_token::cancellation_token()
+	: state_(std::make_shared<cancellation_state>())
+{
+}
+
+void cancellation_token::cancel()
+{
+	state_->cancelled_ = true;
+
+	scoped_lock l(state_->m_);
+	for (auto pool : state_->pools_) {
+		pool->purge_cancelled();
+	}
+}
+
+bool cancellation_token::cancelled() const
+{
+	return state_->cancelled_;
+}
+
 thread_pool::thread_pool()
+	: idle_(1)
+	, queues_(1)
 {
 }
 
 thread_pool::~thread_pool()
 {
+	std::vector<std::shared_ptr<cancellation_state>> tokens;
+	{
+		scoped_lock l(m_);
+		tokens.swap(tokens_);
+	}
+	for (auto const& token : tokens) {
+		scoped_lock l(token->m_);
+		token->pools_.erase(std::remove(token->pools_.begin(), token->pools_.end(), this), token->pools_.end());
+	}
+
 	std::vector<pooled_thread_impl*> threads;
+	std::vector<std::function<void()>> garbage;
 	{
 		scoped_lock l(m_);
+
+		// Tasks which have not started yet are never going to run
+		for (auto & node : queues_) {
+			for (auto & queue : node) {
+				for (auto task : queue) {
+					garbage.emplace_back(std::move(task->f_));
+					task->f_ = std::function<void()>();
+					finish(task, l);
+				}
+				queue.clear();
+			}
+		}
+
 		for (auto thread : threads_) {
 			thread->quit(l);
 		}
@@ -116,33 +242,357 @@ thread_pool::~thread_pool()
 	for (auto thread : threads) {
 		delete thread;
 	}
+
+	scoped_lock l(m_);
+	for (auto thread : reaped_) {
+		delete thread;
+	}
+	reaped_.clear();
 }
 
 async_task thread_pool::spawn(std::function<void()> const& f)
+{
+	return do_spawn(f, normal, std::shared_ptr<cancellation_state>());
+}
+
+async_task thread_pool::spawn(std::function<void()> const& f, priority p)
+{
+	return do_spawn(f, p, std::shared_ptr<cancellation_state>());
+}
+
+async_task thread_pool::spawn(std::function<void()> const& f, priority p, cancellation_token const& token)
+{
+	{
+		scoped_lock l(token.state_->m_);
+		auto & pools = token.state_->pools_;
+		if (std::find(pools.cbegin(), pools.cend(), this) == pools.cend()) {
+			pools.push_back(this);
+		}
+	}
+
+	return do_spawn(f, p, token.state_);
+}
+
+async_task thread_pool::do_spawn(std::function<void()> const& f, priority p, std::shared_ptr<cancellation_state> const& token)
 {
 	async_task ret;
 
+	if (p < low || p > high) {
+		p = normal;
+	}
+
 	scoped_lock l(m_);
 
+	// Reaped threads have left their entry function, joining them does not block for long.
+	for (auto thread : reaped_) {
+		delete thread;
+	}
+	reaped_.clear();
+
+	if (token) {
+		if (std::find(tokens_.cbegin(), tokens_.cend(), token) == tokens_.cend()) {
+			if (tokens_.size() >= prune_tokens_at_) {
+				// Forget tokens no longer referenced by any task or by the user
+				tokens_.erase(std::remove_if(tokens_.begin(), tokens_.end(), [](std::shared_ptr<cancellation_state> const& t) { return t.use_count() == 1; }), tokens_.end());
+				prune_tokens_at_ = std::max(size_t(16), tokens_.size() * 2);
+			}
+			tokens_.push_back(token);
+		}
+	}
+
+	ret.impl_ = new async_task_impl(*this, f, token);
+	if (ret.impl_->cancelled()) {
+		ret.impl_->f_ = std::function<void()>();
+		ret.impl_->done_ = true;
+		++stats_.tasks_cancelled;
+		return ret;
+	}
+
+	size_t node{};
+	if (idle_.size() > 1) {
+		int const cpu = current_cpu();
+		if (cpu >= 0) {
+			node = static_cast<size_t>(numa_node_of_cpu(cpu)) % idle_.size();
+		}
+		else {
+			node = next_node_++ % idle_.size();
+		}
+	}
+
 	pooled_thread_impl *t{};
-	if (idle_.empty()) {
-		t = new pooled_thread_impl(*this);
+	if (!idle_[node].empty()) {
+		t = idle_[node].back();
+		idle_[node].pop_back();
+	}
+	else {
+		// Prefer an idle thread on a different node over creating a new thread or queueing
+		for (auto & idle : idle_) {
+			if (!idle.empty()) {
+				t = idle.back();
+				idle.pop_back();
+				break;
+			}
+		}
+	}
+
+	if (!t && (!max_threads_ || threads_.size() < max_threads_)) {
+		t = new pooled_thread_impl(*this, node);
+		std::vector<int> const cpus = node_affinity(node);
+		if (!cpus.empty()) {
+			t->set_affinity(cpus);
+		}
 		if (!t->run()) {
 			delete t;
-			return ret;
+			t = 0;
+			if (threads_.empty()) {
+				delete ret.impl_;
+				ret.impl_ = 0;
+				return ret;
+			}
+		}
+		else {
+			threads_.push_back(t);
+		}
+	}
+
+	if (t) {
+		t->task_ = ret.impl_;
+		t->thread_cond_.signal(l);
+	}
+	else {
+		queues_[node][p].push_back(ret.impl_);
+	}
+
+	return ret;
+}
+
+void thread_pool::set_max_threads(size_t count)
+{
+	scoped_lock l(m_);
+	max_threads_ = count;
+
+	// If the limit got raised, start queued tasks
+	while (!max_threads_ || threads_.size() < max_threads_) {
+		size_t node{};
+		for (; node < queues_.size(); ++node) {
+			if (!queues_[node][high].empty() || !queues_[node][normal].empty() || !queues_[node][low].empty()) {
+				break;
+			}
+		}
+		if (node == queues_.size()) {
+			break;
+		}
+
+		auto t = new pooled_thread_impl(*this, node);
+		std::vector<int> const cpus = node_affinity(node);
+		if (!cpus.empty()) {
+			t->set_affinity(cpus);
+		}
+		if (!t->run()) {
+			delete t;
+			break;
 		}
 		threads_.push_back(t);
+		t->task_ = dequeue(node);
+		t->thread_cond_.signal(l);
+	}
+}
+
+void thread_pool::finish(async_task_impl* task, scoped_lock & l)
+{
+	task->done_ = true;
+	if (task->detached_) {
+		delete task;
+	}
+	else {
+		task->cond_.signal(l);
+	}
+}
+
+async_task_impl* thread_pool::dequeue(size_t node)
+{
+	async_task_impl* ret{};
+
+	for (int p = high; p >= low && !ret; --p) {
+		// Prefer tasks queued on the thread's own node
+		for (size_t i = 0; i < queues_.size(); ++i) {
+			auto & queue = queues_[(node + i) % queues_.size()][p];
+			if (!queue.empty()) {
+				ret = queue.front();
+				queue.pop_front();
+				break;
+			}
+		}
+	}
+
+	return ret;
+}
+
+void thread_pool::purge_cancelled()
+{
+	std::vector<std::function<void()>> garbage;
+
+	scoped_lock l(m_);
+	for (auto & node : queues_) {
+		for (auto & queue : node) {
+			queue.erase(
+				std::remove_if(queue.begin(), queue.end(),
+					[&](async_task_impl* task) {
+						if (!task->cancelled()) {
+							return false;
+						}
+						garbage.emplace_back(std::move(task->f_));
+						task->f_ = std::function<void()>();
+						++stats_.tasks_cancelled;
+						finish(task, l);
+						return true;
+					}
+				),
+				queue.end()
+			);
+		}
+	}
+	l.unlock();
+
+	// Release the resources held by the cancelled tasks outside the lock
+	garbage.clear();
+}
+
+void thread_pool::set_affinity(std::vector<int> const& cpus)
+{
+	scoped_lock l(m_);
+	affinity_ = cpus;
+	for (auto thread : threads_) {
+		thread->set_affinity(node_affinity(thread->node_));
+	}
+}
+
+void thread_pool::set_numa_placement(bool enable)
+{
+	scoped_lock l(m_);
+
+	if (enable) {
+		nodes_ = numa_nodes();
 	}
 	else {
-		t = idle_.back();
-		idle_.pop_back();
+		nodes_.clear();
+	}
+
+	std::vector<pooled_thread_impl*> idle;
+	for (auto & node : idle_) {
+		idle.insert(idle.end(), node.cbegin(), node.cend());
+	}
+	idle_.assign(std::max(nodes_.size(), size_t(1)), std::vector<pooled_thread_impl*>());
+
+	std::vector<std::array<std::deque<async_task_impl*>, 3>> queues(idle_.size());
+	for (size_t node = 0; node < queues_.size(); ++node) {
+		for (size_t p = 0; p < queues_[node].size(); ++p) {
+			auto & target = queues[node % queues.size()][p];
+			target.insert(target.end(), queues_[node][p].cbegin(), queues_[node][p].cend());
+		}
+	}
+	queues_.swap(queues);
+
+	// Re-distribute the existing threads across the nodes
+	size_t i{};
+	for (auto thread : threads_) {
+		thread->node_ = i++ % idle_.size();
+		thread->set_affinity(node_affinity(thread->node_));
+	}
+	for (auto thread : idle) {
+		idle_[thread->node_].push_back(thread);
+	}
+}
+
+void thread_pool::set_idle_timeout(duration const& timeout, size_t min_threads)
+{
+	scoped_lock l(m_);
+	idle_timeout_ = timeout;
+	min_threads_ = min_threads;
+
+	// Wake up idle threads so that they pick up the new timeout
+	for (auto & node : idle_) {
+		for (auto thread : node) {
+			thread->thread_cond_.signal(l);
+		}
+	}
+}
+
+size_t thread_pool::get_max_threads() const
+{
+	scoped_lock l(m_);
+	return max_threads_;
+}
+
+thread_pool::statistics thread_pool::get_statistics() const
+{
+	scoped_lock l(m_);
+
+	statistics ret = stats_;
+	ret.threads = threads_.size();
+	for (auto const& node : idle_) {
+		ret.idle += node.size();
+	}
+	for (auto const& node : queues_) {
+		for (auto const& queue : node) {
+			ret.queued += queue.size();
+		}
+	}
+	return ret;
+}
+
+bool thread_pool::reap(pooled_thread_impl* t, scoped_lock & l)
+{
+	if (t->task_ || t->thread_cond_.signalled(l) || threads_.size() <= min_threads_) {
+		return false;
+	}
+
+	auto & idle = idle_[t->node_];
+	auto it = std::find(idle.begin(), idle.end(), t);
+	if (it == idle.end()) {
+		return false;
+	}
+	idle.erase(it);
+	threads_.erase(std::find(threads_.begin(), threads_.end(), t));
+	reaped_.push_back(t);
+	++stats_.threads_reaped;
+
+	return true;
+}
+
+void thread_pool::record(std::chrono::steady_clock::time_point const& spawned, std::chrono::steady_clock::time_point const& start)
+{
+	auto const now = clock_type::now();
+	++stats_.tasks_run;
+	add_sample(stats_.wait_time, start - spawned);
+	add_sample(stats_.run_time, now - start);
+}
+
+void thread_pool::make_idle(pooled_thread_impl* t)
+{
+	idle_[t->node_].push_back(t);
+}
+
+std::vector<int> thread_pool::node_affinity(size_t node) const
+{
+	if (node >= nodes_.size()) {
+		return affinity_;
 	}
 
-	ret.impl_ = t;
-	t->f_ = f;
-	t->detached_ = false;
-	t->thread_cond_.signal(l);
+	if (affinity_.empty()) {
+		return nodes_[node];
+	}
 
+	std::vector<int> ret;
+	for (int cpu : nodes_[node]) {
+		if (std::find(affinity_.cbegin(), affinity_.cend(), cpu) != affinity_.cend()) {
+			ret.push_back(cpu);
+		}
+	}
+	if (ret.empty()) {
+		// None of the node's processors is in the configured set
+		ret = affinity_;
+	}
 	return ret;
 }
 
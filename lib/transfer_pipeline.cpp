@@ -0,0 +1,179 @@
+#include "libfilezilla/transfer_pipeline.hpp"
+#include "libfilezilla/aligned_buffer.hpp"
+#include "libfilezilla/hash.hpp"
+#include "libfilezilla/ring_buffer.hpp"
+#include "libfilezilla/thread_pool.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <deque>
+
+namespace fz {
+
+namespace {
+struct chunk final
+{
+	size_t buffer{};
+	size_t size{};
+	int64_t offset{};
+};
+
+typedef spsc_ring_buffer<chunk> chunk_queue;
+}
+
+transfer_pipeline::transfer_pipeline(thread_pool & pool, size_t buffer_count, size_t buffer_size)
+	: pool_(pool)
+	, buffer_count_(std::max(buffer_count, size_t(2)))
+	, buffer_size_(std::max(buffer_size, size_t(1)))
+{
+}
+
+void transfer_pipeline::add_stage(stage const& s)
+{
+	if (s) {
+		stages_.push_back(s);
+	}
+}
+
+void transfer_pipeline::add_hash_stage(hash_accumulator & acc)
+{
+	stages_.push_back([&acc](uint8_t* data, size_t size, int64_t) {
+		acc.update(data, size);
+		return true;
+	});
+}
+
+int64_t transfer_pipeline::run(file & src, file & dst, int64_t offset, int64_t length, copy_progress const& progress)
+{
+	if (!src.opened() || !dst.opened() || offset < 0) {
+		return -1;
+	}
+
+	// The reader and each stage need a thread of their own, with fewer they would wait on each other forever.
+	size_t const max_threads = pool_.get_max_threads();
+	if (max_threads && max_threads < stages_.size() + 1) {
+		return -1;
+	}
+
+	std::vector<aligned_buffer> buffers;
+	for (size_t i = 0; i < buffer_count_; ++i) {
+		buffers.emplace_back(buffer_size_);
+		if (!buffers.back()) {
+			return -1;
+		}
+	}
+
+	// queues[0] holds the free buffers, queues[i] the chunks ready for stage i, the last one those ready to be written.
+	// A deque constructs its elements in place and never moves them, the queues are neither copyable nor movable.
+	std::deque<chunk_queue> queues;
+	for (size_t i = 0; i < stages_.size() + 2; ++i) {
+		queues.emplace_back(buffer_count_);
+	}
+	for (size_t i = 0; i < buffer_count_; ++i) {
+		chunk c;
+		c.buffer = i;
+		queues[0].try_push(c);
+	}
+
+	std::atomic<bool> failed{};
+	auto const fail = [&]() {
+		failed = true;
+		for (auto & q : queues) {
+			q.close();
+		}
+	};
+
+	std::vector<async_task> tasks;
+
+	tasks.emplace_back(pool_.spawn([&]() {
+		int64_t const end = (length < 0) ? -1 : offset + length;
+		int64_t pos = offset;
+		chunk c;
+		while ((end < 0 || pos < end) && queues[0].pop(c)) {
+			if (failed) {
+				return;
+			}
+			int64_t to_read = static_cast<int64_t>(buffer_size_);
+			if (end >= 0) {
+				to_read = std::min(to_read, end - pos);
+			}
+			int64_t const r = src.read_at(buffers[c.buffer].data(), to_read, pos);
+			if (r < 0) {
+				fail();
+				return;
+			}
+			if (!r) {
+				break;
+			}
+			c.size = static_cast<size_t>(r);
+			c.offset = pos;
+			pos += r;
+			if (!queues[1].push(c)) {
+				return;
+			}
+		}
+		queues[1].close();
+	}));
+	if (!tasks.back()) {
+		fail();
+		return -1;
+	}
+
+	for (size_t i = 0; i < stages_.size(); ++i) {
+		tasks.emplace_back(pool_.spawn([&, i]() {
+			chunk_queue & in = queues[i + 1];
+			chunk_queue & out = queues[i + 2];
+			chunk c;
+			while (in.pop(c)) {
+				if (failed) {
+					return;
+				}
+				if (!stages_[i](buffers[c.buffer].data(), c.size, c.offset)) {
+					fail();
+					return;
+				}
+				if (!out.push(c)) {
+					return;
+				}
+			}
+			out.close();
+		}));
+		if (!tasks.back()) {
+			fail();
+			return -1;
+		}
+	}
+
+	int64_t copied{};
+	chunk c;
+	while (queues.back().pop(c)) {
+		if (failed) {
+			break;
+		}
+		uint8_t const* p = buffers[c.buffer].data();
+		size_t written{};
+		while (written < c.size) {
+			int64_t const w = dst.write_at(p + written, static_cast<int64_t>(c.size - written), c.offset + static_cast<int64_t>(written));
+			if (w <= 0) {
+				break;
+			}
+			written += static_cast<size_t>(w);
+		}
+		if (written < c.size) {
+			fail();
+			break;
+		}
+		copied += static_cast<int64_t>(c.size);
+		if (progress && !progress(copied)) {
+			fail();
+			break;
+		}
+		queues[0].push(c);
+	}
+
+	tasks.clear();
+
+	return failed ? -1 : copied;
+}
+
+}
@@ -0,0 +1,242 @@
+#include "libfilezilla/aio.hpp"
+#include "libfilezilla/aligned_buffer.hpp"
+#include "libfilezilla/event_handler.hpp"
+#include "libfilezilla/event_loop.hpp"
+#include "libfilezilla/util.hpp"
+
+#include "test_utils.hpp"
+
+#include <map>
+#include <string.h>
+
+/*
+ * This testsuite asserts the correctness of the
+ * asynchronous file I/O, with and without io_uring
+ */
+
+class aio_test final : public CppUnit::TestFixture
+{
+	CPPUNIT_TEST_SUITE(aio_test);
+	CPPUNIT_TEST(test_threads);
+	CPPUNIT_TEST(test_io_uring);
+	CPPUNIT_TEST(test_cancel);
+	CPPUNIT_TEST(test_direct);
+	CPPUNIT_TEST_SUITE_END();
+
+public:
+	void setUp();
+	void tearDown();
+
+	void test_threads();
+	void test_io_uring();
+	void test_cancel();
+	void test_direct();
+
+private:
+	void run(bool use_io_uring);
+	void run_direct(bool use_io_uring);
+
+	fz::native_string name_;
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(aio_test);
+
+namespace {
+class collector final : public fz::event_handler
+{
+public:
+	explicit collector(fz::event_loop & l)
+		: fz::event_handler(l)
+	{}
+
+	virtual ~collector()
+	{
+		remove_handler();
+	}
+
+	virtual void operator()(fz::event_base const& ev) override
+	{
+		fz::dispatch<fz::aio_event>(ev, this, &collector::on_aio);
+	}
+
+	void on_aio(fz::aio_id id, int64_t result)
+	{
+		fz::scoped_lock l(m_);
+		results_[id] = result;
+		cond_.broadcast(l);
+	}
+
+	// Waits for the completion of the given operation and returns its result
+	int64_t wait(fz::aio_id id)
+	{
+		fz::scoped_lock l(m_);
+		if (!cond_.wait_until(l, fz::monotonic_clock::now() + fz::duration::from_seconds(10), [&]() { return results_.count(id) != 0; })) {
+			return -2;
+		}
+		return results_[id];
+	}
+
+	size_t completed()
+	{
+		fz::scoped_lock l(m_);
+		return results_.size();
+	}
+
+	fz::mutex m_;
+	fz::broadcast_condition cond_;
+	std::map<fz::aio_id, int64_t> results_;
+};
+}
+
+void aio_test::setUp()
+{
+	name_ = test_file_name("aio");
+}
+
+void aio_test::tearDown()
+{
+	fz::remove_file(name_);
+}
+
+void aio_test::run(bool use_io_uring)
+{
+	fz::event_loop loop;
+	collector c(loop);
+
+	// Few slots to exercise queueing
+	fz::aio_engine engine(4, 2, use_io_uring);
+
+	fz::file f;
+	auto id = engine.open(c, f, name_, fz::file::writing, fz::file::empty);
+	CPPUNIT_ASSERT(id);
+	ASSERT_EQUAL(int64_t(0), c.wait(id));
+	CPPUNIT_ASSERT(f.opened());
+
+	// Many concurrent writes of disjoint blocks
+	size_t const blocks = 64;
+	size_t const block_size = 4096;
+	std::vector<std::string> data;
+	for (size_t i = 0; i < blocks; ++i) {
+		data.emplace_back(block_size, static_cast<char>('A' + i % 26));
+	}
+	std::vector<fz::aio_id> ids;
+	for (size_t i = 0; i < blocks; ++i) {
+		ids.push_back(engine.write(c, f, data[i].c_str(), block_size, i * block_size));
+	}
+	for (auto const& wid : ids) {
+		ASSERT_EQUAL(int64_t(block_size), c.wait(wid));
+	}
+	ASSERT_EQUAL(int64_t(0), c.wait(engine.fsync(c, f)));
+	ASSERT_EQUAL(int64_t(blocks * block_size), f.size());
+	f.close();
+
+	// Read them back in reverse
+	ASSERT_EQUAL(int64_t(0), c.wait(engine.open(c, f, name_, fz::file::reading)));
+	std::vector<std::string> buffers(blocks, std::string(block_size, '\0'));
+	ids.clear();
+	for (size_t i = 0; i < blocks; ++i) {
+		size_t const block = blocks - i - 1;
+		ids.push_back(engine.read(c, f, &buffers[block][0], block_size, block * block_size));
+	}
+	for (auto const& rid : ids) {
+		ASSERT_EQUAL(int64_t(block_size), c.wait(rid));
+	}
+	CPPUNIT_ASSERT(buffers == data);
+
+	// Reading at EOF, errors
+	char buf[10];
+	ASSERT_EQUAL(int64_t(0), c.wait(engine.read(c, f, buf, 10, blocks * block_size)));
+	ASSERT_EQUAL(int64_t(-1), c.wait(engine.write(c, f, "x", 1, 0)));
+
+	fz::file missing;
+	ASSERT_EQUAL(int64_t(-1), c.wait(engine.open(c, missing, name_ + fz::to_native("_missing"), fz::file::reading)));
+	CPPUNIT_ASSERT(!missing.opened());
+	f.close();
+
+	// Destroying the engine completes queued operations
+	fz::file out(name_, fz::file::writing, fz::file::empty);
+	CPPUNIT_ASSERT(out.opened());
+	ids.clear();
+	{
+		fz::aio_engine queued(1, 1, use_io_uring);
+		for (size_t i = 0; i < blocks; ++i) {
+			ids.push_back(queued.write(c, out, data[i].c_str(), block_size, i * block_size));
+		}
+	}
+	ASSERT_EQUAL(int64_t(blocks * block_size), out.size());
+	for (auto const& wid : ids) {
+		ASSERT_EQUAL(int64_t(block_size), c.wait(wid));
+	}
+}
+
+void aio_test::test_threads()
+{
+	fz::aio_engine engine(4, 2, false);
+	CPPUNIT_ASSERT(!engine.uses_io_uring());
+
+	run(false);
+}
+
+void aio_test::test_io_uring()
+{
+	// Falls back to threads if io_uring isn't available
+	run(true);
+}
+
+void aio_test::test_cancel()
+{
+	write_test_file(name_, std::string(100000, 'x'));
+
+	fz::event_loop loop;
+	collector c(loop);
+	fz::aio_engine engine(1, 1, false);
+
+	fz::file f(name_, fz::file::reading);
+	std::vector<std::vector<char>> buffers(100, std::vector<char>(1000));
+	for (size_t i = 0; i < buffers.size(); ++i) {
+		engine.read(c, f, buffers[i].data(), 1000, i * 1000);
+	}
+	engine.cancel(c);
+	c.remove_handler();
+
+	// No more events once cancelled, even for operations that were still queued.
+	size_t const completed = c.completed();
+	fz::sleep(fz::duration::from_milliseconds(50));
+	ASSERT_EQUAL(completed, c.completed());
+}
+
+void aio_test::run_direct(bool use_io_uring)
+{
+	fz::event_loop loop;
+	collector c(loop);
+	fz::aio_engine engine(4, 2, use_io_uring);
+
+	fz::file::open_options o;
+	o.direct = true;
+	fz::file f(name_, fz::file::writing, fz::file::empty, o);
+	CPPUNIT_ASSERT(f.opened());
+
+	// Aligned
+	fz::aligned_buffer buf(8192);
+	memset(buf.data(), 'a', buf.size());
+	ASSERT_EQUAL(int64_t(8192), c.wait(engine.write(c, f, buf.data(), 8192, 0)));
+
+	// Unaligned offset, size and buffer
+	std::string const data = "hello world";
+	ASSERT_EQUAL(int64_t(data.size()), c.wait(engine.write(c, f, data.c_str(), static_cast<int64_t>(data.size()), 4095)));
+	ASSERT_EQUAL(int64_t(8192), f.size());
+
+	std::string read(data.size() + 2, '\0');
+	ASSERT_EQUAL(int64_t(read.size()), c.wait(engine.read(c, f, &read[0], static_cast<int64_t>(read.size()), 4094)));
+	ASSERT_EQUAL("a" + data + "a", read);
+
+	memset(buf.data(), 0, buf.size());
+	ASSERT_EQUAL(int64_t(4096), c.wait(engine.read(c, f, buf.data(), 4096, 4096)));
+	ASSERT_EQUAL(data.substr(1) + std::string(10, 'a'), std::string(reinterpret_cast<char*>(buf.data()), 20));
+}
+
+void aio_test::test_direct()
+{
+	run_direct(false);
+	run_direct(true);
+}
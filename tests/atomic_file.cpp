@@ -0,0 +1,117 @@
+#include "libfilezilla/atomic_file.hpp"
+#include "libfilezilla/buffered_file.hpp"
+#include "libfilezilla/local_filesys.hpp"
+#include "libfilezilla/string.hpp"
+#include "libfilezilla/util.hpp"
+
+#include "test_utils.hpp"
+
+/*
+ * This testsuite asserts the correctness of the
+ * atomic file replacement
+ */
+
+class atomic_file_test final : public CppUnit::TestFixture
+{
+	CPPUNIT_TEST_SUITE(atomic_file_test);
+	CPPUNIT_TEST(test_replace);
+	CPPUNIT_TEST(test_discard);
+	CPPUNIT_TEST_SUITE_END();
+
+public:
+	void setUp();
+	void tearDown();
+
+	void test_replace();
+	void test_discard();
+
+private:
+	size_t count_files();
+
+	std::string prefix_;
+	fz::native_string name_;
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(atomic_file_test);
+
+void atomic_file_test::setUp()
+{
+	name_ = test_file_name("atomic_file");
+	prefix_ = fz::to_utf8(name_);
+}
+
+void atomic_file_test::tearDown()
+{
+	fz::remove_file(name_);
+}
+
+// Number of files in the working directory belonging to this test, to detect leftover temporary files
+size_t atomic_file_test::count_files()
+{
+	size_t ret{};
+	fz::local_filesys fs;
+	if (fs.begin_find_files(fzT("."))) {
+		fz::native_string name;
+		while (fs.get_next_file(name)) {
+			if (fz::to_utf8(name).find(prefix_) == 0) {
+				++ret;
+			}
+		}
+	}
+	return ret;
+}
+
+void atomic_file_test::test_replace()
+{
+	{
+		fz::atomic_file_writer w(name_);
+		CPPUNIT_ASSERT(w.opened());
+		CPPUNIT_ASSERT(w.write("first"));
+		CPPUNIT_ASSERT(w.commit());
+		CPPUNIT_ASSERT(!w.opened());
+	}
+	ASSERT_EQUAL(std::string("first"), read_test_file(name_));
+
+	{
+		fz::atomic_file_writer w(name_);
+		CPPUNIT_ASSERT(w.opened());
+
+		fz::file_writer fw(w.get_file());
+		for (int i = 0; i < 1000; ++i) {
+			CPPUNIT_ASSERT(fw.write("line\n"));
+		}
+		CPPUNIT_ASSERT(fw.flush());
+
+		// Old contents remain visible until committed
+		ASSERT_EQUAL(std::string("first"), read_test_file(name_));
+
+		CPPUNIT_ASSERT(w.commit(false));
+	}
+	ASSERT_EQUAL(size_t(5000), read_test_file(name_).size());
+	ASSERT_EQUAL(size_t(1), count_files());
+}
+
+void atomic_file_test::test_discard()
+{
+	{
+		fz::atomic_file_writer w(name_);
+		CPPUNIT_ASSERT(w.write("old"));
+		CPPUNIT_ASSERT(w.commit());
+	}
+
+	{
+		fz::atomic_file_writer w(name_);
+		CPPUNIT_ASSERT(w.write("discarded"));
+	}
+	ASSERT_EQUAL(std::string("old"), read_test_file(name_));
+
+	{
+		fz::atomic_file_writer w(name_);
+		CPPUNIT_ASSERT(w.write("discarded"));
+		w.discard();
+		CPPUNIT_ASSERT(!w.opened());
+		CPPUNIT_ASSERT(!w.commit());
+	}
+	ASSERT_EQUAL(std::string("old"), read_test_file(name_));
+	ASSERT_EQUAL(size_t(1), count_files());
+}
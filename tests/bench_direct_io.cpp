@@ -0,0 +1,159 @@
+#include "libfilezilla/aligned_buffer.hpp"
+#include "libfilezilla/file.hpp"
+#include "libfilezilla/string.hpp"
+#include "libfilezilla/util.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+
+#include <string.h>
+
+/*
+ * Copies a large file using buffered and direct I/O, reporting the throughput
+ * and, where available, the growth of the system's page cache.
+ *
+ * Usage: bench_direct_io [size in MiB] [directory]
+ *
+ * Use a size larger than the amount of free memory to see throughput collapse
+ * with buffered I/O once the cache is exhausted. Direct I/O stays steady and
+ * leaves the cache alone.
+ */
+
+namespace {
+size_t const block_size = 4 * 1024 * 1024;
+
+// Size of the page cache in KiB, -1 if unknown.
+int64_t cached_kib()
+{
+	std::ifstream meminfo("/proc/meminfo");
+	std::string key;
+	int64_t value;
+	std::string unit;
+	while (meminfo >> key >> value >> unit) {
+		if (key == "Cached:") {
+			return value;
+		}
+	}
+	return -1;
+}
+
+bool fill(fz::native_string const& name, int64_t size)
+{
+	fz::file::open_options o;
+	o.direct = true;
+	fz::file f(name, fz::file::writing, fz::file::empty, o);
+	if (!f.opened()) {
+		return false;
+	}
+
+	fz::aligned_buffer buf(block_size);
+	for (size_t i = 0; i < buf.size(); ++i) {
+		buf.data()[i] = static_cast<uint8_t>(i * 131);
+	}
+	for (int64_t done = 0; done < size; ) {
+		int64_t const w = f.write(buf.data(), std::min(static_cast<int64_t>(block_size), size - done));
+		if (w <= 0) {
+			return false;
+		}
+		done += w;
+	}
+	return true;
+}
+
+void copy(fz::native_string const& from, fz::native_string const& to, bool direct, int64_t size)
+{
+	fz::file::open_options o;
+	o.direct = direct;
+
+	int64_t const cached_before = cached_kib();
+	auto const start = std::chrono::steady_clock::now();
+
+	fz::file in(from, fz::file::reading, fz::file::existing, o);
+	fz::file out(to, fz::file::writing, fz::file::empty, o);
+	if (!in.opened() || !out.opened()) {
+		std::cerr << "Could not open files" << std::endl;
+		return;
+	}
+
+	// Two buffers from the pool, as a transfer engine would use them.
+	fz::aligned_buffer_pool pool(block_size, fz::aligned_buffer::default_alignment, 2);
+	fz::aligned_buffer buf = pool.get();
+
+	int64_t done{};
+	while (true) {
+		int64_t const r = in.read(buf.data(), static_cast<int64_t>(buf.size()));
+		if (r <= 0) {
+			break;
+		}
+		for (int64_t written = 0; written < r; ) {
+			int64_t const w = out.write(buf.data() + written, r - written);
+			if (w <= 0) {
+				std::cerr << "Write failed" << std::endl;
+				return;
+			}
+			written += w;
+		}
+		done += r;
+	}
+	pool.release(std::move(buf));
+
+	auto const stop = std::chrono::steady_clock::now();
+	int64_t const cached_after = cached_kib();
+
+	if (done != size) {
+		std::cerr << "Size mismatch" << std::endl;
+	}
+
+	double const seconds = std::chrono::duration<double>(stop - start).count();
+	std::cout << std::setw(10) << (direct ? "direct" : "buffered")
+		<< std::setw(10) << (in.direct() && out.direct() ? "yes" : "no")
+		<< std::setw(14) << std::fixed << std::setprecision(1) << (static_cast<double>(done) / seconds / 1024 / 1024);
+	if (cached_before != -1 && cached_after != -1) {
+		std::cout << std::setw(18) << (cached_after - cached_before) / 1024;
+	}
+	else {
+		std::cout << std::setw(18) << "-";
+	}
+	std::cout << std::endl;
+}
+}
+
+int main(int argc, char *argv[])
+{
+	int64_t size = 4096;
+	if (argc > 1) {
+		size = std::stoll(argv[1]);
+	}
+	size *= 1024 * 1024;
+
+	std::string dir = ".";
+	if (argc > 2) {
+		dir = argv[2];
+	}
+
+	std::string const base = dir + "/fz_bench_direct_io_" + std::to_string(fz::random_number(0, 1000000000));
+	fz::native_string const from = fz::to_native(base + "_in");
+	fz::native_string const to = fz::to_native(base + "_out");
+
+	if (!fill(from, size)) {
+		std::cerr << "Could not create source file" << std::endl;
+		fz::remove_file(from);
+		return 1;
+	}
+
+	std::cout << "Copying " << size / 1024 / 1024 << " MiB\n\n";
+	std::cout << std::setw(10) << "mode" << std::setw(10) << "active" << std::setw(14) << "MiB/s" << std::setw(18) << "cache growth MiB" << "\n";
+
+	copy(from, to, false, size);
+	fz::remove_file(to);
+	copy(from, to, true, size);
+
+	fz::remove_file(to);
+	fz::remove_file(from);
+
+	return 0;
+}
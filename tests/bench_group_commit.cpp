@@ -0,0 +1,99 @@
+#include "libfilezilla/file.hpp"
+#include "libfilezilla/group_commit.hpp"
+#include "libfilezilla/string.hpp"
+#include "libfilezilla/thread_pool.hpp"
+#include "libfilezilla/util.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+/*
+ * Measures durable commits per second of small records appended to a shared
+ * journal by many writers, flushing after every write versus using
+ * fz::group_commit.
+ *
+ * Usage: bench_group_commit [max threads] [directory]
+ *
+ * Run it on a real disk, on tmpfs flushing is free.
+ */
+
+namespace {
+double const seconds = 2;
+
+template<typename Commit>
+double run(fz::native_string const& name, int threads, Commit const& commit)
+{
+	fz::file f(name, fz::file::writing, fz::file::empty);
+	if (!f.opened()) {
+		std::cerr << "Could not create journal" << std::endl;
+		return 0;
+	}
+
+	std::string const record(100, 'r');
+
+	fz::thread_pool pool;
+	std::atomic<int64_t> offset{};
+	std::atomic<uint64_t> commits{};
+	std::atomic<bool> failed{};
+
+	auto const stop = std::chrono::steady_clock::now() + std::chrono::duration<double>(seconds);
+	std::vector<fz::async_task> tasks;
+	for (int i = 0; i < threads; ++i) {
+		tasks.emplace_back(pool.spawn([&]() {
+			while (std::chrono::steady_clock::now() < stop) {
+				int64_t const pos = offset.fetch_add(static_cast<int64_t>(record.size()));
+				if (f.write_at(record.c_str(), static_cast<int64_t>(record.size()), pos) != static_cast<int64_t>(record.size()) || !commit(f)) {
+					failed = true;
+					return;
+				}
+				++commits;
+			}
+		}));
+	}
+	tasks.clear();
+
+	if (failed) {
+		std::cerr << "Write or flush failed" << std::endl;
+	}
+
+	return static_cast<double>(commits) / seconds;
+}
+}
+
+int main(int argc, char *argv[])
+{
+	int max_threads = 32;
+	if (argc > 1) {
+		max_threads = std::stoi(argv[1]);
+	}
+
+	std::string dir = ".";
+	if (argc > 2) {
+		dir = argv[2];
+	}
+	fz::native_string const name = fz::to_native(dir + "/fz_bench_group_commit_" + std::to_string(fz::random_number(0, 1000000000)));
+
+	std::cout << "Commits per second\n\n";
+	std::cout << std::setw(8) << "threads" << std::setw(16) << "fdatasync" << std::setw(16) << "group commit" << "\n";
+
+	for (int threads = 1; threads <= std::max(1, max_threads); threads *= 2) {
+		std::cout << std::setw(8) << threads << std::fixed << std::setprecision(0);
+
+		std::cout << std::setw(16) << run(name, threads, [](fz::file & f) {
+			return f.fdatasync();
+		});
+
+		fz::group_commit gc;
+		std::cout << std::setw(16) << run(name, threads, [&gc](fz::file & f) {
+			return gc.commit(f);
+		}) << std::endl;
+	}
+
+	fz::remove_file(name);
+
+	return 0;
+}
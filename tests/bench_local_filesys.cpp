@@ -0,0 +1,105 @@
+#include "libfilezilla/file.hpp"
+#include "libfilezilla/local_filesys.hpp"
+#include "libfilezilla/recursive_remove.hpp"
+#include "libfilezilla/string.hpp"
+#include "libfilezilla/util.hpp"
+
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <string>
+
+#ifndef FZ_WINDOWS
+#include <sys/stat.h>
+#endif
+
+/*
+ * Enumerates a large directory using local_filesys, with and without
+ * attributes, reporting the time taken.
+ *
+ * Usage: bench_local_filesys [number of files] [directory]
+ *
+ * A directory with the given number of files is created below the
+ * given directory and removed afterwards.
+ */
+
+namespace {
+void enumerate(fz::native_string const& path, bool attributes, int expected)
+{
+	auto const start = std::chrono::steady_clock::now();
+
+	fz::local_filesys fs;
+	if (!fs.begin_find_files(path)) {
+		std::cerr << "Could not open directory" << std::endl;
+		return;
+	}
+
+	int count{};
+	int64_t total{};
+	fz::native_string name;
+	bool is_link;
+	bool is_dir;
+	int64_t size;
+	fz::datetime mtime;
+	int mode;
+	while (attributes ? fs.get_next_file(name, is_link, is_dir, &size, &mtime, &mode) : fs.get_next_file(name)) {
+		++count;
+		if (attributes) {
+			total += size;
+		}
+	}
+
+	auto const stop = std::chrono::steady_clock::now();
+	if (count != expected) {
+		std::cerr << "Found " << count << " entries instead of " << expected << std::endl;
+	}
+
+	double const ms = std::chrono::duration<double, std::milli>(stop - start).count();
+	std::cout << std::setw(16) << (attributes ? "attributes" : "names only")
+		<< std::setw(12) << std::fixed << std::setprecision(1) << ms << std::endl;
+}
+}
+
+int main(int argc, char *argv[])
+{
+	int files = 100000;
+	if (argc > 1) {
+		files = std::stoi(argv[1]);
+	}
+
+	std::string dir = ".";
+	if (argc > 2) {
+		dir = argv[2];
+	}
+
+	fz::native_string const path = fz::to_native(dir + "/fz_bench_local_filesys_" + std::to_string(fz::random_number(0, 1000000000)));
+#ifdef FZ_WINDOWS
+	if (!CreateDirectoryW(path.c_str(), nullptr)) {
+#else
+	if (mkdir(path.c_str(), 0700)) {
+#endif
+		std::cerr << "Could not create directory" << std::endl;
+		return 1;
+	}
+
+	for (int i = 0; i < files; ++i) {
+		fz::file f(path + fzT("/") + fz::to_native(std::to_string(i)), fz::file::writing, fz::file::empty);
+		if (!f.opened() || f.write("x", 1) != 1) {
+			std::cerr << "Could not create files" << std::endl;
+			fz::recursive_remove().remove(path);
+			return 1;
+		}
+	}
+
+	std::cout << "Enumerating " << files << " files\n\n";
+	std::cout << std::setw(16) << "mode" << std::setw(12) << "ms" << "\n";
+
+	for (int i = 0; i < 3; ++i) {
+		enumerate(path, false, files);
+		enumerate(path, true, files);
+	}
+
+	fz::recursive_remove().remove(path);
+
+	return 0;
+}
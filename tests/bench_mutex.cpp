@@ -0,0 +1,85 @@
+#include "libfilezilla/mutex.hpp"
+#include "libfilezilla/thread_pool.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+/*
+ * Contention microbenchmark comparing recursive and non-recursive fz::mutex
+ * with fz::adaptive_mutex.
+ *
+ * Each thread repeatedly locks the mutex, performs a very short critical
+ * section and unlocks it again, resembling event_loop::send_event.
+ */
+
+namespace {
+int const iterations = 1000000;
+
+template<typename Mutex>
+double run(Mutex & m, int threads)
+{
+	fz::thread_pool pool;
+
+	uint64_t counter{};
+	std::atomic<int> ready{};
+	std::atomic<bool> go{};
+
+	std::vector<fz::async_task> tasks;
+	for (int i = 0; i < threads; ++i) {
+		tasks.emplace_back(pool.spawn([&]() {
+			++ready;
+			while (!go) {
+			}
+			for (int j = 0; j < iterations; ++j) {
+				fz::scoped_lock l(m);
+				++counter;
+			}
+		}));
+	}
+
+	while (ready != threads) {
+	}
+
+	auto const start = std::chrono::steady_clock::now();
+	go = true;
+	for (auto & task : tasks) {
+		task.join();
+	}
+	auto const stop = std::chrono::steady_clock::now();
+
+	if (counter != static_cast<uint64_t>(threads) * iterations) {
+		std::cerr << "Counter mismatch, mutex is broken" << std::endl;
+	}
+
+	double const seconds = std::chrono::duration<double>(stop - start).count();
+	return static_cast<double>(counter) / seconds / 1000000;
+}
+}
+
+int main(int argc, char *argv[])
+{
+	int max_threads = 16;
+	if (argc > 1) {
+		max_threads = std::stoi(argv[1]);
+	}
+
+	std::cout << "Million lock/unlock pairs per second\n\n";
+	std::cout << std::setw(8) << "threads" << std::setw(16) << "mutex(true)" << std::setw(16) << "mutex(false)" << std::setw(16) << "adaptive_mutex" << "\n";
+
+	for (int threads = 1; threads <= max_threads; threads *= 2) {
+		fz::mutex recursive(true);
+		fz::mutex normal(false);
+		fz::adaptive_mutex adaptive;
+
+		std::cout << std::setw(8) << threads << std::fixed << std::setprecision(2)
+			<< std::setw(16) << run(recursive, threads)
+			<< std::setw(16) << run(normal, threads)
+			<< std::setw(16) << run(adaptive, threads) << std::endl;
+	}
+
+	return 0;
+}
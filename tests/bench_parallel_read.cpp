@@ -0,0 +1,137 @@
+#include "libfilezilla/aligned_buffer.hpp"
+#include "libfilezilla/file.hpp"
+#include "libfilezilla/parallel_read.hpp"
+#include "libfilezilla/string.hpp"
+#include "libfilezilla/thread_pool.hpp"
+#include "libfilezilla/util.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <string>
+
+/*
+ * Reads a large file once sequentially and then using read_segments with
+ * varying concurrency, reporting the throughput.
+ *
+ * Usage: bench_parallel_read [size in MiB] [directory]
+ *
+ * The file is opened for direct I/O so that every pass is read from the
+ * storage and not from the page cache. Fast storage such as NVMe drives only
+ * reach their full throughput with multiple requests in flight.
+ */
+
+namespace {
+size_t const block_size = 4 * 1024 * 1024;
+
+bool fill(fz::native_string const& name, int64_t size)
+{
+	fz::file::open_options o;
+	o.direct = true;
+	fz::file f(name, fz::file::writing, fz::file::empty, o);
+	if (!f.opened()) {
+		return false;
+	}
+
+	fz::aligned_buffer buf(block_size);
+	for (size_t i = 0; i < buf.size(); ++i) {
+		buf.data()[i] = static_cast<uint8_t>(i * 131);
+	}
+	for (int64_t done = 0; done < size; ) {
+		int64_t const w = f.write(buf.data(), std::min(static_cast<int64_t>(block_size), size - done));
+		if (w <= 0) {
+			return false;
+		}
+		done += w;
+	}
+	return f.fsync();
+}
+
+void report(std::string const& mode, int64_t done, int64_t size, std::chrono::steady_clock::time_point const& start)
+{
+	auto const stop = std::chrono::steady_clock::now();
+	if (done != size) {
+		std::cerr << mode << ": size mismatch" << std::endl;
+		return;
+	}
+	double const seconds = std::chrono::duration<double>(stop - start).count();
+	std::cout << std::setw(24) << mode
+		<< std::setw(14) << std::fixed << std::setprecision(1) << (static_cast<double>(done) / seconds / 1024 / 1024) << std::endl;
+}
+
+void sequential(fz::file & f, int64_t size)
+{
+	auto const start = std::chrono::steady_clock::now();
+
+	fz::aligned_buffer buf(block_size);
+	int64_t done{};
+	int64_t r;
+	f.seek(0, fz::file::begin);
+	while ((r = f.read(buf.data(), static_cast<int64_t>(buf.size()))) > 0) {
+		done += r;
+	}
+
+	report("sequential", done, size, start);
+}
+
+void parallel(fz::file & f, fz::thread_pool & pool, int64_t size, size_t threads, bool in_order)
+{
+	auto const start = std::chrono::steady_clock::now();
+
+	fz::parallel_read_options options;
+	options.segment_size = block_size;
+	options.parallel = threads;
+	options.in_order = in_order;
+
+	int64_t const done = fz::read_segments(f, pool, [](uint8_t const*, size_t, int64_t) { return true; }, 0, -1, options);
+
+	report("segments x" + std::to_string(threads) + (in_order ? " ordered" : ""), done, size, start);
+}
+}
+
+int main(int argc, char *argv[])
+{
+	int64_t size = 1024;
+	if (argc > 1) {
+		size = std::stoll(argv[1]);
+	}
+	size *= 1024 * 1024;
+
+	std::string dir = ".";
+	if (argc > 2) {
+		dir = argv[2];
+	}
+
+	fz::native_string const name = fz::to_native(dir + "/fz_bench_parallel_read_" + std::to_string(fz::random_number(0, 1000000000)));
+
+	if (!fill(name, size)) {
+		std::cerr << "Could not create file" << std::endl;
+		fz::remove_file(name);
+		return 1;
+	}
+
+	fz::file::open_options o;
+	o.direct = true;
+	fz::file f(name, fz::file::reading, fz::file::existing, o);
+	if (!f.opened()) {
+		std::cerr << "Could not open file" << std::endl;
+		fz::remove_file(name);
+		return 1;
+	}
+
+	std::cout << "Reading " << size / 1024 / 1024 << " MiB" << (f.direct() ? "" : ", direct I/O not supported, results are skewed by the page cache") << "\n\n";
+	std::cout << std::setw(24) << "mode" << std::setw(14) << "MiB/s" << "\n";
+
+	fz::thread_pool pool;
+	sequential(f, size);
+	for (size_t threads : {1, 2, 4, 8, 16}) {
+		parallel(f, pool, size, threads, true);
+	}
+	parallel(f, pool, size, 8, false);
+
+	f.close();
+	fz::remove_file(name);
+
+	return 0;
+}
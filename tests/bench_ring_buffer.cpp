@@ -0,0 +1,158 @@
+#include "libfilezilla/mutex.hpp"
+#include "libfilezilla/ring_buffer.hpp"
+#include "libfilezilla/thread_pool.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+/*
+ * Throughput benchmark comparing fz::spsc_ring_buffer and fz::mpmc_ring_buffer
+ * with a bounded std::deque protected by a mutex and condition.
+ *
+ * Half of the threads push, the other half pop, each element is a single
+ * integer. Blocking push and pop are used throughout.
+ */
+
+namespace {
+uint64_t const items = 2000000;
+size_t const capacity = 1024;
+
+class locked_queue final
+{
+public:
+	bool push(uint64_t v)
+	{
+		fz::scoped_lock l(m_);
+		while (q_.size() >= capacity) {
+			not_full_.wait(l);
+		}
+		q_.push_back(v);
+		not_empty_.signal(l);
+		return true;
+	}
+
+	bool pop(uint64_t & v)
+	{
+		fz::scoped_lock l(m_);
+		while (q_.empty()) {
+			if (closed_) {
+				return false;
+			}
+			not_empty_.wait(l);
+		}
+		v = q_.front();
+		q_.pop_front();
+		not_full_.signal(l);
+		return true;
+	}
+
+	void close()
+	{
+		fz::scoped_lock l(m_);
+		closed_ = true;
+		not_empty_.broadcast(l);
+	}
+
+private:
+	fz::mutex m_{false};
+	fz::broadcast_condition not_empty_;
+	fz::broadcast_condition not_full_;
+	std::deque<uint64_t> q_;
+	bool closed_{};
+};
+
+template<typename Queue>
+double run(Queue & q, int producers, int consumers)
+{
+	fz::thread_pool pool;
+
+	std::atomic<uint64_t> received{};
+	std::atomic<int> remaining{producers};
+	std::atomic<int> ready{};
+	std::atomic<bool> go{};
+
+	std::vector<fz::async_task> tasks;
+	for (int i = 0; i < consumers; ++i) {
+		tasks.emplace_back(pool.spawn([&]() {
+			++ready;
+			while (!go) {
+			}
+			uint64_t count{};
+			uint64_t v;
+			while (q.pop(v)) {
+				++count;
+			}
+			received += count;
+		}));
+	}
+	for (int i = 0; i < producers; ++i) {
+		tasks.emplace_back(pool.spawn([&]() {
+			++ready;
+			while (!go) {
+			}
+			for (uint64_t j = 0; j < items / producers; ++j) {
+				q.push(j);
+			}
+			if (!--remaining) {
+				q.close();
+			}
+		}));
+	}
+
+	while (ready != producers + consumers) {
+	}
+
+	auto const start = std::chrono::steady_clock::now();
+	go = true;
+	for (auto & task : tasks) {
+		task.join();
+	}
+	auto const stop = std::chrono::steady_clock::now();
+
+	if (received != (items / producers) * producers) {
+		std::cerr << "Element count mismatch, queue is broken" << std::endl;
+	}
+
+	double const seconds = std::chrono::duration<double>(stop - start).count();
+	return static_cast<double>(received) / seconds / 1000000;
+}
+}
+
+int main(int argc, char *argv[])
+{
+	int max_threads = 32;
+	if (argc > 1) {
+		max_threads = std::stoi(argv[1]);
+	}
+
+	std::cout << "Million elements per second\n\n";
+	std::cout << std::setw(8) << "threads" << std::setw(16) << "locked deque" << std::setw(16) << "spsc" << std::setw(16) << "mpmc" << "\n";
+
+	for (int threads = 2; threads <= std::max(2, max_threads); threads *= 2) {
+		int const producers = threads / 2;
+		int const consumers = threads - producers;
+
+		locked_queue locked;
+		fz::mpmc_ring_buffer<uint64_t> mpmc(capacity);
+
+		std::cout << std::setw(8) << threads << std::fixed << std::setprecision(2)
+			<< std::setw(16) << run(locked, producers, consumers);
+
+		if (threads == 2) {
+			fz::spsc_ring_buffer<uint64_t> spsc(capacity);
+			std::cout << std::setw(16) << run(spsc, 1, 1);
+		}
+		else {
+			std::cout << std::setw(16) << "-";
+		}
+
+		std::cout << std::setw(16) << run(mpmc, producers, consumers) << std::endl;
+	}
+
+	return 0;
+}
@@ -0,0 +1,143 @@
+#include "libfilezilla/buffered_file.hpp"
+#include "libfilezilla/string.hpp"
+#include "libfilezilla/util.hpp"
+
+#include "test_utils.hpp"
+
+#include <random>
+
+#include <string.h>
+
+/*
+ * This testsuite asserts the correctness of the
+ * buffered file reader and writer
+ */
+
+class buffered_file_test final : public CppUnit::TestFixture
+{
+	CPPUNIT_TEST_SUITE(buffered_file_test);
+	CPPUNIT_TEST(test_lines);
+	CPPUNIT_TEST(test_records);
+	CPPUNIT_TEST_SUITE_END();
+
+public:
+	void setUp();
+	void tearDown();
+
+	void test_lines();
+	void test_records();
+
+private:
+	fz::native_string name_;
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(buffered_file_test);
+
+void buffered_file_test::setUp()
+{
+	name_ = test_file_name("buffered_file");
+}
+
+void buffered_file_test::tearDown()
+{
+	fz::remove_file(name_);
+}
+
+void buffered_file_test::test_lines()
+{
+	// Seeded, fz::random_number is far too slow for this many calls
+	std::mt19937 gen(42);
+
+	std::vector<std::string> lines;
+	for (int i = 0; i < 1000; ++i) {
+		lines.push_back(std::string(gen() % 101, static_cast<char>('a' + i % 26)));
+	}
+
+	{
+		fz::file f(name_, fz::file::writing, fz::file::empty);
+		CPPUNIT_ASSERT(f.opened());
+
+		// Small buffer to exercise automatic flushes and lines spanning buffer boundaries
+		fz::file_writer w(f, 64);
+		for (size_t i = 0; i < lines.size(); ++i) {
+			CPPUNIT_ASSERT(w.write(lines[i]));
+			CPPUNIT_ASSERT(w.write(i % 2 ? "\r\n" : "\n", i % 2 ? 2 : 1));
+		}
+		CPPUNIT_ASSERT(w.write("last", 4));
+		CPPUNIT_ASSERT(w.sync());
+	}
+
+	fz::file f(name_, fz::file::reading);
+	CPPUNIT_ASSERT(f.opened());
+	fz::file_reader r(f, 64);
+
+	std::string line;
+	for (size_t i = 0; i < lines.size(); ++i) {
+		ASSERT_EQUAL(static_cast<int64_t>(lines[i].size() + (i % 2 ? 2 : 1)), r.read_line(line));
+		ASSERT_EQUAL(lines[i], line);
+	}
+	ASSERT_EQUAL(int64_t(4), r.read_line(line));
+	ASSERT_EQUAL(std::string("last"), line);
+	ASSERT_EQUAL(int64_t(0), r.read_line(line));
+	CPPUNIT_ASSERT(line.empty());
+}
+
+void buffered_file_test::test_records()
+{
+	// Seeded, fz::random_number is far too slow for this many calls
+	std::mt19937 gen(42);
+
+	std::string data(100000, '\0');
+	for (auto & c : data) {
+		c = static_cast<char>(gen());
+	}
+
+	{
+		fz::file f(name_, fz::file::writing, fz::file::empty);
+		CPPUNIT_ASSERT(f.opened());
+
+		fz::file_writer w(f, 1000);
+		size_t pos{};
+		while (pos < data.size()) {
+			// Mix of small writes and writes larger than the buffer
+			size_t const chunk = std::min(data.size() - pos, static_cast<size_t>(gen() % 3001));
+			CPPUNIT_ASSERT(w.write(data.c_str() + pos, static_cast<int64_t>(chunk)));
+			pos += chunk;
+		}
+		CPPUNIT_ASSERT(w.flush());
+		ASSERT_EQUAL(static_cast<int64_t>(data.size()), f.size());
+	}
+
+	fz::file f(name_, fz::file::reading);
+	CPPUNIT_ASSERT(f.opened());
+	fz::file_reader r(f, 1000);
+
+	// Length-prefixed records are typically parsed by peeking at the header first
+	uint8_t const* p{};
+	ASSERT_EQUAL(int64_t(4), r.peek(p, 4));
+	CPPUNIT_ASSERT(!memcmp(p, data.c_str(), 4));
+	ASSERT_EQUAL(int64_t(1000), r.peek(p, 5000));
+	r.consume(10);
+
+	std::string actual = data.substr(0, 10);
+	while (actual.size() < data.size()) {
+		char buf[3000];
+		int64_t const want = static_cast<int64_t>(gen() % 3000) + 1;
+		if (want % 2) {
+			int64_t const got = r.read(buf, want);
+			CPPUNIT_ASSERT(got > 0);
+			actual.append(buf, static_cast<size_t>(got));
+		}
+		else {
+			int64_t const got = r.peek(p, static_cast<size_t>(want));
+			CPPUNIT_ASSERT(got > 0);
+			actual.append(reinterpret_cast<char const*>(p), static_cast<size_t>(got));
+			r.consume(static_cast<size_t>(got));
+		}
+	}
+	CPPUNIT_ASSERT(data == actual);
+
+	char c;
+	ASSERT_EQUAL(int64_t(0), r.read(&c, 1));
+	ASSERT_EQUAL(int64_t(0), r.peek(p, 1));
+}
@@ -0,0 +1,351 @@
+#include "libfilezilla/aligned_buffer.hpp"
+#include "libfilezilla/file.hpp"
+#include "libfilezilla/string.hpp"
+#include "libfilezilla/thread_pool.hpp"
+#include "libfilezilla/util.hpp"
+
+#include "test_utils.hpp"
+
+#include <random>
+
+#include <string.h>
+
+/*
+ * This testsuite asserts the correctness of the
+ * file access functions
+ */
+
+class file_test final : public CppUnit::TestFixture
+{
+	CPPUNIT_TEST_SUITE(file_test);
+	CPPUNIT_TEST(test_positional);
+	CPPUNIT_TEST(test_vectored);
+	CPPUNIT_TEST(test_options);
+	CPPUNIT_TEST(test_direct);
+	CPPUNIT_TEST(test_copy);
+	CPPUNIT_TEST(test_sparse);
+	CPPUNIT_TEST_SUITE_END();
+
+public:
+	void setUp();
+	void tearDown();
+
+	void test_positional();
+	void test_vectored();
+	void test_options();
+	void test_direct();
+	void test_copy();
+	void test_sparse();
+
+private:
+	fz::native_string name_;
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(file_test);
+
+void file_test::setUp()
+{
+	name_ = test_file_name("file");
+}
+
+void file_test::tearDown()
+{
+	fz::remove_file(name_);
+}
+
+void file_test::test_positional()
+{
+	{
+		fz::file f(name_, fz::file::writing, fz::file::empty);
+		CPPUNIT_ASSERT(f.opened());
+
+		// Concurrent writes of disjoint chunks
+		fz::thread_pool pool;
+		std::vector<fz::async_task> tasks;
+		for (int i = 0; i < 4; ++i) {
+			tasks.emplace_back(pool.spawn([&f, i]() {
+				std::string const chunk(1000, static_cast<char>('a' + i));
+				f.write_at(chunk.c_str(), 1000, 1000 * i);
+			}));
+		}
+		tasks.clear();
+
+		ASSERT_EQUAL(int64_t(4000), f.size());
+	}
+
+	fz::file f(name_, fz::file::reading);
+	CPPUNIT_ASSERT(f.opened());
+
+	char buf[100];
+	ASSERT_EQUAL(int64_t(100), f.read_at(buf, 100, 2950));
+	ASSERT_EQUAL(std::string(50, 'c') + std::string(50, 'd'), std::string(buf, 100));
+
+	// File pointer is independent
+	ASSERT_EQUAL(int64_t(10), f.read(buf, 10));
+	ASSERT_EQUAL(std::string(10, 'a'), std::string(buf, 10));
+
+	// EOF
+	ASSERT_EQUAL(int64_t(0), f.read_at(buf, 100, 4000));
+	ASSERT_EQUAL(int64_t(0), f.read_at(buf, 100, 5000));
+	ASSERT_EQUAL(int64_t(5), f.read_at(buf, 100, 3995));
+}
+
+void file_test::test_vectored()
+{
+	{
+		fz::file f(name_, fz::file::writing, fz::file::empty);
+		CPPUNIT_ASSERT(f.opened());
+
+		fz::const_io_buffer const bufs[] = {
+			{"Hello", 5},
+			{", ", 2},
+			{"World", 5}
+		};
+		ASSERT_EQUAL(int64_t(12), f.writev(bufs, 3));
+		ASSERT_EQUAL(int64_t(5), f.writev_at(bufs, 1, 7));
+		ASSERT_EQUAL(int64_t(0), f.writev(bufs, 0));
+
+		// Many buffers
+		std::vector<fz::const_io_buffer> many(100, fz::const_io_buffer{"x", 1});
+		ASSERT_EQUAL(int64_t(100), f.writev(many.data(), many.size()));
+	}
+
+	fz::file f(name_, fz::file::reading);
+	ASSERT_EQUAL(int64_t(112), f.size());
+
+	char a[3];
+	char b[10];
+	fz::io_buffer bufs[] = {
+		{a, sizeof(a)},
+		{b, sizeof(b)}
+	};
+	ASSERT_EQUAL(int64_t(13), f.readv(bufs, 2));
+	ASSERT_EQUAL(std::string("Hel"), std::string(a, 3));
+	ASSERT_EQUAL(std::string("lo, Hellox"), std::string(b, 10));
+
+	memset(a, 0, sizeof(a));
+	memset(b, 0, sizeof(b));
+	ASSERT_EQUAL(int64_t(13), f.readv_at(bufs, 2, 4));
+	ASSERT_EQUAL(std::string("o, "), std::string(a, 3));
+	ASSERT_EQUAL(std::string("Helloxxxxx"), std::string(b, 10));
+
+	// Short read at end of file
+	ASSERT_EQUAL(int64_t(5), f.readv_at(bufs, 2, 107));
+	ASSERT_EQUAL(std::string("xxx"), std::string(a, 3));
+	ASSERT_EQUAL(std::string("xx"), std::string(b, 2));
+}
+
+void file_test::test_options()
+{
+	fz::file::open_options o;
+	o.pattern = fz::file::random;
+	o.noatime = true;
+	o.preallocate = 1024 * 1024;
+
+	{
+		fz::file f(name_, fz::file::writing, fz::file::empty, o);
+		CPPUNIT_ASSERT(f.opened());
+
+		// Preallocation does not change the size
+		ASSERT_EQUAL(int64_t(0), f.size());
+		ASSERT_EQUAL(int64_t(5), f.write("Hello", 5));
+		ASSERT_EQUAL(int64_t(5), f.size());
+	}
+
+	fz::file f(name_, fz::file::reading, fz::file::existing, o);
+	CPPUNIT_ASSERT(f.opened());
+
+#ifndef FZ_WINDOWS
+	CPPUNIT_ASSERT(f.advise(0, 0, fz::file::sequential));
+	CPPUNIT_ASSERT(f.advise(1, 2, fz::file::dontneed));
+	CPPUNIT_ASSERT(f.readahead(0, 0));
+#endif
+
+	char buf[5];
+	ASSERT_EQUAL(int64_t(5), f.read_at(buf, 5, 0));
+	ASSERT_EQUAL(std::string("Hello"), std::string(buf, 5));
+}
+
+void file_test::test_direct()
+{
+	fz::aligned_buffer_pool pool(8192);
+	fz::aligned_buffer aligned = pool.get();
+	CPPUNIT_ASSERT(aligned);
+	ASSERT_EQUAL(size_t(8192), aligned.size());
+	ASSERT_EQUAL(uintptr_t(0), reinterpret_cast<uintptr_t>(aligned.data()) % fz::aligned_buffer::default_alignment);
+	uint8_t* const p = aligned.data();
+	pool.release(std::move(aligned));
+	CPPUNIT_ASSERT(!aligned);
+	aligned = pool.get();
+	CPPUNIT_ASSERT(p == aligned.data());
+
+	// Buffers of other sizes are not cached, but freed
+	fz::aligned_buffer other(4096);
+	pool.release(std::move(other));
+	CPPUNIT_ASSERT(!other);
+
+	std::string expected;
+	for (int i = 0; i < 20000; ++i) {
+		expected += static_cast<char>('a' + i % 26);
+	}
+
+	fz::file::open_options o;
+	o.direct = true;
+
+	{
+		fz::file f(name_, fz::file::writing, fz::file::empty, o);
+		CPPUNIT_ASSERT(f.opened());
+
+		// Unaligned sizes, offsets and buffers
+		for (size_t pos = 0; pos < 10000; pos += 777) {
+			int64_t const chunk = std::min(size_t(777), 10000 - pos);
+			ASSERT_EQUAL(chunk, f.write(expected.c_str() + pos, chunk));
+		}
+		ASSERT_EQUAL(int64_t(10000), f.size());
+		ASSERT_EQUAL(int64_t(10000), f.position());
+
+		// Aligned
+		memcpy(aligned.data(), expected.c_str() + 8192, 8192);
+		ASSERT_EQUAL(int64_t(8192), f.write_at(aligned.data(), 8192, 8192));
+		ASSERT_EQUAL(int64_t(16384), f.size());
+
+		// Tail within a single block, overlapping existing data
+		ASSERT_EQUAL(int64_t(3616), f.write_at(expected.c_str() + 16384, 3616, 16384));
+		ASSERT_EQUAL(int64_t(100), f.write_at(expected.c_str() + 4000, 100, 4000));
+		ASSERT_EQUAL(int64_t(20000), f.size());
+	}
+
+	fz::file f(name_, fz::file::reading, fz::file::existing, o);
+	CPPUNIT_ASSERT(f.opened());
+
+	std::string actual;
+	char buf[333];
+	int64_t r;
+	while ((r = f.read(buf, sizeof(buf))) > 0) {
+		actual.append(buf, r);
+	}
+	ASSERT_EQUAL(int64_t(0), r);
+	CPPUNIT_ASSERT(expected == actual);
+
+	ASSERT_EQUAL(int64_t(50), f.read_at(buf, 50, 19950));
+	ASSERT_EQUAL(expected.substr(19950), std::string(buf, 50));
+	ASSERT_EQUAL(int64_t(0), f.read_at(buf, 50, 20000));
+
+	fz::file buffered(name_, fz::file::reading);
+	CPPUNIT_ASSERT(!buffered.direct());
+	ASSERT_EQUAL(int64_t(8192), buffered.read_at(aligned.data(), 8192, 4096));
+	CPPUNIT_ASSERT(!memcmp(aligned.data(), expected.c_str() + 4096, 8192));
+}
+
+void file_test::test_copy()
+{
+	// Seeded, fz::random_number is far too slow to generate this much data
+	std::mt19937 gen(42);
+	std::string data(3 * 1024 * 1024 + 17, '\0');
+	for (auto & c : data) {
+		c = static_cast<char>(gen());
+	}
+	write_test_file(name_, data);
+
+	fz::native_string const copy = name_ + fzT("_copy");
+
+	// Whole file
+	int64_t reported{};
+	CPPUNIT_ASSERT(fz::copy_file(name_, copy, false, [&reported](int64_t copied) {
+		reported = copied;
+		return true;
+	}));
+	ASSERT_EQUAL(static_cast<int64_t>(data.size()), reported);
+	CPPUNIT_ASSERT(data == read_test_file(copy));
+
+	// Range
+	{
+		fz::file in(name_, fz::file::reading);
+		fz::file out(copy, fz::file::writing, fz::file::empty);
+		ASSERT_EQUAL(int64_t(1000), fz::copy_file(in, out, 5000, 1000));
+		ASSERT_EQUAL(int64_t(6000), out.size());
+
+		// Past the end of the source
+		ASSERT_EQUAL(int64_t(17), fz::copy_file(in, out, 3 * 1024 * 1024, 1000));
+		ASSERT_EQUAL(int64_t(0), fz::copy_file(in, out, 4 * 1024 * 1024));
+	}
+	std::string const range = read_test_file(copy);
+	ASSERT_EQUAL(std::string(5000, '\0'), range.substr(0, 5000));
+	CPPUNIT_ASSERT(data.substr(5000, 1000) == range.substr(5000, 1000));
+
+	// Resume after a partial copy
+	{
+		fz::file in(name_, fz::file::reading);
+		fz::file out(copy, fz::file::writing, fz::file::empty);
+		ASSERT_EQUAL(int64_t(100000), fz::copy_file(in, out, 0, 100000));
+	}
+	CPPUNIT_ASSERT(fz::copy_file(name_, copy, true));
+	CPPUNIT_ASSERT(data == read_test_file(copy));
+
+	// Aborted by callback
+	CPPUNIT_ASSERT(!fz::copy_file(name_, copy, false, [](int64_t) { return false; }));
+
+	// Onto itself, the source must not get truncated
+	CPPUNIT_ASSERT(!fz::copy_file(name_, name_));
+	CPPUNIT_ASSERT(data == read_test_file(name_));
+
+	fz::remove_file(copy);
+}
+
+void file_test::test_sparse()
+{
+	fz::file f(name_, fz::file::writing, fz::file::empty);
+	CPPUNIT_ASSERT(f.opened());
+
+	// Preallocation
+	CPPUNIT_ASSERT(f.allocate(0, 65536, true));
+	ASSERT_EQUAL(int64_t(0), f.size());
+	CPPUNIT_ASSERT(f.allocate(0, 65536));
+	ASSERT_EQUAL(int64_t(65536), f.size());
+	CPPUNIT_ASSERT(f.allocate(0, 1000));
+	ASSERT_EQUAL(int64_t(65536), f.size());
+
+	// Data at both ends, a hole in between
+	int64_t const size = 4 * 1024 * 1024;
+	CPPUNIT_ASSERT(f.seek(0, fz::file::begin) == 0 && f.truncate());
+	std::string const data(65536, 'x');
+	ASSERT_EQUAL(int64_t(65536), f.write_at(data.c_str(), 65536, 0));
+	ASSERT_EQUAL(int64_t(65536), f.write_at(data.c_str(), 65536, size - 65536));
+	ASSERT_EQUAL(size, f.size());
+
+	ASSERT_EQUAL(int64_t(0), f.next_data(0));
+	int64_t const hole = f.next_hole(0);
+	CPPUNIT_ASSERT(hole >= 65536 && hole <= size);
+	ASSERT_EQUAL(size, f.next_hole(size));
+	ASSERT_EQUAL(size, f.next_data(size));
+
+	// The file pointer is not affected
+	ASSERT_EQUAL(int64_t(0), f.position());
+
+	bool const punched = f.punch_hole(0, 32768);
+	ASSERT_EQUAL(size, f.size());
+
+	// Reading only the data regions reconstructs the file, holes read as zeroes
+	fz::file in(name_, fz::file::reading);
+	std::string contents(static_cast<size_t>(size), '\0');
+	int64_t data_size{};
+	int64_t start = in.next_data(0);
+	while (start >= 0 && start < size) {
+		int64_t const end = in.next_hole(start);
+		CPPUNIT_ASSERT(end > start);
+		ASSERT_EQUAL(end - start, in.read_at(&contents[static_cast<size_t>(start)], end - start, start));
+		data_size += end - start;
+		start = in.next_data(end);
+	}
+	ASSERT_EQUAL(size, start);
+	CPPUNIT_ASSERT(data_size >= 65536 + 32768);
+
+	std::string expected(static_cast<size_t>(size), '\0');
+	expected.replace(32768, 32768, data, 0, 32768);
+	expected.replace(static_cast<size_t>(size - 65536), 65536, data);
+	if (!punched) {
+		// Not supported by the file system
+		expected.replace(0, 32768, data, 0, 32768);
+	}
+	CPPUNIT_ASSERT(expected == contents);
+}
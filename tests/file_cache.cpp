@@ -0,0 +1,195 @@
+#include "libfilezilla/atomic_file.hpp"
+#include "libfilezilla/file_cache.hpp"
+#include "libfilezilla/string.hpp"
+#include "libfilezilla/util.hpp"
+
+#include "test_utils.hpp"
+
+/*
+ * This testsuite asserts the correctness of the
+ * cache of open files
+ */
+
+class file_cache_test final : public CppUnit::TestFixture
+{
+	CPPUNIT_TEST_SUITE(file_cache_test);
+	CPPUNIT_TEST(test_reuse);
+	CPPUNIT_TEST(test_validation);
+	CPPUNIT_TEST(test_limit);
+	CPPUNIT_TEST(test_revalidate);
+	CPPUNIT_TEST_SUITE_END();
+
+public:
+	void setUp();
+	void tearDown();
+
+	void test_reuse();
+	void test_validation();
+	void test_limit();
+	void test_revalidate();
+
+private:
+	std::string read(fz::file_cache::lease const& l);
+
+	fz::native_string name_;
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(file_cache_test);
+
+void file_cache_test::setUp()
+{
+	name_ = test_file_name("file_cache");
+}
+
+void file_cache_test::tearDown()
+{
+	fz::remove_file(name_);
+	for (int i = 0; i < 3; ++i) {
+		fz::remove_file(name_ + fz::to_native(std::to_string(i)));
+	}
+}
+
+std::string file_cache_test::read(fz::file_cache::lease const& l)
+{
+	std::string ret(static_cast<size_t>(l.size()), '\0');
+	if (!ret.empty()) {
+		ASSERT_EQUAL(l.size(), l->read_at(&ret[0], l.size(), 0));
+	}
+	return ret;
+}
+
+void file_cache_test::test_reuse()
+{
+	write_test_file(name_, "hello");
+
+	fz::file_cache cache;
+	CPPUNIT_ASSERT(!cache.open(name_ + fzT("_missing")));
+	CPPUNIT_ASSERT(!cache.open(fzT(".")));
+	ASSERT_EQUAL(size_t(0), cache.size());
+
+	auto l1 = cache.open(name_);
+	CPPUNIT_ASSERT(l1);
+	ASSERT_EQUAL(int64_t(5), l1.size());
+	CPPUNIT_ASSERT(!l1.modification_time().empty());
+
+	auto l2 = cache.open(name_);
+	CPPUNIT_ASSERT(&*l1 == &*l2);
+	ASSERT_EQUAL(std::string("hello"), read(l2));
+
+	l1 = fz::file_cache::lease();
+	l2 = fz::file_cache::lease();
+
+	// Still open without any leases
+	auto l3 = cache.open(name_);
+	ASSERT_EQUAL(std::string("hello"), read(l3));
+	ASSERT_EQUAL(uint64_t(2), cache.hits());
+	ASSERT_EQUAL(uint64_t(3), cache.misses());
+	ASSERT_EQUAL(size_t(1), cache.size());
+}
+
+void file_cache_test::test_validation()
+{
+	write_test_file(name_, "hello");
+
+	fz::file_cache cache;
+	auto l1 = cache.open(name_);
+	CPPUNIT_ASSERT(l1);
+
+	// Changed size
+	{
+		fz::file f(name_, fz::file::writing);
+		f.seek(0, fz::file::end);
+		f.write(" world", 6);
+	}
+	auto l2 = cache.open(name_);
+	CPPUNIT_ASSERT(l2);
+	CPPUNIT_ASSERT(&*l1 != &*l2);
+	ASSERT_EQUAL(std::string("hello world"), read(l2));
+
+	// Replaced by another file of the same size
+	{
+		fz::atomic_file_writer w(name_);
+		CPPUNIT_ASSERT(w.write(std::string("HELLO WORLD")));
+		CPPUNIT_ASSERT(w.commit(false));
+	}
+	auto l3 = cache.open(name_);
+	CPPUNIT_ASSERT(l3);
+	CPPUNIT_ASSERT(&*l2 != &*l3);
+	ASSERT_EQUAL(std::string("HELLO WORLD"), read(l3));
+
+	// Old leases still refer to the old file
+	ASSERT_EQUAL(std::string("hello world"), read(l2));
+
+	// Rewritten with the same size within the same second
+	fz::sleep(fz::duration::from_milliseconds(20));
+	write_test_file(name_, "hello WORLD");
+	auto l4 = cache.open(name_);
+	CPPUNIT_ASSERT(l4);
+	CPPUNIT_ASSERT(&*l3 != &*l4);
+	CPPUNIT_ASSERT(l3.modification_time() < l4.modification_time());
+
+	// Deleted
+	fz::remove_file(name_);
+	CPPUNIT_ASSERT(!cache.open(name_));
+	ASSERT_EQUAL(size_t(0), cache.size());
+	ASSERT_EQUAL(std::string("hello WORLD"), read(l4));
+}
+
+void file_cache_test::test_limit()
+{
+	std::vector<fz::native_string> names;
+	for (int i = 0; i < 3; ++i) {
+		names.push_back(name_ + fz::to_native(std::to_string(i)));
+		write_test_file(names.back(), std::to_string(i));
+	}
+
+	fz::file_cache cache(2);
+	for (auto const& name : names) {
+		CPPUNIT_ASSERT(cache.open(name));
+	}
+	ASSERT_EQUAL(size_t(2), cache.size());
+
+	// The least recently used one got closed
+	cache.open(names[2]);
+	ASSERT_EQUAL(uint64_t(1), cache.hits());
+	cache.open(names[0]);
+	ASSERT_EQUAL(uint64_t(1), cache.hits());
+
+	// Leased files are not closed
+	std::vector<fz::file_cache::lease> leases;
+	for (auto const& name : names) {
+		leases.push_back(cache.open(name));
+	}
+	ASSERT_EQUAL(size_t(3), cache.size());
+	for (size_t i = 0; i < names.size(); ++i) {
+		ASSERT_EQUAL(std::to_string(i), read(leases[i]));
+	}
+
+	leases.clear();
+	cache.open(names[0]);
+	ASSERT_EQUAL(size_t(2), cache.size());
+
+	cache.invalidate(names[0]);
+	ASSERT_EQUAL(size_t(1), cache.size());
+	cache.clear();
+	ASSERT_EQUAL(size_t(0), cache.size());
+}
+
+void file_cache_test::test_revalidate()
+{
+	write_test_file(name_, "hello");
+
+	fz::file_cache cache(10, fz::duration::from_hours(1));
+	auto l1 = cache.open(name_);
+
+	// Not checked again yet
+	write_test_file(name_, "hello world");
+	auto l2 = cache.open(name_);
+	CPPUNIT_ASSERT(&*l1 == &*l2);
+	ASSERT_EQUAL(int64_t(5), l2.size());
+
+	cache.invalidate(name_);
+	auto l3 = cache.open(name_);
+	CPPUNIT_ASSERT(&*l1 != &*l3);
+	ASSERT_EQUAL(std::string("hello world"), read(l3));
+}
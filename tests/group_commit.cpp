@@ -0,0 +1,141 @@
+#include "libfilezilla/event_handler.hpp"
+#include "libfilezilla/event_loop.hpp"
+#include "libfilezilla/group_commit.hpp"
+#include "libfilezilla/string.hpp"
+#include "libfilezilla/util.hpp"
+
+#include "test_utils.hpp"
+
+#include <atomic>
+#include <map>
+
+/*
+ * This testsuite asserts the correctness of the
+ * group commit helper
+ */
+
+class group_commit_test final : public CppUnit::TestFixture
+{
+	CPPUNIT_TEST_SUITE(group_commit_test);
+	CPPUNIT_TEST(test_blocking);
+	CPPUNIT_TEST(test_async);
+	CPPUNIT_TEST_SUITE_END();
+
+public:
+	void setUp();
+	void tearDown();
+
+	void test_blocking();
+	void test_async();
+
+private:
+	fz::native_string name_;
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(group_commit_test);
+
+namespace {
+class commit_collector final : public fz::event_handler
+{
+public:
+	explicit commit_collector(fz::event_loop & l)
+		: fz::event_handler(l)
+	{}
+
+	virtual ~commit_collector()
+	{
+		remove_handler();
+	}
+
+	virtual void operator()(fz::event_base const& ev) override
+	{
+		fz::dispatch<fz::group_commit_event>(ev, this, &commit_collector::on_commit);
+	}
+
+	void on_commit(fz::file* f, bool result)
+	{
+		fz::scoped_lock l(m_);
+		if (result) {
+			++committed_[f];
+		}
+		cond_.broadcast(l);
+	}
+
+	bool wait(fz::file* f, int count)
+	{
+		fz::scoped_lock l(m_);
+		return cond_.wait_until(l, fz::monotonic_clock::now() + fz::duration::from_seconds(10), [&]() { return committed_[f] >= count; });
+	}
+
+	fz::mutex m_{false};
+	fz::broadcast_condition cond_;
+	std::map<fz::file*, int> committed_;
+};
+}
+
+void group_commit_test::setUp()
+{
+	name_ = test_file_name("group_commit");
+}
+
+void group_commit_test::tearDown()
+{
+	fz::remove_file(name_);
+}
+
+void group_commit_test::test_blocking()
+{
+	fz::file f(name_, fz::file::writing, fz::file::empty);
+	CPPUNIT_ASSERT(f.opened());
+
+	fz::group_commit gc(fz::duration::from_milliseconds(5));
+
+	fz::thread_pool pool;
+	std::atomic<int64_t> offset{};
+	std::atomic<int> committed{};
+	std::vector<fz::async_task> tasks;
+	for (int i = 0; i < 8; ++i) {
+		tasks.emplace_back(pool.spawn([&]() {
+			for (int j = 0; j < 10; ++j) {
+				std::string const record = "record " + std::to_string(j) + "\n";
+				int64_t const pos = offset.fetch_add(static_cast<int64_t>(record.size()));
+				if (f.write_at(record.c_str(), static_cast<int64_t>(record.size()), pos) == static_cast<int64_t>(record.size()) && gc.commit(f)) {
+					++committed;
+				}
+			}
+		}));
+	}
+	tasks.clear();
+
+	ASSERT_EQUAL(80, committed.load());
+	ASSERT_EQUAL(offset.load(), f.size());
+}
+
+void group_commit_test::test_async()
+{
+	fz::file f1(name_, fz::file::writing, fz::file::empty);
+	CPPUNIT_ASSERT(f1.opened());
+	fz::file f2(name_ + fzT("_2"), fz::file::writing, fz::file::empty);
+	CPPUNIT_ASSERT(f2.opened());
+
+	fz::event_loop loop;
+	commit_collector c(loop);
+
+	{
+		fz::group_commit gc;
+		for (int i = 0; i < 20; ++i) {
+			fz::file & f = (i % 2) ? f2 : f1;
+			f.write("data", 4);
+			gc.commit(f, c);
+		}
+		CPPUNIT_ASSERT(c.wait(&f1, 10));
+		CPPUNIT_ASSERT(c.wait(&f2, 10));
+
+		// Cancelled commits still happen, but are not reported
+		commit_collector other(loop);
+		gc.commit(f1, other);
+		gc.cancel(other);
+	}
+
+	fz::remove_file(name_ + fzT("_2"));
+}
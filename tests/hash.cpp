@@ -0,0 +1,149 @@
+#include "libfilezilla/file.hpp"
+#include "libfilezilla/hash.hpp"
+#include "libfilezilla/string.hpp"
+#include "libfilezilla/thread_pool.hpp"
+#include "libfilezilla/util.hpp"
+
+#include "test_utils.hpp"
+
+#include <random>
+
+/*
+ * This testsuite asserts the correctness of the
+ * checksum and hash functions
+ */
+
+class hash_test final : public CppUnit::TestFixture
+{
+	CPPUNIT_TEST_SUITE(hash_test);
+	CPPUNIT_TEST(test_crc32c);
+	CPPUNIT_TEST(test_xxh64);
+	CPPUNIT_TEST(test_sha256);
+	CPPUNIT_TEST(test_streaming);
+	CPPUNIT_TEST(test_file);
+	CPPUNIT_TEST_SUITE_END();
+
+public:
+	void setUp() {}
+	void tearDown() {}
+
+	void test_crc32c();
+	void test_xxh64();
+	void test_sha256();
+	void test_streaming();
+	void test_file();
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(hash_test);
+
+namespace {
+// Seeded, fz::random_number is far too slow to generate megabytes of data
+std::string random_string(size_t size)
+{
+	std::mt19937 gen(static_cast<std::mt19937::result_type>(size));
+	std::string ret(size, '\0');
+	for (auto & c : ret) {
+		c = static_cast<char>(gen());
+	}
+	return ret;
+}
+}
+
+void hash_test::test_crc32c()
+{
+	ASSERT_EQUAL(uint32_t(0), fz::crc32c("", 0));
+	ASSERT_EQUAL(uint32_t(0xe3069283), fz::crc32c("123456789", 9));
+
+	std::string const zeroes(32, '\0');
+	ASSERT_EQUAL(uint32_t(0x8a9136aa), fz::crc32c(zeroes.c_str(), zeroes.size()));
+	std::string const ones(32, '\xff');
+	ASSERT_EQUAL(uint32_t(0x62a8ab43), fz::crc32c(ones.c_str(), ones.size()));
+
+	// Chaining
+	ASSERT_EQUAL(uint32_t(0xe3069283), fz::crc32c("6789", 4, fz::crc32c("12345", 5)));
+
+	fz::hash_accumulator acc(fz::hash_algorithm::crc32c);
+	acc.update(std::string("123456789"));
+	ASSERT_EQUAL(std::string("e3069283"), fz::hex_encode<std::string>(acc.digest()));
+}
+
+void hash_test::test_xxh64()
+{
+	ASSERT_EQUAL(uint64_t(0xef46db3751d8e999ull), fz::xxh64("", 0));
+	ASSERT_EQUAL(uint64_t(0x44bc2cf5ad770999ull), fz::xxh64("abc", 3));
+
+	std::string const long_input = "Nobody inspects the spammish repetition";
+	ASSERT_EQUAL(uint64_t(0xfbcea83c8a378bf1ull), fz::xxh64(long_input.c_str(), long_input.size()));
+
+	fz::hash_accumulator acc(fz::hash_algorithm::xxh64);
+	acc.update(long_input);
+	ASSERT_EQUAL(std::string("fbcea83c8a378bf1"), fz::hex_encode<std::string>(acc.digest()));
+}
+
+void hash_test::test_sha256()
+{
+	ASSERT_EQUAL(std::string("e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855"), fz::hex_encode<std::string>(fz::sha256("")));
+	ASSERT_EQUAL(std::string("ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad"), fz::hex_encode<std::string>(fz::sha256("abc")));
+	ASSERT_EQUAL(std::string("248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1"),
+		fz::hex_encode<std::string>(fz::sha256("abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq")));
+	ASSERT_EQUAL(std::string("cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0"), fz::hex_encode<std::string>(fz::sha256(std::string(1000000, 'a'))));
+}
+
+void hash_test::test_streaming()
+{
+	std::string const data = random_string(100000);
+
+	for (auto const algorithm : { fz::hash_algorithm::crc32c, fz::hash_algorithm::xxh64, fz::hash_algorithm::sha256 }) {
+		fz::hash_accumulator acc(algorithm);
+		acc.update(data);
+		auto const expected = acc.digest();
+		ASSERT_EQUAL(fz::digest_size(algorithm), expected.size());
+
+		// Digest resets the accumulator
+		acc.update(data);
+		CPPUNIT_ASSERT(expected == acc.digest());
+
+		size_t pos{};
+		while (pos < data.size()) {
+			size_t const chunk = std::min(data.size() - pos, static_cast<size_t>(fz::random_number(0, 200)));
+			acc.update(data.c_str() + pos, chunk);
+			pos += chunk;
+		}
+		CPPUNIT_ASSERT(expected == acc.digest());
+
+		acc.update("garbage", 7);
+		acc.reset();
+		acc.update(data);
+		CPPUNIT_ASSERT(expected == acc.digest());
+	}
+}
+
+void hash_test::test_file()
+{
+	fz::native_string const name = test_file_name("hash");
+
+	std::string const data = random_string(3 * 1024 * 1024 + 5);
+	write_test_file(name, data);
+
+	fz::file f(name, fz::file::reading);
+	CPPUNIT_ASSERT(f.opened());
+
+	CPPUNIT_ASSERT(fz::sha256(data) == fz::hash_file(f, fz::hash_algorithm::sha256));
+	CPPUNIT_ASSERT(fz::sha256(data.substr(1000, 5000)) == fz::hash_file(f, fz::hash_algorithm::sha256, 1000, 5000));
+	CPPUNIT_ASSERT(fz::hash_file(f, fz::hash_algorithm::sha256, 1000, static_cast<int64_t>(data.size())).empty());
+
+	int64_t const segment_size = 1024 * 1024;
+	fz::thread_pool pool;
+	auto const segments = fz::hash_file_segments(f, fz::hash_algorithm::sha256, segment_size, pool);
+	ASSERT_EQUAL(size_t(4), segments.size());
+
+	fz::hash_accumulator root(fz::hash_algorithm::sha256);
+	for (size_t i = 0; i < segments.size(); ++i) {
+		CPPUNIT_ASSERT(fz::sha256(data.substr(i * segment_size, segment_size)) == segments[i]);
+		root.update(segments[i]);
+	}
+	CPPUNIT_ASSERT(root.digest() == fz::hash_file_tree(f, fz::hash_algorithm::sha256, segment_size, pool));
+
+	f.close();
+	fz::remove_file(name);
+}
@@ -0,0 +1,159 @@
+#include "libfilezilla/file.hpp"
+#include "libfilezilla/local_filesys.hpp"
+#include "libfilezilla/recursive_remove.hpp"
+#include "libfilezilla/string.hpp"
+#include "libfilezilla/util.hpp"
+
+#include "test_utils.hpp"
+
+#include <map>
+
+#ifndef FZ_WINDOWS
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/*
+ * This testsuite asserts the correctness of the
+ * directory enumeration in local_filesys
+ */
+
+class local_filesys_test final : public CppUnit::TestFixture
+{
+	CPPUNIT_TEST_SUITE(local_filesys_test);
+	CPPUNIT_TEST(test_enumerate);
+	CPPUNIT_TEST(test_dirs_only);
+	CPPUNIT_TEST_SUITE_END();
+
+public:
+	void setUp();
+	void tearDown();
+
+	void test_enumerate();
+	void test_dirs_only();
+
+private:
+	struct entry
+	{
+		bool is_link{};
+		bool is_dir{};
+		int64_t size{-2};
+		fz::datetime mtime;
+	};
+
+	std::map<fz::native_string, entry> enumerate(bool attributes, bool dirs_only);
+
+	fz::native_string path_;
+	bool links_{};
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(local_filesys_test);
+
+namespace {
+bool make_dir(fz::native_string const& path)
+{
+#ifdef FZ_WINDOWS
+	return CreateDirectoryW(path.c_str(), nullptr) != 0;
+#else
+	return !mkdir(path.c_str(), 0700);
+#endif
+}
+}
+
+void local_filesys_test::setUp()
+{
+	path_ = test_file_name("local_filesys");
+	CPPUNIT_ASSERT(make_dir(path_));
+	CPPUNIT_ASSERT(make_dir(path_ + fzT("/dir")));
+
+	write_test_file(path_ + fzT("/file"), "hello");
+
+#ifndef FZ_WINDOWS
+	links_ = !symlink("file", (path_ + "/link_file").c_str()) &&
+		!symlink("dir", (path_ + "/link_dir").c_str()) &&
+		!symlink("missing", (path_ + "/link_dangling").c_str());
+#endif
+}
+
+void local_filesys_test::tearDown()
+{
+	fz::recursive_remove().remove(path_);
+}
+
+std::map<fz::native_string, local_filesys_test::entry> local_filesys_test::enumerate(bool attributes, bool dirs_only)
+{
+	std::map<fz::native_string, entry> ret;
+
+	fz::local_filesys fs;
+	CPPUNIT_ASSERT(fs.begin_find_files(path_, dirs_only));
+
+	fz::native_string name;
+	entry e;
+	while (attributes ? fs.get_next_file(name, e.is_link, e.is_dir, &e.size, &e.mtime, nullptr) : fs.get_next_file(name, e.is_link, e.is_dir, nullptr, nullptr, nullptr)) {
+		ret[name] = e;
+	}
+
+	return ret;
+}
+
+void local_filesys_test::test_enumerate()
+{
+	for (bool attributes : {false, true}) {
+		auto entries = enumerate(attributes, false);
+		ASSERT_EQUAL(size_t(links_ ? 5 : 2), entries.size());
+
+		CPPUNIT_ASSERT(!entries[fzT("file")].is_dir);
+		CPPUNIT_ASSERT(!entries[fzT("file")].is_link);
+		CPPUNIT_ASSERT(entries[fzT("dir")].is_dir);
+		CPPUNIT_ASSERT(!entries[fzT("dir")].is_link);
+
+		if (attributes) {
+			ASSERT_EQUAL(int64_t(5), entries[fzT("file")].size);
+			ASSERT_EQUAL(int64_t(-1), entries[fzT("dir")].size);
+
+			auto const now = fz::datetime::now();
+			CPPUNIT_ASSERT(!entries[fzT("file")].mtime.empty());
+			CPPUNIT_ASSERT((now - entries[fzT("file")].mtime) < fz::duration::from_minutes(10));
+			CPPUNIT_ASSERT(entries[fzT("file")].mtime == fz::local_filesys::get_modification_time(path_ + fzT("/file")));
+		}
+		else {
+			// Untouched if not requested
+			ASSERT_EQUAL(int64_t(-2), entries[fzT("file")].size);
+		}
+
+		if (links_) {
+			// Links are followed
+			CPPUNIT_ASSERT(entries[fzT("link_file")].is_link);
+			CPPUNIT_ASSERT(!entries[fzT("link_file")].is_dir);
+			CPPUNIT_ASSERT(entries[fzT("link_dir")].is_link);
+			CPPUNIT_ASSERT(entries[fzT("link_dir")].is_dir);
+			CPPUNIT_ASSERT(!entries[fzT("link_dangling")].is_dir);
+			if (attributes) {
+				ASSERT_EQUAL(int64_t(5), entries[fzT("link_file")].size);
+				ASSERT_EQUAL(int64_t(-1), entries[fzT("link_dangling")].size);
+			}
+		}
+	}
+}
+
+void local_filesys_test::test_dirs_only()
+{
+	for (bool attributes : {false, true}) {
+		auto entries = enumerate(attributes, true);
+		ASSERT_EQUAL(size_t(links_ ? 2 : 1), entries.size());
+		CPPUNIT_ASSERT(entries[fzT("dir")].is_dir);
+		if (links_) {
+			CPPUNIT_ASSERT(entries[fzT("link_dir")].is_dir);
+		}
+	}
+
+	fz::local_filesys fs;
+	CPPUNIT_ASSERT(fs.begin_find_files(path_, true));
+	fz::native_string name;
+	int count{};
+	while (fs.get_next_file(name)) {
+		CPPUNIT_ASSERT(name == fzT("dir") || name == fzT("link_dir"));
+		++count;
+	}
+	ASSERT_EQUAL(links_ ? 2 : 1, count);
+}
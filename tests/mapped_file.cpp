@@ -0,0 +1,159 @@
+#include "libfilezilla/file.hpp"
+#include "libfilezilla/mapped_file.hpp"
+#include "libfilezilla/util.hpp"
+
+#include "test_utils.hpp"
+
+#include <memory>
+#include <vector>
+#include <string.h>
+
+/*
+ * This testsuite asserts the correctness of the
+ * memory-mapped file access
+ */
+
+class mapped_file_test final : public CppUnit::TestFixture
+{
+	CPPUNIT_TEST_SUITE(mapped_file_test);
+	CPPUNIT_TEST(test_read);
+	CPPUNIT_TEST(test_window);
+	CPPUNIT_TEST(test_write);
+#ifndef FZ_WINDOWS
+	CPPUNIT_TEST(test_truncate);
+#endif
+	CPPUNIT_TEST_SUITE_END();
+
+public:
+	void setUp();
+	void tearDown();
+
+	void test_read();
+	void test_window();
+	void test_write();
+	void test_truncate();
+
+private:
+	fz::native_string name_;
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(mapped_file_test);
+
+void mapped_file_test::setUp()
+{
+	name_ = test_file_name("mapped_file");
+}
+
+void mapped_file_test::tearDown()
+{
+	fz::remove_file(name_);
+}
+
+void mapped_file_test::test_read()
+{
+	write_test_file(name_, "Hello, World");
+
+	fz::mapped_file m;
+	CPPUNIT_ASSERT(!m.opened());
+	CPPUNIT_ASSERT(!m.map());
+
+	CPPUNIT_ASSERT(m.open(name_));
+	ASSERT_EQUAL(int64_t(12), m.size());
+	CPPUNIT_ASSERT(!m.data());
+
+	CPPUNIT_ASSERT(m.map());
+	ASSERT_EQUAL(size_t(12), m.length());
+	ASSERT_EQUAL(std::string("Hello, World"), std::string(reinterpret_cast<char const*>(m.data()), m.length()));
+	CPPUNIT_ASSERT(m.advise(fz::mapped_file::sequential));
+	CPPUNIT_ASSERT(!m.truncated());
+
+	// Empty window at the end, nothing past it
+	CPPUNIT_ASSERT(m.map(12));
+	ASSERT_EQUAL(size_t(0), m.length());
+	CPPUNIT_ASSERT(!m.map(13));
+	CPPUNIT_ASSERT(!m.data());
+
+	fz::mapped_file missing(name_ + fz::to_native("_missing"));
+	CPPUNIT_ASSERT(!missing.opened());
+}
+
+void mapped_file_test::test_window()
+{
+	size_t const g = fz::mapped_file::granularity();
+	std::string content;
+	for (size_t i = 0; i < 3 * g + 100; ++i) {
+		content += static_cast<char>('a' + i % 26);
+	}
+	write_test_file(name_, content);
+
+	fz::mapped_file m(name_);
+	CPPUNIT_ASSERT(m.opened());
+	CPPUNIT_ASSERT(m.advise(fz::mapped_file::random));
+
+	// Slide an unaligned window over the file
+	std::string copy;
+	int64_t const window = static_cast<int64_t>(g) + 7;
+	for (int64_t offset = 0; offset < m.size(); offset += window) {
+		CPPUNIT_ASSERT(m.map(offset, window));
+		ASSERT_EQUAL(offset, m.offset());
+		copy.append(reinterpret_cast<char const*>(m.data()), m.length());
+	}
+	CPPUNIT_ASSERT(copy == content);
+}
+
+void mapped_file_test::test_write()
+{
+	write_test_file(name_, "Hello, World");
+
+	{
+		fz::mapped_file m(name_, fz::mapped_file::writing);
+		CPPUNIT_ASSERT(m.map(7, 5));
+		memcpy(m.data(), "Earth", 5);
+		CPPUNIT_ASSERT(m.flush());
+	}
+
+	fz::file f(name_, fz::file::reading);
+	char buf[12];
+	ASSERT_EQUAL(int64_t(12), f.read(buf, 12));
+	ASSERT_EQUAL(std::string("Hello, Earth"), std::string(buf, 12));
+}
+
+void mapped_file_test::test_truncate()
+{
+	size_t const g = fz::mapped_file::granularity();
+	write_test_file(name_, std::string(4 * g, 'x'));
+
+	fz::mapped_file m(name_);
+	CPPUNIT_ASSERT(!m.guarded());
+	CPPUNIT_ASSERT(m.map());
+	CPPUNIT_ASSERT(m.guarded());
+	ASSERT_EQUAL('x', static_cast<char>(m.data()[0]));
+
+	// Only a limited number of windows can be guarded at the same time
+	{
+		std::vector<std::unique_ptr<fz::mapped_file>> others;
+		while (others.size() < 1000) {
+			others.emplace_back(new fz::mapped_file(name_));
+			CPPUNIT_ASSERT(others.back()->map());
+			if (!others.back()->guarded()) {
+				break;
+			}
+		}
+		CPPUNIT_ASSERT(!others.back()->guarded());
+	}
+
+	{
+		fz::file f(name_, fz::file::writing);
+		CPPUNIT_ASSERT(f.seek(g, fz::file::begin) == static_cast<int64_t>(g));
+		CPPUNIT_ASSERT(f.truncate());
+	}
+
+	// Still within the file
+	ASSERT_EQUAL('x', static_cast<char>(m.data()[g - 1]));
+	CPPUNIT_ASSERT(!m.truncated());
+
+	// Past the new end
+	ASSERT_EQUAL(0, static_cast<int>(m.data()[2 * g + 5]));
+	CPPUNIT_ASSERT(m.truncated());
+	ASSERT_EQUAL(0, static_cast<int>(m.data()[4 * g - 1]));
+}
@@ -0,0 +1,309 @@
+#include "libfilezilla/mutex.hpp"
+#include "libfilezilla/thread_pool.hpp"
+#include "libfilezilla/util.hpp"
+
+#include "test_utils.hpp"
+
+#include <atomic>
+
+/*
+ * This testsuite asserts the correctness of the
+ * thread synchronization primitives
+ */
+
+class mutex_test final : public CppUnit::TestFixture
+{
+	CPPUNIT_TEST_SUITE(mutex_test);
+	CPPUNIT_TEST(test_adaptive);
+	CPPUNIT_TEST(test_adaptive_condition);
+	CPPUNIT_TEST(test_wait_until);
+	CPPUNIT_TEST(test_broadcast);
+	CPPUNIT_TEST(test_rwlock);
+	CPPUNIT_TEST(test_seqlock);
+	CPPUNIT_TEST(test_profiling);
+	CPPUNIT_TEST_SUITE_END();
+
+public:
+	void setUp() {}
+	void tearDown() {}
+
+	void test_adaptive();
+	void test_adaptive_condition();
+	void test_wait_until();
+	void test_broadcast();
+	void test_rwlock();
+	void test_seqlock();
+	void test_profiling();
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(mutex_test);
+
+void mutex_test::test_adaptive()
+{
+	fz::adaptive_mutex m;
+	int counter{};
+
+	{
+		fz::thread_pool pool;
+		std::vector<fz::async_task> tasks;
+		for (int i = 0; i < 4; ++i) {
+			tasks.emplace_back(pool.spawn([&]() {
+				for (int j = 0; j < 100000; ++j) {
+					fz::scoped_lock l(m);
+					++counter;
+				}
+			}));
+		}
+	}
+
+	ASSERT_EQUAL(400000, counter);
+
+	CPPUNIT_ASSERT(m.try_lock());
+	CPPUNIT_ASSERT(!m.try_lock());
+	m.unlock();
+
+	fz::scoped_lock l(m);
+	l.unlock();
+	CPPUNIT_ASSERT(m.try_lock());
+	m.unlock();
+	l.lock();
+	CPPUNIT_ASSERT(!m.try_lock());
+}
+
+void mutex_test::test_adaptive_condition()
+{
+	fz::adaptive_mutex m;
+	fz::condition c;
+
+	fz::thread_pool pool;
+
+	fz::scoped_lock l(m);
+	fz::async_task task = pool.spawn([&]() {
+		fz::scoped_lock l(m);
+		c.signal(l);
+	});
+	CPPUNIT_ASSERT(c.wait(l, fz::duration::from_seconds(5)));
+	l.unlock();
+
+	task.join();
+
+	l.lock();
+	CPPUNIT_ASSERT(!c.wait(l, fz::duration::from_milliseconds(10)));
+}
+
+void mutex_test::test_wait_until()
+{
+	fz::mutex m;
+	fz::condition c;
+	fz::broadcast_condition b;
+
+	auto const start = fz::monotonic_clock::now();
+	auto const deadline = start + fz::duration::from_milliseconds(100);
+
+	fz::scoped_lock l(m);
+	CPPUNIT_ASSERT(!c.wait_until(l, deadline));
+	CPPUNIT_ASSERT(fz::monotonic_clock::now() >= deadline);
+
+	// Deadline in the past
+	CPPUNIT_ASSERT(!b.wait_until(l, start));
+	CPPUNIT_ASSERT(!b.wait_until(l, start, []() { return false; }));
+	CPPUNIT_ASSERT(b.wait_until(l, start, []() { return true; }));
+
+	// Latched signal
+	c.signal(l);
+	CPPUNIT_ASSERT(c.wait_until(l, start));
+	CPPUNIT_ASSERT(!c.signalled(l));
+}
+
+void mutex_test::test_broadcast()
+{
+	fz::mutex m;
+	fz::broadcast_condition cond;
+
+	int waiting{};
+	bool go{};
+	int woken{};
+
+	fz::thread_pool pool;
+	std::vector<fz::async_task> tasks;
+	for (int i = 0; i < 5; ++i) {
+		tasks.emplace_back(pool.spawn([&]() {
+			fz::scoped_lock l(m);
+			++waiting;
+			cond.broadcast(l);
+			if (cond.wait_until(l, fz::monotonic_clock::now() + fz::duration::from_seconds(10), [&]() { return go; })) {
+				++woken;
+			}
+		}));
+	}
+
+	{
+		fz::scoped_lock l(m);
+		cond.wait(l, [&]() { return waiting == 5; });
+		go = true;
+		cond.broadcast(l);
+	}
+	tasks.clear();
+
+	ASSERT_EQUAL(5, woken);
+}
+
+void mutex_test::test_rwlock()
+{
+	fz::rwlock rw;
+	fz::thread_pool pool;
+
+	{
+		// Multiple readers at the same time
+		fz::scoped_read_lock r(rw);
+
+		bool other_reader{};
+		pool.spawn([&]() {
+			fz::scoped_read_lock r(rw);
+			other_reader = true;
+		}).join();
+		CPPUNIT_ASSERT(other_reader);
+	}
+
+	// Writers are exclusive
+	int value{};
+	std::atomic<bool> inside{};
+	std::atomic<bool> overlap{};
+	{
+		std::vector<fz::async_task> tasks;
+		for (int i = 0; i < 4; ++i) {
+			tasks.emplace_back(pool.spawn([&]() {
+				for (int j = 0; j < 10000; ++j) {
+					if (j % 10) {
+						fz::scoped_read_lock r(rw);
+						if (inside) {
+							overlap = true;
+						}
+					}
+					else {
+						fz::scoped_write_lock w(rw);
+						if (inside.exchange(true)) {
+							overlap = true;
+						}
+						++value;
+						inside = false;
+					}
+				}
+			}));
+		}
+	}
+
+	CPPUNIT_ASSERT(!overlap);
+	ASSERT_EQUAL(4000, value);
+}
+
+namespace {
+struct pair_value
+{
+	uint64_t a;
+	uint64_t b;
+	uint32_t c;
+};
+}
+
+void mutex_test::test_seqlock()
+{
+	fz::seqlock<pair_value> s(pair_value{1, 1, 1});
+
+	pair_value v = s.load();
+	ASSERT_EQUAL(uint64_t(1), v.a);
+
+	fz::thread_pool pool;
+
+	std::atomic<bool> done{};
+	std::atomic<bool> torn{};
+
+	std::vector<fz::async_task> readers;
+	for (int i = 0; i < 3; ++i) {
+		readers.emplace_back(pool.spawn([&]() {
+			while (!done) {
+				pair_value const v = s.load();
+				if (v.a != v.b || v.b != v.c) {
+					torn = true;
+				}
+			}
+		}));
+	}
+
+	for (uint32_t i = 2; i < 100000; ++i) {
+		s.store(pair_value{i, i, i});
+	}
+	done = true;
+	readers.clear();
+
+	CPPUNIT_ASSERT(!torn);
+	ASSERT_EQUAL(uint32_t(99999), s.load().c);
+}
+
+namespace {
+fz::lock_statistics find_statistics(std::string const& name)
+{
+	for (auto const& stats : fz::get_lock_statistics()) {
+		if (stats.name == name) {
+			return stats;
+		}
+	}
+	return fz::lock_statistics();
+}
+}
+
+void mutex_test::test_profiling()
+{
+	fz::mutex m("test_profiling", false);
+	fz::mutex other("test_profiling_other");
+	fz::condition c;
+
+	CPPUNIT_ASSERT(!fz::lock_profiling_enabled());
+	{
+		fz::scoped_lock l(m);
+	}
+	ASSERT_EQUAL(uint64_t(0), find_statistics("test_profiling").acquisitions);
+
+	fz::enable_lock_profiling();
+	CPPUNIT_ASSERT(fz::lock_profiling_enabled());
+
+	{
+		fz::thread_pool pool;
+
+		fz::scoped_lock l(m);
+		fz::async_task task = pool.spawn([&]() {
+			fz::scoped_lock l(m);
+			fz::scoped_lock lo(other);
+		});
+		fz::sleep(fz::duration::from_milliseconds(50));
+
+		// Waiting on a condition does not count towards the hold time
+		c.wait(l, fz::duration::from_milliseconds(100));
+		c.wait(l, fz::duration::from_milliseconds(50));
+		l.unlock();
+		task.join();
+	}
+
+	fz::enable_lock_profiling(false);
+	{
+		fz::scoped_lock l(m);
+	}
+
+	auto stats = find_statistics("test_profiling");
+	ASSERT_EQUAL(uint64_t(2), stats.acquisitions);
+	ASSERT_EQUAL(uint64_t(1), stats.contended);
+	CPPUNIT_ASSERT(stats.hold_time >= 50000000);
+	CPPUNIT_ASSERT(stats.hold_time < 200000000);
+	CPPUNIT_ASSERT(stats.wait_time > 0);
+
+	// Hottest first
+	auto const top = fz::get_lock_statistics(1);
+	ASSERT_EQUAL(size_t(1), top.size());
+	CPPUNIT_ASSERT(top[0].wait_time >= stats.wait_time);
+
+	ASSERT_EQUAL(uint64_t(1), find_statistics("test_profiling_other").acquisitions);
+	ASSERT_EQUAL(uint64_t(0), find_statistics("test_profiling_other").contended);
+
+	fz::reset_lock_statistics();
+	ASSERT_EQUAL(uint64_t(0), find_statistics("test_profiling").acquisitions);
+}
@@ -0,0 +1,181 @@
+#include "libfilezilla/file.hpp"
+#include "libfilezilla/mutex.hpp"
+#include "libfilezilla/parallel_read.hpp"
+#include "libfilezilla/semaphore.hpp"
+#include "libfilezilla/string.hpp"
+#include "libfilezilla/thread_pool.hpp"
+#include "libfilezilla/util.hpp"
+
+#include "test_utils.hpp"
+
+#include <string.h>
+
+/*
+ * This testsuite asserts the correctness of the
+ * parallel segmented reads
+ */
+
+class parallel_read_test final : public CppUnit::TestFixture
+{
+	CPPUNIT_TEST_SUITE(parallel_read_test);
+	CPPUNIT_TEST(test_in_order);
+	CPPUNIT_TEST(test_out_of_order);
+	CPPUNIT_TEST(test_range);
+	CPPUNIT_TEST(test_abort);
+	CPPUNIT_TEST(test_busy_pool);
+	CPPUNIT_TEST_SUITE_END();
+
+public:
+	void setUp();
+	void tearDown();
+
+	void test_in_order();
+	void test_out_of_order();
+	void test_range();
+	void test_abort();
+	void test_busy_pool();
+
+private:
+	fz::native_string name_;
+	std::string data_;
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(parallel_read_test);
+
+void parallel_read_test::setUp()
+{
+	name_ = test_file_name("parallel_read");
+
+	data_.clear();
+	for (int i = 0; i < 50000; ++i) {
+		data_ += std::to_string(i) + "\n";
+	}
+
+	write_test_file(name_, data_);
+}
+
+void parallel_read_test::tearDown()
+{
+	fz::remove_file(name_);
+}
+
+void parallel_read_test::test_in_order()
+{
+	fz::file f(name_, fz::file::reading);
+	CPPUNIT_ASSERT(f.opened());
+
+	fz::thread_pool pool;
+	fz::parallel_read_options options;
+	options.segment_size = 4096;
+	options.parallel = 4;
+
+	std::string read;
+	ASSERT_EQUAL(int64_t(data_.size()), fz::read_segments(f, pool, [&](uint8_t const* data, size_t size, int64_t offset) {
+		if (offset != static_cast<int64_t>(read.size()) || size > 4096) {
+			return false;
+		}
+		read.append(reinterpret_cast<char const*>(data), size);
+		return true;
+	}, 0, -1, options));
+	CPPUNIT_ASSERT(read == data_);
+}
+
+void parallel_read_test::test_out_of_order()
+{
+	fz::file f(name_, fz::file::reading);
+	CPPUNIT_ASSERT(f.opened());
+
+	fz::thread_pool pool;
+	fz::parallel_read_options options;
+	options.segment_size = 10000;
+	options.parallel = 8;
+	options.in_order = false;
+
+	fz::mutex m;
+	std::string read(data_.size(), '\0');
+	int64_t total{};
+	ASSERT_EQUAL(int64_t(data_.size()), fz::read_segments(f, pool, [&](uint8_t const* data, size_t size, int64_t offset) {
+		fz::scoped_lock l(m);
+		memcpy(&read[static_cast<size_t>(offset)], data, size);
+		total += static_cast<int64_t>(size);
+		return true;
+	}, 0, -1, options));
+	ASSERT_EQUAL(int64_t(data_.size()), total);
+	CPPUNIT_ASSERT(read == data_);
+}
+
+void parallel_read_test::test_range()
+{
+	fz::file f(name_, fz::file::reading);
+	CPPUNIT_ASSERT(f.opened());
+
+	fz::thread_pool pool;
+	fz::parallel_read_options options;
+	options.segment_size = 1000;
+
+	std::string read;
+	auto const append = [&](uint8_t const* data, size_t size, int64_t) {
+		read.append(reinterpret_cast<char const*>(data), size);
+		return true;
+	};
+
+	ASSERT_EQUAL(int64_t(2500), fz::read_segments(f, pool, append, 123, 2500, options));
+	CPPUNIT_ASSERT(read == data_.substr(123, 2500));
+
+	// Range extending beyond the end of the file
+	read.clear();
+	ASSERT_EQUAL(int64_t(5000), fz::read_segments(f, pool, append, static_cast<int64_t>(data_.size()) - 5000, 100000, options));
+	CPPUNIT_ASSERT(read == data_.substr(data_.size() - 5000));
+
+	read.clear();
+	ASSERT_EQUAL(int64_t(0), fz::read_segments(f, pool, append, static_cast<int64_t>(data_.size()), -1, options));
+	CPPUNIT_ASSERT(read.empty());
+}
+
+void parallel_read_test::test_abort()
+{
+	fz::file f(name_, fz::file::reading);
+	CPPUNIT_ASSERT(f.opened());
+
+	fz::thread_pool pool;
+	fz::parallel_read_options options;
+	options.segment_size = 1000;
+
+	int calls{};
+	ASSERT_EQUAL(int64_t(-1), fz::read_segments(f, pool, [&](uint8_t const*, size_t, int64_t) {
+		return ++calls < 3;
+	}, 0, -1, options));
+	ASSERT_EQUAL(3, calls);
+
+	options.in_order = false;
+	ASSERT_EQUAL(int64_t(-1), fz::read_segments(f, pool, [](uint8_t const*, size_t, int64_t offset) {
+		return offset < 100000;
+	}, 0, -1, options));
+
+	fz::file closed;
+	ASSERT_EQUAL(int64_t(-1), fz::read_segments(closed, pool, [](uint8_t const*, size_t, int64_t) { return true; }));
+}
+
+void parallel_read_test::test_busy_pool()
+{
+	fz::file f(name_, fz::file::reading);
+	CPPUNIT_ASSERT(f.opened());
+
+	// The only thread of the pool is busy, so no reader can start
+	fz::thread_pool pool;
+	pool.set_max_threads(1);
+	fz::semaphore release;
+	fz::async_task busy = pool.spawn([&]() { release.acquire(); });
+
+	fz::parallel_read_options options;
+	options.segment_size = 4096;
+
+	std::string read;
+	ASSERT_EQUAL(int64_t(data_.size()), fz::read_segments(f, pool, [&](uint8_t const* data, size_t size, int64_t) {
+		read.append(reinterpret_cast<char const*>(data), size);
+		return true;
+	}, 0, -1, options));
+	CPPUNIT_ASSERT(read == data_);
+
+	release.release();
+}
@@ -0,0 +1,203 @@
+#include "libfilezilla/event_handler.hpp"
+#include "libfilezilla/event_loop.hpp"
+#include "libfilezilla/file.hpp"
+#include "libfilezilla/rate_limiter.hpp"
+#include "libfilezilla/string.hpp"
+#include "libfilezilla/util.hpp"
+
+#include "test_utils.hpp"
+
+/*
+ * This testsuite asserts the correctness of the
+ * token bucket rate limiter
+ */
+
+class rate_limiter_test final : public CppUnit::TestFixture
+{
+	CPPUNIT_TEST_SUITE(rate_limiter_test);
+	CPPUNIT_TEST(test_unlimited);
+	CPPUNIT_TEST(test_hierarchy);
+	CPPUNIT_TEST(test_refill);
+	CPPUNIT_TEST(test_wait);
+	CPPUNIT_TEST(test_reader);
+	CPPUNIT_TEST_SUITE_END();
+
+public:
+	void setUp();
+	void tearDown();
+
+	void test_unlimited();
+	void test_hierarchy();
+	void test_refill();
+	void test_wait();
+	void test_reader();
+
+private:
+	fz::native_string name_;
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(rate_limiter_test);
+
+void rate_limiter_test::setUp()
+{
+	name_ = test_file_name("rate_limiter");
+}
+
+void rate_limiter_test::tearDown()
+{
+	fz::remove_file(name_);
+}
+
+void rate_limiter_test::test_unlimited()
+{
+	fz::token_bucket b;
+	ASSERT_EQUAL(int64_t(1000000000), b.consume(1000000000));
+	ASSERT_EQUAL(int64_t(1000000000), b.consume(1000000000));
+	CPPUNIT_ASSERT(!b.wait_time(1000000000));
+
+	fz::token_bucket blocked(0);
+	ASSERT_EQUAL(int64_t(0), blocked.consume(1));
+	CPPUNIT_ASSERT(blocked.wait_time());
+}
+
+void rate_limiter_test::test_hierarchy()
+{
+	// Slow refill with large bursts, so that the counts below do not depend on timing
+	fz::token_bucket global(1, 1000);
+	fz::token_bucket user(fz::token_bucket::unlimited, 0, &global);
+	fz::token_bucket transfer1(1, 600, &user);
+	fz::token_bucket transfer2(1, 600, &user);
+
+	ASSERT_EQUAL(int64_t(600), transfer1.consume(10000));
+	ASSERT_EQUAL(int64_t(0), transfer1.consume(10000));
+
+	// Limited by what is left in the global bucket
+	ASSERT_EQUAL(int64_t(400), transfer2.consume(10000));
+	ASSERT_EQUAL(int64_t(0), transfer2.consume(10000));
+	ASSERT_EQUAL(int64_t(0), global.consume(1));
+
+	// Refunds go back into all buckets up the hierarchy
+	transfer2.refund(100);
+	ASSERT_EQUAL(int64_t(100), global.consume(10000));
+}
+
+void rate_limiter_test::test_refill()
+{
+	fz::token_bucket b(10000, 100);
+	ASSERT_EQUAL(int64_t(100), b.consume(1000));
+
+	// Rate is 10 octets per millisecond, burst limits the refill
+	auto const start = fz::monotonic_clock::now();
+	int64_t total{};
+	while (fz::monotonic_clock::now() - start < fz::duration::from_milliseconds(200)) {
+		int64_t const c = b.consume(1000);
+		CPPUNIT_ASSERT(c <= 100);
+		total += c;
+		fz::sleep(fz::duration::from_milliseconds(1));
+	}
+	int64_t const elapsed = (fz::monotonic_clock::now() - start).get_milliseconds();
+	CPPUNIT_ASSERT(total <= elapsed * 10 + 100);
+	CPPUNIT_ASSERT(total >= 1000);
+
+	b.set_limit(10000, 10);
+	fz::sleep(fz::duration::from_milliseconds(20));
+	ASSERT_EQUAL(int64_t(10), b.consume(1000));
+}
+
+namespace {
+class waiter final : public fz::event_handler
+{
+public:
+	waiter(fz::event_loop & l, fz::token_bucket & b)
+		: fz::event_handler(l)
+		, bucket_(b)
+	{}
+
+	virtual ~waiter()
+	{
+		remove_handler();
+	}
+
+	void start()
+	{
+		send_event<fz::timer_event>(0);
+	}
+
+	virtual void operator()(fz::event_base const& ev) override
+	{
+		if (ev.derived_type() != fz::timer_event::type()) {
+			return;
+		}
+
+		fz::scoped_lock l(m_);
+		while (received_ < 500) {
+			int64_t const c = bucket_.consume(500 - received_);
+			if (!c) {
+				++waits_;
+				bucket_.wait(*this, 500 - received_);
+				return;
+			}
+			received_ += c;
+		}
+		cond_.signal(l);
+	}
+
+	fz::token_bucket & bucket_;
+
+	fz::mutex m_;
+	fz::condition cond_;
+	int64_t received_{};
+	int waits_{};
+};
+}
+
+void rate_limiter_test::test_wait()
+{
+	fz::event_loop loop;
+
+	fz::token_bucket b(2000, 100);
+	waiter w(loop, b);
+
+	auto const start = fz::monotonic_clock::now();
+	fz::scoped_lock l(w.m_);
+	w.start();
+	CPPUNIT_ASSERT(w.cond_.wait(l, fz::duration::from_seconds(10)));
+	auto const elapsed = fz::monotonic_clock::now() - start;
+
+	ASSERT_EQUAL(int64_t(500), w.received_);
+	CPPUNIT_ASSERT(w.waits_ > 0);
+
+	// 400 octets beyond the initial burst at 2 per millisecond
+	CPPUNIT_ASSERT(elapsed >= fz::duration::from_milliseconds(190));
+}
+
+void rate_limiter_test::test_reader()
+{
+	std::string const data(30000, 'x');
+	write_test_file(name_, data);
+
+	fz::file f(name_, fz::file::reading);
+	CPPUNIT_ASSERT(f.opened());
+
+	fz::token_bucket b(100000, 10000);
+	fz::rate_limited_reader r(f, b);
+
+	auto const start = fz::monotonic_clock::now();
+	std::string read;
+	char buf[4096];
+	int64_t res;
+	while ((res = r.read(buf, sizeof(buf))) > 0) {
+		read.append(buf, static_cast<size_t>(res));
+	}
+	auto const elapsed = fz::monotonic_clock::now() - start;
+
+	ASSERT_EQUAL(int64_t(0), res);
+	CPPUNIT_ASSERT(read == data);
+
+	// 20000 octets beyond the initial burst at 100 per millisecond
+	CPPUNIT_ASSERT(elapsed >= fz::duration::from_milliseconds(190));
+
+	// Reading at EOF does not use up tokens
+	ASSERT_EQUAL(int64_t(0), r.read(buf, sizeof(buf)));
+	CPPUNIT_ASSERT(b.available() > 0);
+}
@@ -0,0 +1,151 @@
+#include "libfilezilla/ring_buffer.hpp"
+#include "libfilezilla/thread_pool.hpp"
+#include "libfilezilla/util.hpp"
+
+#include "test_utils.hpp"
+
+#include <string>
+
+/*
+ * This testsuite asserts the correctness of the
+ * lock-free ring buffers
+ */
+
+class ring_buffer_test final : public CppUnit::TestFixture
+{
+	CPPUNIT_TEST_SUITE(ring_buffer_test);
+	CPPUNIT_TEST(test_spsc);
+	CPPUNIT_TEST(test_spsc_threads);
+	CPPUNIT_TEST(test_mpmc);
+	CPPUNIT_TEST(test_mpmc_threads);
+	CPPUNIT_TEST(test_close);
+	CPPUNIT_TEST_SUITE_END();
+
+public:
+	void setUp() {}
+	void tearDown() {}
+
+	void test_spsc();
+	void test_spsc_threads();
+	void test_mpmc();
+	void test_mpmc_threads();
+	void test_close();
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(ring_buffer_test);
+
+namespace {
+template<typename Buffer>
+void check_fifo(Buffer & b)
+{
+	ASSERT_EQUAL(size_t(4), b.capacity());
+
+	std::string s;
+	CPPUNIT_ASSERT(!b.try_pop(s));
+
+	// Wrap around a few times
+	for (int round = 0; round < 3; ++round) {
+		for (int i = 0; i < 4; ++i) {
+			CPPUNIT_ASSERT(b.try_push(std::to_string(i)));
+		}
+		CPPUNIT_ASSERT(!b.try_push(std::string("full")));
+
+		for (int i = 0; i < 4; ++i) {
+			CPPUNIT_ASSERT(b.try_pop(s));
+			ASSERT_EQUAL(std::to_string(i), s);
+		}
+		CPPUNIT_ASSERT(!b.try_pop(s));
+	}
+
+	// Remaining elements get destroyed
+	b.try_push(std::string(100, 'x'));
+}
+
+template<typename Buffer>
+uint64_t transfer(Buffer & b, int producers, int consumers, uint64_t per_producer)
+{
+	std::atomic<uint64_t> sum{};
+	std::atomic<int> remaining_producers{producers};
+
+	fz::thread_pool pool;
+	std::vector<fz::async_task> tasks;
+	for (int i = 0; i < consumers; ++i) {
+		tasks.emplace_back(pool.spawn([&]() {
+			uint64_t local{};
+			uint64_t v;
+			while (b.pop(v)) {
+				local += v;
+			}
+			sum += local;
+		}));
+	}
+	for (int i = 0; i < producers; ++i) {
+		tasks.emplace_back(pool.spawn([&]() {
+			for (uint64_t j = 1; j <= per_producer; ++j) {
+				b.push(j);
+			}
+			if (!--remaining_producers) {
+				b.close();
+			}
+		}));
+	}
+	tasks.clear();
+
+	return sum;
+}
+}
+
+void ring_buffer_test::test_spsc()
+{
+	fz::spsc_ring_buffer<std::string> b(3);
+	check_fifo(b);
+}
+
+void ring_buffer_test::test_spsc_threads()
+{
+	// Small capacity so that both sides have to block
+	fz::spsc_ring_buffer<uint64_t> b(2);
+	ASSERT_EQUAL(uint64_t(100000) * 100001 / 2, transfer(b, 1, 1, 100000));
+}
+
+void ring_buffer_test::test_mpmc()
+{
+	fz::mpmc_ring_buffer<std::string> b(4);
+	check_fifo(b);
+}
+
+void ring_buffer_test::test_mpmc_threads()
+{
+	fz::mpmc_ring_buffer<uint64_t> b(16);
+	ASSERT_EQUAL(uint64_t(4) * 50000 * 50001 / 2, transfer(b, 4, 3, 50000));
+}
+
+void ring_buffer_test::test_close()
+{
+	fz::mpmc_ring_buffer<int> b(2);
+	CPPUNIT_ASSERT(b.push(1));
+	CPPUNIT_ASSERT(b.push(2));
+
+	fz::thread_pool pool;
+
+	// Blocked producer fails on close
+	bool pushed{true};
+	fz::async_task task = pool.spawn([&]() {
+		pushed = b.push(3);
+	});
+
+	fz::sleep(fz::duration::from_milliseconds(50));
+	CPPUNIT_ASSERT(!b.closed());
+	b.close();
+	task.join();
+	CPPUNIT_ASSERT(!pushed);
+
+	// Remaining elements can still be popped
+	int v{};
+	CPPUNIT_ASSERT(b.pop(v));
+	ASSERT_EQUAL(1, v);
+	CPPUNIT_ASSERT(b.pop(v));
+	ASSERT_EQUAL(2, v);
+	CPPUNIT_ASSERT(!b.pop(v));
+	CPPUNIT_ASSERT(!b.push(4));
+}
@@ -0,0 +1,132 @@
+#include "libfilezilla/semaphore.hpp"
+#include "libfilezilla/thread_pool.hpp"
+
+#include "test_utils.hpp"
+
+#include <atomic>
+
+/*
+ * This testsuite asserts the correctness of the
+ * semaphore, latch and barrier primitives
+ */
+
+class semaphore_test final : public CppUnit::TestFixture
+{
+	CPPUNIT_TEST_SUITE(semaphore_test);
+	CPPUNIT_TEST(test_semaphore);
+	CPPUNIT_TEST(test_semaphore_threads);
+	CPPUNIT_TEST(test_latch);
+	CPPUNIT_TEST(test_barrier);
+	CPPUNIT_TEST_SUITE_END();
+
+public:
+	void setUp() {}
+	void tearDown() {}
+
+	void test_semaphore();
+	void test_semaphore_threads();
+	void test_latch();
+	void test_barrier();
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(semaphore_test);
+
+void semaphore_test::test_semaphore()
+{
+	fz::semaphore s(2);
+	CPPUNIT_ASSERT(s.try_acquire());
+	CPPUNIT_ASSERT(s.acquire(fz::duration::from_milliseconds(10)));
+	CPPUNIT_ASSERT(!s.try_acquire());
+
+	auto const start = fz::monotonic_clock::now();
+	CPPUNIT_ASSERT(!s.acquire(fz::duration::from_milliseconds(50)));
+	CPPUNIT_ASSERT((fz::monotonic_clock::now() - start) >= fz::duration::from_milliseconds(50));
+	CPPUNIT_ASSERT(!s.acquire_until(start));
+
+	s.release(3);
+	s.acquire();
+	s.acquire();
+	s.acquire();
+	CPPUNIT_ASSERT(!s.try_acquire());
+}
+
+void semaphore_test::test_semaphore_threads()
+{
+	// Ping-pong between two threads, each side always has to wait
+	fz::semaphore ping;
+	fz::semaphore pong;
+	int const rounds = 10000;
+	int counter{};
+
+	fz::thread_pool pool;
+	fz::async_task task = pool.spawn([&]() {
+		for (int i = 0; i < rounds; ++i) {
+			ping.acquire();
+			++counter;
+			pong.release();
+		}
+	});
+
+	for (int i = 0; i < rounds; ++i) {
+		ping.release();
+		pong.acquire();
+	}
+	task.join();
+
+	ASSERT_EQUAL(rounds, counter);
+}
+
+void semaphore_test::test_latch()
+{
+	fz::latch done(4);
+	CPPUNIT_ASSERT(!done.try_wait());
+	CPPUNIT_ASSERT(!done.wait_until(fz::monotonic_clock::now() + fz::duration::from_milliseconds(10)));
+
+	// Fan-out/fan-in without joining the individual tasks
+	std::atomic<int> sum{};
+	fz::thread_pool pool;
+	for (int i = 1; i <= 4; ++i) {
+		pool.spawn([&, i]() {
+			sum += i;
+			done.count_down();
+		}).detach();
+	}
+
+	done.wait();
+	CPPUNIT_ASSERT(done.try_wait());
+	ASSERT_EQUAL(10, sum.load());
+	CPPUNIT_ASSERT(done.wait_until(fz::monotonic_clock::now()));
+}
+
+void semaphore_test::test_barrier()
+{
+	int const threads = 4;
+	int const phases = 100;
+
+	std::atomic<int> arrived{};
+	std::atomic<bool> mismatch{};
+	int completions{};
+
+	fz::barrier b(threads, [&]() {
+		// All threads of this phase have arrived, none of the next one yet
+		if (arrived != (completions + 1) * threads) {
+			mismatch = true;
+		}
+		++completions;
+	});
+
+	fz::thread_pool pool;
+	std::vector<fz::async_task> tasks;
+	for (int i = 0; i < threads; ++i) {
+		tasks.emplace_back(pool.spawn([&]() {
+			for (int phase = 0; phase < phases; ++phase) {
+				++arrived;
+				b.arrive_and_wait();
+			}
+		}));
+	}
+	tasks.clear();
+
+	CPPUNIT_ASSERT(!mismatch);
+	ASSERT_EQUAL(phases, completions);
+}
@@ -1,7 +1,9 @@
 #ifndef LIBFILEZILLA_TEST_UTILS_HEADER
 #define LIBFILEZILLA_TEST_UTILS_HEADER
 
+#include "libfilezilla/file.hpp"
 #include "libfilezilla/string.hpp"
+#include "libfilezilla/util.hpp"
 
 #include <cppunit/TestAssert.h>
 #include <cppunit/extensions/HelperMacros.h>
@@ -41,4 +43,32 @@ void inline assert_equal_data(V const& expected, V const& actual, std::string co
 #define ASSERT_EQUAL_DATA(expected, actual, data) assert_equal_data((expected), (actual), #actual, data, CPPUNIT_SOURCELINE())
 #define ASSERT_EQUAL(expected, actual) assert_equal_data((expected), (actual), #actual, std::string(), CPPUNIT_SOURCELINE())
 
+/// Returns a unique name for a temporary file in the working directory, e.g. fz_file_test_12345
+fz::native_string inline test_file_name(std::string const& suite)
+{
+	return fz::to_native("fz_" + suite + "_test_" + std::to_string(fz::random_number(0, 1000000000)));
+}
+
+/// Replaces the contents of the file with the data
+void inline write_test_file(fz::native_string const& name, std::string const& data)
+{
+	fz::file f(name, fz::file::writing, fz::file::empty);
+	CPPUNIT_ASSERT(f.opened());
+	if (!data.empty()) {
+		ASSERT_EQUAL(static_cast<int64_t>(data.size()), f.write(data.c_str(), static_cast<int64_t>(data.size())));
+	}
+}
+
+/// Returns the contents of the file
+std::string inline read_test_file(fz::native_string const& name)
+{
+	fz::file f(name, fz::file::reading);
+	CPPUNIT_ASSERT(f.opened());
+	std::string ret(static_cast<size_t>(f.size()), '\0');
+	if (!ret.empty()) {
+		ASSERT_EQUAL(static_cast<int64_t>(ret.size()), f.read(&ret[0], static_cast<int64_t>(ret.size())));
+	}
+	return ret;
+}
+
 #endif
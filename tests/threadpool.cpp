@@ -0,0 +1,269 @@
+#include "libfilezilla/thread_pool.hpp"
+#include "libfilezilla/thread.hpp"
+#include "libfilezilla/util.hpp"
+
+#include "test_utils.hpp"
+
+#include <algorithm>
+#include <atomic>
+
+class thread_pool_test final : public CppUnit::TestFixture
+{
+	CPPUNIT_TEST_SUITE(thread_pool_test);
+	CPPUNIT_TEST(test_spawn);
+	CPPUNIT_TEST(test_affinity);
+	CPPUNIT_TEST(test_numa);
+	CPPUNIT_TEST(test_idle_timeout);
+	CPPUNIT_TEST(test_priority);
+	CPPUNIT_TEST(test_cancel);
+	CPPUNIT_TEST_SUITE_END();
+
+public:
+	void setUp() {}
+	void tearDown() {}
+
+	void test_spawn();
+	void test_affinity();
+	void test_numa();
+	void test_idle_timeout();
+	void test_priority();
+	void test_cancel();
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(thread_pool_test);
+
+void thread_pool_test::test_spawn()
+{
+	fz::thread_pool pool;
+
+	std::atomic<int> v{};
+	for (int i = 0; i < 10; ++i) {
+		fz::async_task a = pool.spawn([&v]() { ++v; });
+		fz::async_task b = pool.spawn([&v]() { ++v; });
+		CPPUNIT_ASSERT(a);
+		CPPUNIT_ASSERT(b);
+		a.join();
+		CPPUNIT_ASSERT(!a);
+	}
+
+	ASSERT_EQUAL(20, v.load());
+}
+
+void thread_pool_test::test_affinity()
+{
+	std::vector<int> const allowed = fz::current_thread_affinity();
+	if (allowed.empty()) {
+		// Platform does not support affinity
+		return;
+	}
+
+	int const cpu = allowed.back();
+
+	fz::thread_pool pool;
+	pool.set_affinity({cpu});
+
+	std::vector<int> placement;
+	int ran_on{-1};
+	pool.spawn([&]() {
+		placement = fz::current_thread_affinity();
+		ran_on = fz::current_cpu();
+	}).join();
+
+	CPPUNIT_ASSERT(placement == std::vector<int>{cpu});
+	ASSERT_EQUAL(cpu, ran_on);
+
+	// Lifting the restriction applies to existing threads
+	pool.set_affinity({});
+	pool.spawn([&]() {
+		placement = fz::current_thread_affinity();
+	}).join();
+	CPPUNIT_ASSERT(placement.size() >= allowed.size());
+}
+
+void thread_pool_test::test_numa()
+{
+	auto const nodes = fz::numa_nodes();
+	CPPUNIT_ASSERT(!nodes.empty());
+	for (auto const& node : nodes) {
+		CPPUNIT_ASSERT(!node.empty());
+	}
+
+	int const cpu = nodes.back().front();
+	ASSERT_EQUAL(static_cast<int>(nodes.size() - 1), fz::numa_node_of_cpu(cpu));
+
+	fz::thread_pool pool;
+	pool.set_numa_placement(true);
+
+	std::atomic<int> v{};
+	{
+		std::vector<fz::async_task> tasks;
+		for (int i = 0; i < 8; ++i) {
+			tasks.emplace_back(pool.spawn([&v]() { ++v; }));
+		}
+	}
+	ASSERT_EQUAL(8, v.load());
+
+	std::vector<int> const allowed = fz::current_thread_affinity();
+	if (!allowed.empty()) {
+		// Tasks stay on the node the spawning thread runs on
+		int const node = fz::numa_node_of_cpu(allowed.back());
+		CPPUNIT_ASSERT(fz::set_current_thread_affinity(nodes[node]));
+
+		int task_node{-1};
+		pool.spawn([&]() {
+			std::vector<int> const placement = fz::current_thread_affinity();
+			task_node = placement.empty() ? -1 : fz::numa_node_of_cpu(placement.front());
+		}).join();
+
+		fz::set_current_thread_affinity(allowed);
+		ASSERT_EQUAL(node, task_node);
+	}
+}
+
+void thread_pool_test::test_idle_timeout()
+{
+	fz::thread_pool pool;
+	pool.set_idle_timeout(fz::duration::from_milliseconds(20), 1);
+
+	{
+		std::vector<fz::async_task> tasks;
+		for (int i = 0; i < 4; ++i) {
+			tasks.emplace_back(pool.spawn([]() { fz::sleep(fz::duration::from_milliseconds(10)); }));
+		}
+	}
+
+	auto stats = pool.get_statistics();
+	ASSERT_EQUAL(size_t(4), stats.threads);
+	ASSERT_EQUAL(uint64_t(4), stats.tasks_run);
+
+	uint64_t runs{};
+	for (auto const& v : stats.run_time) {
+		runs += v;
+	}
+	ASSERT_EQUAL(uint64_t(4), runs);
+
+	// All but one thread exit once idle for long enough
+	auto const start = fz::monotonic_clock::now();
+	while (pool.get_statistics().threads > 1 && (fz::monotonic_clock::now() - start) < fz::duration::from_seconds(5)) {
+		fz::sleep(fz::duration::from_milliseconds(10));
+	}
+
+	stats = pool.get_statistics();
+	ASSERT_EQUAL(size_t(1), stats.threads);
+	ASSERT_EQUAL(size_t(1), stats.idle);
+	ASSERT_EQUAL(uint64_t(3), stats.threads_reaped);
+
+	// Pool still works after reaping
+	int v{};
+	pool.spawn([&v]() { v = 5; }).join();
+	ASSERT_EQUAL(5, v);
+}
+
+namespace {
+// Blocks the pool's only thread until opened
+struct gate final
+{
+	void wait()
+	{
+		fz::scoped_lock l(m_);
+		if (!open_) {
+			cond_.wait(l);
+		}
+	}
+
+	void open()
+	{
+		fz::scoped_lock l(m_);
+		open_ = true;
+		cond_.signal(l);
+	}
+
+	fz::mutex m_;
+	fz::condition cond_;
+	bool open_{};
+};
+}
+
+void thread_pool_test::test_priority()
+{
+	fz::thread_pool pool;
+	pool.set_max_threads(1);
+
+	gate g;
+	fz::async_task blocker = pool.spawn([&g]() { g.wait(); });
+
+	fz::mutex m;
+	std::vector<int> order;
+	auto add = [&](int v) {
+		return [&m, &order, v]() {
+			fz::scoped_lock l(m);
+			order.push_back(v);
+		};
+	};
+
+	fz::async_task a = pool.spawn(add(1), fz::thread_pool::low);
+	fz::async_task b = pool.spawn(add(2), fz::thread_pool::normal);
+	fz::async_task c = pool.spawn(add(3), fz::thread_pool::high);
+	fz::async_task d = pool.spawn(add(4), fz::thread_pool::high);
+
+	ASSERT_EQUAL(size_t(4), pool.get_statistics().queued);
+
+	g.open();
+	a.join();
+	b.join();
+	c.join();
+	d.join();
+
+	CPPUNIT_ASSERT((order == std::vector<int>{3, 4, 2, 1}));
+	ASSERT_EQUAL(size_t(1), pool.get_statistics().threads);
+}
+
+void thread_pool_test::test_cancel()
+{
+	fz::thread_pool pool;
+	pool.set_max_threads(1);
+
+	gate g;
+	fz::async_task blocker = pool.spawn([&g]() { g.wait(); });
+
+	fz::cancellation_token token;
+
+	auto resource = std::make_shared<int>(5);
+	std::weak_ptr<int> weak = resource;
+
+	bool ran{};
+	fz::async_task queued = pool.spawn([resource, &ran]() { ran = true; }, fz::thread_pool::normal, token);
+	resource.reset();
+	CPPUNIT_ASSERT(!weak.expired());
+
+	// Cancelling releases the queued task right away
+	token.cancel();
+	CPPUNIT_ASSERT(weak.expired());
+	CPPUNIT_ASSERT(token.cancelled());
+	queued.join();
+
+	g.open();
+	blocker.join();
+	CPPUNIT_ASSERT(!ran);
+
+	// Already cancelled tokens prevent the task from running
+	pool.spawn([&ran]() { ran = true; }, fz::thread_pool::normal, token).join();
+	CPPUNIT_ASSERT(!ran);
+
+	// Running tasks can poll the token
+	fz::cancellation_token token2;
+	gate started;
+	fz::async_task running = pool.spawn([&]() {
+		started.open();
+		while (!token2.cancelled()) {
+			fz::sleep(fz::duration::from_milliseconds(1));
+		}
+		ran = true;
+	}, fz::thread_pool::low, token2);
+	started.wait();
+	token2.cancel();
+	running.join();
+	CPPUNIT_ASSERT(ran);
+
+	ASSERT_EQUAL(uint64_t(2), pool.get_statistics().tasks_cancelled);
+}
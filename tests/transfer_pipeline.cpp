@@ -0,0 +1,198 @@
+#include "libfilezilla/file.hpp"
+#include "libfilezilla/hash.hpp"
+#include "libfilezilla/string.hpp"
+#include "libfilezilla/thread_pool.hpp"
+#include "libfilezilla/transfer_pipeline.hpp"
+#include "libfilezilla/util.hpp"
+
+#include "test_utils.hpp"
+
+#include <atomic>
+
+/*
+ * This testsuite asserts the correctness of the
+ * pipelined transfer engine
+ */
+
+class transfer_pipeline_test final : public CppUnit::TestFixture
+{
+	CPPUNIT_TEST_SUITE(transfer_pipeline_test);
+	CPPUNIT_TEST(test_copy);
+	CPPUNIT_TEST(test_stages);
+	CPPUNIT_TEST(test_abort);
+	CPPUNIT_TEST(test_overlap);
+	CPPUNIT_TEST_SUITE_END();
+
+public:
+	void setUp();
+	void tearDown();
+
+	void test_copy();
+	void test_stages();
+	void test_abort();
+	void test_overlap();
+
+private:
+	fz::native_string name_;
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(transfer_pipeline_test);
+
+void transfer_pipeline_test::setUp()
+{
+	name_ = test_file_name("transfer_pipeline");
+}
+
+void transfer_pipeline_test::tearDown()
+{
+	fz::remove_file(name_);
+	fz::remove_file(name_ + fzT("_copy"));
+}
+
+void transfer_pipeline_test::test_copy()
+{
+	std::string data;
+	for (int i = 0; i < 100000; ++i) {
+		data += std::to_string(i) + "\n";
+	}
+	write_test_file(name_, data);
+
+	fz::file src(name_, fz::file::reading);
+	fz::file dst(name_ + fzT("_copy"), fz::file::writing, fz::file::empty);
+	CPPUNIT_ASSERT(src.opened() && dst.opened());
+
+	fz::thread_pool pool;
+	fz::transfer_pipeline pipeline(pool, 3, 4096);
+
+	int64_t last_progress{};
+	ASSERT_EQUAL(int64_t(data.size()), pipeline.run(src, dst, 0, -1, [&](int64_t copied) {
+		CPPUNIT_ASSERT(copied > last_progress);
+		last_progress = copied;
+		return true;
+	}));
+	ASSERT_EQUAL(int64_t(data.size()), last_progress);
+	dst.close();
+	CPPUNIT_ASSERT(read_test_file(name_ + fzT("_copy")) == data);
+
+	// Partial range, source shorter than requested
+	fz::file dst2(name_ + fzT("_copy"), fz::file::writing, fz::file::empty);
+	ASSERT_EQUAL(int64_t(100), pipeline.run(src, dst2, 1000, 100));
+	ASSERT_EQUAL(int64_t(1100), dst2.size());
+	ASSERT_EQUAL(int64_t(data.size() - 5000), pipeline.run(src, dst2, 5000, static_cast<int64_t>(data.size())));
+	dst2.close();
+	ASSERT_EQUAL(data.substr(5000), read_test_file(name_ + fzT("_copy")).substr(5000));
+}
+
+void transfer_pipeline_test::test_stages()
+{
+	std::string data(300000, '\0');
+	for (size_t i = 0; i < data.size(); ++i) {
+		data[i] = static_cast<char>(i * 7);
+	}
+	write_test_file(name_, data);
+
+	fz::file src(name_, fz::file::reading);
+	fz::file dst(name_ + fzT("_copy"), fz::file::writing, fz::file::empty);
+	CPPUNIT_ASSERT(src.opened() && dst.opened());
+
+	fz::thread_pool pool;
+	fz::transfer_pipeline pipeline(pool, 4, 10000);
+
+	// Stages run in order: hash the original, then transform, then hash the transformed data
+	fz::hash_accumulator before(fz::hash_algorithm::sha256);
+	fz::hash_accumulator after(fz::hash_algorithm::sha256);
+	int64_t expected_offset{};
+	pipeline.add_stage([&](uint8_t*, size_t size, int64_t offset) {
+		if (offset != expected_offset) {
+			return false;
+		}
+		expected_offset += static_cast<int64_t>(size);
+		return true;
+	});
+	pipeline.add_hash_stage(before);
+	pipeline.add_stage([](uint8_t* p, size_t size, int64_t) {
+		for (size_t i = 0; i < size; ++i) {
+			p[i] ^= 0x5a;
+		}
+		return true;
+	});
+	pipeline.add_hash_stage(after);
+
+	ASSERT_EQUAL(int64_t(data.size()), pipeline.run(src, dst));
+	dst.close();
+
+	std::string transformed = data;
+	for (auto & c : transformed) {
+		c ^= 0x5a;
+	}
+	CPPUNIT_ASSERT(read_test_file(name_ + fzT("_copy")) == transformed);
+	CPPUNIT_ASSERT(before.digest() == fz::sha256(data));
+	CPPUNIT_ASSERT(after.digest() == fz::sha256(transformed));
+}
+
+void transfer_pipeline_test::test_abort()
+{
+	write_test_file(name_, std::string(100000, 'x'));
+
+	fz::file src(name_, fz::file::reading);
+	fz::file dst(name_ + fzT("_copy"), fz::file::writing, fz::file::empty);
+	CPPUNIT_ASSERT(src.opened() && dst.opened());
+
+	fz::thread_pool pool;
+	{
+		fz::transfer_pipeline pipeline(pool, 2, 1000);
+		ASSERT_EQUAL(int64_t(-1), pipeline.run(src, dst, 0, -1, [](int64_t copied) { return copied < 5000; }));
+		CPPUNIT_ASSERT(dst.size() < 100000);
+	}
+	{
+		fz::transfer_pipeline pipeline(pool, 2, 1000);
+		pipeline.add_stage([](uint8_t*, size_t, int64_t offset) { return offset < 50000; });
+		ASSERT_EQUAL(int64_t(-1), pipeline.run(src, dst));
+	}
+
+	// Pool too small for the reader and the stage
+	{
+		fz::thread_pool small;
+		small.set_max_threads(1);
+		fz::transfer_pipeline pipeline(small);
+		pipeline.add_stage([](uint8_t*, size_t, int64_t) { return true; });
+		ASSERT_EQUAL(int64_t(-1), pipeline.run(src, dst));
+	}
+
+	// Destination not writable
+	fz::file ro(name_, fz::file::reading);
+	fz::transfer_pipeline pipeline(pool);
+	ASSERT_EQUAL(int64_t(-1), pipeline.run(src, ro));
+}
+
+void transfer_pipeline_test::test_overlap()
+{
+	write_test_file(name_, std::string(100000, 'x'));
+
+	fz::file src(name_, fz::file::reading);
+	fz::file dst(name_ + fzT("_copy"), fz::file::writing, fz::file::empty);
+	CPPUNIT_ASSERT(src.opened() && dst.opened());
+
+	fz::thread_pool pool;
+	fz::transfer_pipeline pipeline(pool, 4, 10000);
+
+	// Two slow stages. Record how many of them are working at the same time.
+	std::atomic<int> active{};
+	std::atomic<int> max_active{};
+	auto const slow = [&](uint8_t*, size_t, int64_t) {
+		int const now = ++active;
+		int prev = max_active;
+		while (prev < now && !max_active.compare_exchange_weak(prev, now)) {
+		}
+		fz::sleep(fz::duration::from_milliseconds(20));
+		--active;
+		return true;
+	};
+	pipeline.add_stage(slow);
+	pipeline.add_stage(slow);
+
+	ASSERT_EQUAL(int64_t(100000), pipeline.run(src, dst));
+
+	// With 10 chunks passing through both stages, they must have overlapped
+	ASSERT_EQUAL(2, max_active.load());
+}